@@ -0,0 +1,75 @@
+#include <lang/Exception.hpp>
+
+#include "BurstQueue.hpp"
+
+#include <cstring>
+
+static_assert(FRAME_MODULUS % UL_HORIZON == 0, "ring index must not jump at FN wrap");
+
+boolean BurstQueue::put(int tn, int fn, uint8_t gain, const uint8_t *bits, int n) {
+	if (tn < 0 || tn > 7) throw IllegalArgumentException(String::format("TN=%d", tn));
+	if (fn < 0 || fn >= FRAME_MODULUS) throw IllegalArgumentException(String::format("FN=%d", fn));
+	if (n < 0 || n > TRXD_BITS) throw IllegalArgumentException(String::format("burst bits %d", n));
+	if (head >= 0) {
+		int d = GsmClock::fnDiff(fn, head);
+		if (d < 0) {
+			++late;
+			return false;
+		}
+		if (d >= UL_HORIZON) {
+			++rejected;
+			return false;
+		}
+	}
+	Slot& s = slots[tn][fn % UL_HORIZON];
+	if (s.fn == fn) ++replaced;
+	else if (s.fn >= 0) ++late; // left from a frame never flushed
+	s.fn = fn;
+	s.gain = gain;
+	memcpy(s.bits, bits, (size_t)n);
+	memset(s.bits + n, 0, (size_t)(TRXD_BITS - n));
+	++queued;
+	return true;
+}
+
+// frames head..fn-1 were skipped (loop late or clock jump)
+void BurstQueue::dropLate(int fn) {
+	int d = GsmClock::fnDiff(fn, head);
+	if (d > UL_HORIZON) d = UL_HORIZON;
+	for (int i = 0; i < d; ++i) {
+		int f = GsmClock::fnAdd(head, i);
+		for (int tn = 0; tn < 8; ++tn) {
+			Slot& s = slots[tn][f % UL_HORIZON];
+			if (s.fn == f) {
+				s.fn = -1;
+				++late;
+			}
+		}
+	}
+}
+
+int BurstQueue::flush(int fn, TrxdBatch& out) {
+	if (head >= 0 && fn != head) dropLate(fn);
+	int n = 0;
+	for (int tn = 0; tn < 8; ++tn) {
+		Slot& s = slots[tn][fn % UL_HORIZON];
+		if (s.fn < 0) continue;
+		if (s.fn == fn) {
+			if (!out.add((uint8_t)tn, (uint32_t)fn, s.gain, s.bits, TRXD_BITS)) break;
+			++sent;
+			++n;
+		}
+		else if (GsmClock::fnDiff(s.fn, fn) > 0) continue; // later frame, same index
+		else ++late;
+		s.fn = -1;
+	}
+	head = GsmClock::fnAdd(fn, 1);
+	return n;
+}
+
+void BurstQueue::clear() {
+	for (int tn = 0; tn < 8; ++tn) {
+		for (int i = 0; i < UL_HORIZON; ++i) slots[tn][i].fn = -1;
+	}
+	head = -1;
+}
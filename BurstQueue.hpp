@@ -0,0 +1,38 @@
+#ifndef BURSTQUEUE_HPP
+#define BURSTQUEUE_HPP
+
+#include "TrxProtocol.hpp"
+#include "GsmClock.hpp"
+
+#define UL_HORIZON 64 // frames a burst may be queued ahead, divides FRAME_MODULUS
+
+// Uplink bursts waiting for their frame, one ring per timeslot indexed by fn % UL_HORIZON
+// (FRAME_MODULUS is a multiple of UL_HORIZON, so the index runs on across the wrap).
+// flush() takes the frame now due at the transceiver (clock + CLOCK_ADVANCE), bursts of
+// frames it passed are late and dropped. Used by the loop thread only.
+class BurstQueue : extends Object {
+private:
+	struct Slot {
+		int fn = -1;            // frame of queued burst, -1 empty
+		uint8_t gain;
+		uint8_t bits[TRXD_BITS];
+	};
+	Slot slots[8][UL_HORIZON];
+	int head = -1;              // next frame to flush, -1 before first flush
+
+	void dropLate(int fn);
+public:
+	jlong queued = 0, sent = 0;
+	jlong late = 0;             // dropped, frame already gone
+	jlong rejected = 0;         // beyond horizon
+	jlong replaced = 0;         // queued twice for same slot, last one wins
+
+	// false when the frame was flushed already or is beyond horizon
+	boolean put(int tn, int fn, uint8_t gain, const uint8_t *bits, int n = TRXD_BITS);
+	// bursts of frame fn to out (TRXD_BATCH holds a frame), returns count
+	int flush(int fn, TrxdBatch& out);
+	int next() const { return head; }
+	void clear();
+};
+
+#endif
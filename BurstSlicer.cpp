@@ -0,0 +1,91 @@
+#include <lang/System.hpp>
+
+#include "BurstSlicer.hpp"
+
+#include <cstring>
+
+BurstSlicer::BurstSlicer(SpscSampleBuffer& rxb, const GsmClock& clock, int tail) : rxb(rxb), clock(clock), tail(tail),
+		fn(0), tn(0), ts(0), pending(0), hopping(null), arfcn(-1), lost(0), copied(0) {
+	if (!clock.isValid()) throw IllegalStateException("BurstSlicer: clock not synchronized");
+	if (!rxb.isMirrored()) {
+		LOGW("BurstSlicer: rx buffer not mirrored, timeslots at ring end will be copied");
+	}
+}
+
+String BurstSlicer::toString() const {
+	return String::format("BurstSlicer(fn=%d,tn=%d,ts=%ld,lost=%ld,copied=%ld)", fn, tn, ts, lost, copied);
+}
+
+void BurstSlicer::start(jlong t) {
+	GsmTime g = clock.toGsm(t);
+	fn = g.fn;
+	tn = g.tn;
+	ts = tick(fn, tn, t);
+	if (ts < t) {
+		if (++tn == 8) { tn = 0; fn = GsmClock::fnAdd(fn, 1); }
+		ts = tick(fn, tn, t);
+	}
+	pending = 0;
+}
+
+void BurstSlicer::release() {
+	if (pending > 0) rxb.release(pending);
+	pending = 0;
+}
+
+int BurstSlicer::next(BurstView *v, int max) {
+	release();
+
+	// timeslot boundaries are computed from clock, so rounding never accumulates
+	int f = fn, t = tn;
+	jlong end = ts;
+	for (int k = 0; k < max; ++k) {
+		v[k].fn = f;
+		v[k].tn = t;
+		v[k].ts = end;
+		if (++t == 8) { t = 0; f = GsmClock::fnAdd(f, 1); }
+		jlong e = tick(f, t, end);
+		v[k].len = (int)(e - end);
+		v[k].settled = rxb.isSettled(end, v[k].len);
+		v[k].arfcn = hopping ? hopping->arfcn(v[k].fn) : arfcn;
+		end = e;
+	}
+
+	int want = (int)(end - ts) + tail;
+	int n = want;
+	const short *p = rxb.peek(ts, n);
+	if (n < 0) {
+		int ofn = fn, otn = tn;
+		start(rxb.first());
+		lost += GsmClock::fnDiff(fn, ofn)*8 + tn - otn;
+		LOGW("BurstSlicer: overflow, restart at fn=%d tn=%d", fn, tn);
+		return 0;
+	}
+
+	int cnt = 0;
+	while (cnt < max && v[cnt].ts - ts + v[cnt].len + tail <= n) {
+		v[cnt].ptr = p + 2*(v[cnt].ts - ts);
+		++cnt;
+	}
+	if (cnt == 0 && n > 0 && !rxb.isMirrored()) {
+		// contiguous part ended at ring end, copy this one timeslot
+		int l = v[0].len + tail;
+		if (rxb.available(ts) < l) return 0;
+		if (staging.length < 2*l) staging = Array<short>(2*l);
+		memcpy(&staging[0], p, 2*n*sizeof(short));
+		int r = l - n;
+		const short *p2 = rxb.peek(ts + n, r);
+		memcpy(&staging[2*n], p2, 2*r*sizeof(short));
+		v[0].ptr = &staging[0];
+		cnt = 1;
+		++copied;
+	}
+	if (cnt == 0) return 0;
+
+	const BurstView& b = v[cnt-1];
+	fn = b.tn == 7 ? GsmClock::fnAdd(b.fn, 1) : b.fn;
+	tn = (b.tn + 1) & 7;
+	ts = b.ts + b.len;
+	pending = ts;
+	return cnt;
+}
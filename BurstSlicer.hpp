@@ -0,0 +1,55 @@
+#ifndef BURSTSLICER_HPP
+#define BURSTSLICER_HPP
+
+#include "RadioDevice.hpp"
+#include "GsmClock.hpp"
+#include "Hopping.hpp"
+
+#include <cmath>
+
+struct BurstView {
+	int fn;
+	int tn;
+	jlong ts;          // tick of first sample
+	const short *ptr;  // sc16 I/Q samples in rx buffer, holds len + tail samples
+	int len;           // timeslot length, 156 or 157 symbols at 1 sps (TN0 and TN4 are longer)
+	boolean settled;   // false if taken while LO was settling after retune
+	int arfcn;         // ARFCN the burst was received on (-1 unknown)
+};
+
+// Cuts rx buffer stream into timeslots according to clock, without copying samples.
+// Views point into the (mirrored) ring and stay valid until next() or release().
+class BurstSlicer : extends Object {
+private:
+	SpscSampleBuffer& rxb;
+	const GsmClock& clock;
+	int tail;          // samples available after the timeslot end (for equalizer)
+	int fn, tn;        // next timeslot
+	jlong ts;          // its start tick
+	jlong pending;     // end of returned views, released on next call
+	Array<short> staging; // timeslot crossing end of ring which is not mirrored
+	const HoppingSequence *hopping; // ARFCN per frame (null - fixed arfcn)
+	int arfcn;
+	jlong lost;        // timeslots skipped on rx buffer overflow
+	jlong copied;
+
+	jlong tick(int fn, int tn, jlong near) const {
+		return (jlong)ceil(clock.toTick(fn, tn, near) - 1e-6);
+	}
+public:
+	BurstSlicer(SpscSampleBuffer& rxb, const GsmClock& clock, int tail=0);
+	String toString() const;
+
+	// first timeslot is the one starting at or after t
+	void start(jlong t);
+	// up to max complete timeslots, 0 if none available yet
+	int next(BurstView *v, int max);
+	void release();
+	void setArfcn(int arfcn) { this->arfcn = arfcn; hopping = null; }
+	void setHopping(const HoppingSequence *seq) { hopping = seq; }
+
+	jlong getLost() const { return lost; }
+	jlong getCopied() const { return copied; }
+};
+
+#endif
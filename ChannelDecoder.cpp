@@ -0,0 +1,211 @@
+#include <lang/System.hpp>
+
+#include "ChannelDecoder.hpp"
+#include "GsmCoding.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DECODER_X86
+#endif
+
+namespace {
+const int MAX_LANES = 8;
+const int INFO_BITS = 184;
+const int STEPS = 228;   // info + parity + tail
+const uint64_t FIRE_POLY = 0x0004820009ULL; // (D23 + 1)(D17 + D3 + 1) without D40
+const float BIG = 1e30f;
+
+// coded bit k -> burst k%4, position in the 114 data bits of burst
+inline int burstPos(int k) {
+	int j = 2*((49*k) % 57) + ((k % 8) / 4);
+	return j < 57 ? 3 + j : 88 + j - 57;
+}
+
+// sign of branch metric for x=0 predecessor, branch for x=1 has opposite sign
+struct Branches {
+	int sel[CONV_STATES]; // 0: s0+s1, 1: s0-s1, 2: -s0+s1, 3: -s0-s1
+	Branches() {
+		for (int ns = 0; ns < CONV_STATES; ++ns) {
+			int u = ns & 1, st = ns >> 1;
+			int c0 = u ^ (st >> 2 & 1), c1 = u ^ (st & 1) ^ (st >> 2 & 1);
+			sel[ns] = c0*2 + c1;
+		}
+	}
+} branches;
+
+// forward ACS of n steps, maximizing correlation, state 0 at start
+typedef void (*Acs)(const float *soft, int n, uint8_t *dec, float *m);
+
+void acsScalar(const float *soft, int n, uint8_t *dec, float *m) {
+	const int W = 4;
+	float nm[CONV_STATES*W];
+	for (int s = 0; s < CONV_STATES; ++s)
+		for (int l = 0; l < W; ++l) m[s*W + l] = s == 0 ? 0 : -BIG;
+	for (int i = 0; i < n; ++i) {
+		const float *s0 = soft + 2*i*W, *s1 = s0 + W;
+		for (int ns = 0; ns < CONV_STATES; ++ns) {
+			int st = ns >> 1, sel = branches.sel[ns];
+			uint8_t d = 0;
+			for (int l = 0; l < W; ++l) {
+				float bm = ((sel & 2) ? -s0[l] : s0[l]) + ((sel & 1) ? -s1[l] : s1[l]);
+				float a = m[st*W + l] + bm, b = m[(st | 8)*W + l] - bm;
+				if (b > a) { a = b; d |= (uint8_t)(1 << l); }
+				nm[ns*W + l] = a;
+			}
+			dec[i*CONV_STATES + ns] = d;
+		}
+		memcpy(m, nm, sizeof(nm));
+	}
+}
+boolean supportedScalar() { return true; }
+
+#ifdef DECODER_X86
+// SSE2: 4 blocks per vector
+__attribute__((target("sse2")))
+void acsSSE2(const float *soft, int n, uint8_t *dec, float *mo) {
+	__m128 m[CONV_STATES], nm[CONV_STATES];
+	for (int s = 0; s < CONV_STATES; ++s) m[s] = _mm_set1_ps(s == 0 ? 0 : -BIG);
+	for (int i = 0; i < n; ++i) {
+		__m128 s0 = _mm_loadu_ps(soft + 8*i), s1 = _mm_loadu_ps(soft + 8*i + 4);
+		__m128 bm[4];
+		bm[0] = _mm_add_ps(s0, s1);
+		bm[1] = _mm_sub_ps(s0, s1);
+		bm[2] = _mm_sub_ps(_mm_setzero_ps(), bm[1]);
+		bm[3] = _mm_sub_ps(_mm_setzero_ps(), bm[0]);
+		for (int ns = 0; ns < CONV_STATES; ++ns) {
+			int st = ns >> 1;
+			__m128 b0 = bm[branches.sel[ns]];
+			__m128 a = _mm_add_ps(m[st], b0), b = _mm_sub_ps(m[st | 8], b0);
+			dec[i*CONV_STATES + ns] = (uint8_t)_mm_movemask_ps(_mm_cmpgt_ps(b, a));
+			nm[ns] = _mm_max_ps(a, b);
+		}
+		for (int s = 0; s < CONV_STATES; ++s) m[s] = nm[s];
+	}
+	for (int s = 0; s < CONV_STATES; ++s) _mm_storeu_ps(mo + 4*s, m[s]);
+}
+boolean supportedSSE2() { return __builtin_cpu_supports("sse2"); }
+
+// AVX2: 8 blocks per vector
+__attribute__((target("avx2")))
+void acsAVX2(const float *soft, int n, uint8_t *dec, float *mo) {
+	__m256 m[CONV_STATES], nm[CONV_STATES];
+	for (int s = 0; s < CONV_STATES; ++s) m[s] = _mm256_set1_ps(s == 0 ? 0 : -BIG);
+	for (int i = 0; i < n; ++i) {
+		__m256 s0 = _mm256_loadu_ps(soft + 16*i), s1 = _mm256_loadu_ps(soft + 16*i + 8);
+		__m256 bm[4];
+		bm[0] = _mm256_add_ps(s0, s1);
+		bm[1] = _mm256_sub_ps(s0, s1);
+		bm[2] = _mm256_sub_ps(_mm256_setzero_ps(), bm[1]);
+		bm[3] = _mm256_sub_ps(_mm256_setzero_ps(), bm[0]);
+		for (int ns = 0; ns < CONV_STATES; ++ns) {
+			int st = ns >> 1;
+			__m256 b0 = bm[branches.sel[ns]];
+			__m256 a = _mm256_add_ps(m[st], b0), b = _mm256_sub_ps(m[st | 8], b0);
+			dec[i*CONV_STATES + ns] = (uint8_t)_mm256_movemask_ps(_mm256_cmp_ps(b, a, _CMP_GT_OQ));
+			nm[ns] = _mm256_max_ps(a, b);
+		}
+		for (int s = 0; s < CONV_STATES; ++s) m[s] = nm[s];
+	}
+	for (int s = 0; s < CONV_STATES; ++s) _mm256_storeu_ps(mo + 8*s, m[s]);
+}
+boolean supportedAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+const struct {
+	const char *name;
+	int lanes;
+	Acs acs;
+	boolean (*supported)();
+} kernels[] = {
+	{"scalar", 4, acsScalar, supportedScalar},
+#ifdef DECODER_X86
+	{"sse2", 4, acsSSE2, supportedSSE2},
+	{"avx2", 8, acsAVX2, supportedAVX2},
+#endif
+};
+
+int selectKernel() {
+	int best = 0;
+	for (int i = 1; i < (int)(sizeof(kernels)/sizeof(kernels[0])); ++i) {
+		if (kernels[i].supported()) best = i;
+	}
+	return best;
+}
+const int kernelIdx = selectKernel();
+
+// info + inverted FIRE parity + tail
+void blockBits(const uint8_t *data, uint8_t *u) {
+	for (int i = 0; i < INFO_BITS; ++i) u[i] = (uint8_t)(data[i/8] >> (i%8) & 1);
+	uint64_t p = ~parityBits(u, INFO_BITS, FIRE_POLY, 40);
+	for (int i = 0; i < 40; ++i) u[INFO_BITS + i] = (uint8_t)(p >> (39-i) & 1);
+	for (int i = INFO_BITS + 40; i < STEPS; ++i) u[i] = 0;
+}
+}
+
+ChannelDecoder::ChannelDecoder() : soft(2*STEPS*MAX_LANES), dec(STEPS*CONV_STATES), metric(CONV_STATES*MAX_LANES), bits(STEPS) {
+}
+
+const char *ChannelDecoder::kernel() { return kernels[kernelIdx].name; }
+
+void ChannelDecoder::deinterleave(const BurstSoft *const *bursts, float *coded) {
+	for (int k = 0; k < XCCH_CODED; ++k) coded[k] = bursts[k % 4]->soft[burstPos(k)];
+}
+
+int ChannelDecoder::xcchBurst(int fn) {
+	static const int first[] = {2, 6, 12, 16, 22, 26, 32, 36, 42, 46};
+	int f = fn % 51;
+	for (int s : first) {
+		if (f >= s && f < s + 4) return f - s;
+	}
+	return -1;
+}
+
+void ChannelDecoder::encode(const uint8_t *data, uint8_t bursts[4][BURST_BITS]) {
+	uint8_t u[STEPS], c[XCCH_CODED];
+	blockBits(data, u);
+	convEncode(u, STEPS, c);
+	for (int k = 0; k < XCCH_CODED; ++k) bursts[k % 4][burstPos(k)] = c[k];
+}
+
+int ChannelDecoder::decode(const float *coded, int count, XcchBlock *out) {
+	const int W = kernels[kernelIdx].lanes;
+	int good = 0;
+	for (int b0 = 0; b0 < count; b0 += W) {
+		int lanes = count - b0 < W ? count - b0 : W;
+		if (lanes < W) memset(&soft[0], 0, 2*STEPS*W*sizeof(float));
+		for (int l = 0; l < lanes; ++l) {
+			const float *c = coded + (b0 + l)*XCCH_CODED;
+			for (int k = 0; k < XCCH_CODED; ++k) soft[k*W + l] = c[k];
+		}
+		kernels[kernelIdx].acs(&soft[0], STEPS, &dec[0], &metric[0]);
+
+		for (int l = 0; l < lanes; ++l) {
+			XcchBlock& blk = out[b0 + l];
+			uint8_t *u = &bits[0];
+			int st = 0; // tail bits terminate in state 0
+			for (int i = STEPS-1; i >= 0; --i) {
+				u[i] = (uint8_t)(st & 1);
+				st = (st >> 1) | ((dec[i*CONV_STATES + st] >> l & 1) << 3);
+			}
+			memset(blk.data, 0, XCCH_BYTES);
+			for (int i = 0; i < INFO_BITS; ++i) blk.data[i/8] |= (uint8_t)(u[i] << (i%8));
+
+			uint8_t ref[STEPS];
+			blockBits(blk.data, ref);
+			blk.ok = memcmp(ref + INFO_BITS, u + INFO_BITS, 40) == 0;
+			if (blk.ok) ++good;
+
+			// re-encode to count corrected channel bits
+			uint8_t c[XCCH_CODED];
+			convEncode(u, STEPS, c);
+			const float *s = coded + (b0 + l)*XCCH_CODED;
+			blk.errors = 0;
+			for (int k = 0; k < XCCH_CODED; ++k) {
+				if ((s[k] < 0) != (c[k] != 0)) ++blk.errors;
+			}
+		}
+	}
+	return good;
+}
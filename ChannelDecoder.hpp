@@ -0,0 +1,37 @@
+#ifndef CHANNELDECODER_HPP
+#define CHANNELDECODER_HPP
+
+#include "GmskDemod.hpp"
+
+#define XCCH_BYTES 23
+#define XCCH_CODED 456
+
+struct XcchBlock {
+	uint8_t data[XCCH_BYTES]; // L2 frame, bits packed lsb first
+	boolean ok;               // FIRE code check passed
+	int errors;               // coded bits corrected by Viterbi
+};
+
+// xCCH (BCCH, CCCH, SDCCH, SACCH) decoder: 4 burst deinterleave, K=5 Viterbi, FIRE code.
+// Viterbi runs many blocks side by side in SIMD lanes.
+class ChannelDecoder : extends Object {
+private:
+	Array<float> soft;    // [step][c0/c1][lane]
+	Array<uint8_t> dec;   // [step][state] lane masks
+	Array<float> metric;  // final metrics [state][lane]
+	Array<uint8_t> bits;
+public:
+	ChannelDecoder();
+
+	static const char *kernel();
+	// burst index of BCCH/CCCH block on TN0 of 51-multiframe, -1 for FCCH/SCH/idle frames
+	static int xcchBurst(int fn);
+	// 4 consecutive bursts of a block to XCCH_CODED soft bits
+	static void deinterleave(const BurstSoft *const *bursts, float *coded);
+	// count blocks of XCCH_CODED soft bits each, returns number of blocks passing CRC
+	int decode(const float *coded, int count, XcchBlock *out);
+	// data bits of 4 bursts (3..59, 88..144) for a L2 frame
+	static void encode(const uint8_t *data, uint8_t bursts[4][BURST_BITS]);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include <lang/System.hpp>
+
+#include "Channelizer.hpp"
+
+#include <cmath>
+
+Channelizer::Channelizer(int channels, int taps) : M(channels), taps(taps), fft(channels, true) {
+	if (taps < 1) throw IllegalArgumentException(String::format("taps %d", taps));
+	// windowed sinc with cutoff at half channel spacing (Blackman window)
+	int L = M * taps;
+	Array<double> proto(L);
+	double sum = 0;
+	for (int i = 0; i < L; ++i) {
+		double x = (i - (L - 1) / 2.0) / M;
+		double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+		double w = 0.42 - 0.5 * cos(2 * M_PI * i / (L - 1)) + 0.08 * cos(4 * M_PI * i / (L - 1));
+		proto[i] = sinc * w;
+		sum += proto[i];
+	}
+	h = Array<float>(L);
+	for (int p = 0; p < M; ++p) {
+		for (int r = 0; r < taps; ++r) h[p*taps + r] = (float)(proto[r*M + p] / sum);
+	}
+	histLen = (taps - 1) * M;
+	reset();
+}
+
+void Channelizer::reset() {
+	hist = Array<float>(2*histLen);
+	for (int i = 0; i < 2*histLen; ++i) hist[i] = 0;
+}
+
+// y_k[m] = sum_l h[l] x[mM + M-1 - l] exp(+j2pi k l/M)
+//        = IDFT_k( v_p[m] = sum_r h[rM+p] x[mM + M-1 - rM - p] )
+int Channelizer::process(const float *in, int n, float *out) {
+	if (n % M) throw IllegalArgumentException(String::format("length %d not multiple of %d", n, M));
+	int frames = n / M;
+	// work on history + new input as one contiguous signal
+	if (work.length < 2*(histLen + n)) work = Array<float>(2*(histLen + n));
+	float *x = &work[0];
+	memcpy(x, &hist[0], 2*histLen*sizeof(float));
+	memcpy(x + 2*histLen, in, 2*n*sizeof(float));
+
+	for (int m = 0; m < frames; ++m) {
+		const float *newest = x + 2*(histLen + m*M + M - 1);
+		float *v = out + 2*m*M;
+		for (int p = 0; p < M; ++p) {
+			const float *hp = &h[p*taps];
+			const float *xp = newest - 2*p;
+			float re = 0, im = 0;
+			for (int r = 0; r < taps; ++r) {
+				re += hp[r] * xp[-2*r*M];
+				im += hp[r] * xp[-2*r*M + 1];
+			}
+			v[2*p] = re;
+			v[2*p+1] = im;
+		}
+	}
+	fft.transform(out, frames);
+	memcpy(&hist[0], x + 2*n, 2*histLen*sizeof(float));
+	return frames;
+}
@@ -0,0 +1,28 @@
+#ifndef CHANNELIZER_HPP
+#define CHANNELIZER_HPP
+
+#include "FFT.hpp"
+
+// Critically sampled polyphase FFT filterbank.
+// Splits complex input at rate fs into M channels spaced fs/M, each decimated by M.
+// Channel k is centered at k*fs/M for k < M/2 and (k-M)*fs/M otherwise.
+class Channelizer : extends Object {
+private:
+	int M;      // number of channels (power of 2)
+	int taps;   // prototype filter taps per branch
+	Array<float> h;    // prototype lowpass, M*taps, stored per branch: h[p*taps + r] = proto[r*M + p]
+	Array<float> hist; // input history (complex), (taps-1)*M + block
+	int histLen;       // complex samples kept between calls
+	Array<float> work; // history + input block
+	FFT fft;
+public:
+	Channelizer(int channels, int taps=12);
+
+	int channels() const { return M; }
+	void reset();
+	// in: n complex samples (interleaved I/Q), n multiple of channels()
+	// out: n/M output vectors of M complex channel samples, returns n/M
+	int process(const float *in, int n, float *out);
+};
+
+#endif
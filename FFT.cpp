@@ -0,0 +1,53 @@
+#include <lang/System.hpp>
+
+#include "FFT.hpp"
+
+#include <cmath>
+
+FFT::FFT(int n, boolean inverse) : n(n), inverse(inverse), tw(n), bitrev(n) {
+	if (n < 2 || (n & (n-1)) != 0) throw IllegalArgumentException(String::format("FFT size %d", n));
+	double sign = inverse ? 1.0 : -1.0;
+	for (int i = 0; i < n/2; ++i) {
+		double a = sign * 2 * M_PI * i / n;
+		tw[2*i] = (float)cos(a);
+		tw[2*i+1] = (float)sin(a);
+	}
+	int bits = 0;
+	while ((1 << bits) < n) ++bits;
+	for (int i = 0; i < n; ++i) {
+		int r = 0;
+		for (int b = 0; b < bits; ++b) if (i & (1 << b)) r |= 1 << (bits-1-b);
+		bitrev[i] = r;
+	}
+}
+
+void FFT::transform(float *x, int count) const {
+	const float *w = &tw[0];
+	for (int c = 0; c < count; ++c, x += 2*n) {
+		for (int i = 0; i < n; ++i) {
+			int j = bitrev[i];
+			if (i < j) {
+				float re = x[2*i], im = x[2*i+1];
+				x[2*i] = x[2*j]; x[2*i+1] = x[2*j+1];
+				x[2*j] = re; x[2*j+1] = im;
+			}
+		}
+		for (int len = 2; len <= n; len <<= 1) {
+			int half = len >> 1;
+			int step = n / len; // twiddle stride
+			for (int i = 0; i < n; i += len) {
+				float *a = x + 2*i;
+				float *b = a + 2*half;
+				for (int k = 0; k < half; ++k) {
+					float wr = w[2*k*step], wi = w[2*k*step+1];
+					float br = b[2*k]*wr - b[2*k+1]*wi;
+					float bi = b[2*k]*wi + b[2*k+1]*wr;
+					b[2*k] = a[2*k] - br;
+					b[2*k+1] = a[2*k+1] - bi;
+					a[2*k] += br;
+					a[2*k+1] += bi;
+				}
+			}
+		}
+	}
+}
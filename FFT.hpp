@@ -0,0 +1,23 @@
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <lang/String.hpp>
+
+// Radix-2 complex FFT on interleaved (re,im) float data, size power of 2.
+// Not normalized, inverse transform uses conjugated twiddles.
+class FFT : extends Object {
+private:
+	int n;
+	boolean inverse;
+	Array<float> tw;    // twiddles, n/2 complex
+	Array<int> bitrev;
+public:
+	FFT() : n(0), inverse(false) {}
+	FFT(int n, boolean inverse=false);
+
+	int size() const { return n; }
+	// in place transform of count consecutive blocks of n complex samples
+	void transform(float *x, int count=1) const;
+};
+
+#endif
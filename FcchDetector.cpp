@@ -0,0 +1,228 @@
+#include <lang/System.hpp>
+
+#include "FcchDetector.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FCCH_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FCCH_NEON
+#endif
+
+namespace {
+const double GSM_SYMBOL_RATE = 1625000.0 / 6;
+const int FCCH_SYMBOLS = 148;    // tail + fixed bits, all zero
+const int BLOCK = 4096;          // samples processed per kernel call
+
+// per symbol sums of x[n+lag]*conj(x[n]) and |x[n]|^2, 3 floats per symbol
+typedef void (*SymbolSums)(const float *x, int lag, int sps, int nsym, float *out);
+
+void symbolSumsScalar(const float *x, int lag, int sps, int nsym, float *out) {
+	for (int s = 0; s < nsym; ++s, x += 2*sps, out += 3) {
+		float re = 0, im = 0, p = 0;
+		for (int i = 0; i < sps; ++i) {
+			const float *a = x + 2*i, *b = a + 2*lag;
+			re += b[0]*a[0] + b[1]*a[1];
+			im += b[1]*a[0] - b[0]*a[1];
+			p += a[0]*a[0] + a[1]*a[1];
+		}
+		out[0] = re; out[1] = im; out[2] = p;
+	}
+}
+boolean supportedScalar() { return true; }
+
+#ifdef FCCH_X86
+// SSE2: 2 complex samples per iteration
+__attribute__((target("sse2")))
+void symbolSumsSSE2(const float *x, int lag, int sps, int nsym, float *out) {
+	for (int s = 0; s < nsym; ++s, x += 2*sps, out += 3) {
+		__m128 vre = _mm_setzero_ps(), vim = _mm_setzero_ps(), vp = _mm_setzero_ps();
+		int i = 0;
+		for (; i + 2 <= sps; i += 2) {
+			__m128 a = _mm_loadu_ps(x + 2*i);
+			__m128 b = _mm_loadu_ps(x + 2*(i + lag));
+			vre = _mm_add_ps(vre, _mm_mul_ps(a, b));
+			vim = _mm_add_ps(vim, _mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(2,3,0,1))));
+			vp = _mm_add_ps(vp, _mm_mul_ps(a, a));
+		}
+		float r[4], m[4], p[4];
+		_mm_storeu_ps(r, vre); _mm_storeu_ps(m, vim); _mm_storeu_ps(p, vp);
+		symbolSumsScalar(x + 2*i, lag, sps - i, 1, out); // odd sps tail
+		out[0] += r[0] + r[1] + r[2] + r[3];
+		out[1] += m[0] - m[1] + m[2] - m[3];
+		out[2] += p[0] + p[1] + p[2] + p[3];
+	}
+}
+boolean supportedSSE2() { return __builtin_cpu_supports("sse2"); }
+
+// AVX2: 4 complex samples per iteration
+__attribute__((target("avx2")))
+void symbolSumsAVX2(const float *x, int lag, int sps, int nsym, float *out) {
+	for (int s = 0; s < nsym; ++s, x += 2*sps, out += 3) {
+		__m256 vre = _mm256_setzero_ps(), vim = _mm256_setzero_ps(), vp = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 4 <= sps; i += 4) {
+			__m256 a = _mm256_loadu_ps(x + 2*i);
+			__m256 b = _mm256_loadu_ps(x + 2*(i + lag));
+			vre = _mm256_add_ps(vre, _mm256_mul_ps(a, b));
+			vim = _mm256_add_ps(vim, _mm256_mul_ps(a, _mm256_permute_ps(b, 0xb1)));
+			vp = _mm256_add_ps(vp, _mm256_mul_ps(a, a));
+		}
+		float r[8], m[8], p[8];
+		_mm256_storeu_ps(r, vre); _mm256_storeu_ps(m, vim); _mm256_storeu_ps(p, vp);
+		symbolSumsScalar(x + 2*i, lag, sps - i, 1, out);
+		for (int k = 0; k < 8; k += 2) {
+			out[0] += r[k] + r[k+1];
+			out[1] += m[k] - m[k+1];
+			out[2] += p[k] + p[k+1];
+		}
+	}
+}
+boolean supportedAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+#ifdef FCCH_NEON
+// NEON: 4 complex samples per iteration, deinterleaved by vld2
+void symbolSumsNEON(const float *x, int lag, int sps, int nsym, float *out) {
+	for (int s = 0; s < nsym; ++s, x += 2*sps, out += 3) {
+		float32x4_t vre = vdupq_n_f32(0), vim = vdupq_n_f32(0), vp = vdupq_n_f32(0);
+		int i = 0;
+		for (; i + 4 <= sps; i += 4) {
+			float32x4x2_t a = vld2q_f32(x + 2*i);
+			float32x4x2_t b = vld2q_f32(x + 2*(i + lag));
+			vre = vmlaq_f32(vmlaq_f32(vre, a.val[0], b.val[0]), a.val[1], b.val[1]);
+			vim = vmlsq_f32(vmlaq_f32(vim, a.val[0], b.val[1]), a.val[1], b.val[0]);
+			vp = vmlaq_f32(vmlaq_f32(vp, a.val[0], a.val[0]), a.val[1], a.val[1]);
+		}
+		float r[4], m[4], p[4];
+		vst1q_f32(r, vre); vst1q_f32(m, vim); vst1q_f32(p, vp);
+		symbolSumsScalar(x + 2*i, lag, sps - i, 1, out);
+		out[0] += r[0] + r[1] + r[2] + r[3];
+		out[1] += m[0] + m[1] + m[2] + m[3];
+		out[2] += p[0] + p[1] + p[2] + p[3];
+	}
+}
+boolean supportedNEON() { return true; }
+#endif
+
+const struct {
+	const char *name;
+	SymbolSums sums;
+	boolean (*supported)();
+} kernels[] = {
+	{"scalar", symbolSumsScalar, supportedScalar},
+#ifdef FCCH_X86
+	{"sse2", symbolSumsSSE2, supportedSSE2},
+	{"avx2", symbolSumsAVX2, supportedAVX2},
+#endif
+#ifdef FCCH_NEON
+	{"neon", symbolSumsNEON, supportedNEON},
+#endif
+};
+
+int selectKernel() {
+	int best = 0;
+	for (int i = 1; i < (int)(sizeof(kernels)/sizeof(kernels[0])); ++i) {
+		if (kernels[i].supported()) best = i;
+	}
+	return best;
+}
+const int kernelIdx = selectKernel();
+
+double wrapPhase(double a) {
+	while (a > M_PI) a -= 2*M_PI;
+	while (a < -M_PI) a += 2*M_PI;
+	return a;
+}
+}
+
+FcchDetector::FcchDetector(double rate, int sps, float threshold) : rate(rate), sps(sps), window(128),
+		threshold(threshold), buf(2*(BLOCK + sps)), bufLen(0), bufTs(0),
+		sums(3*window), tmp(3*(BLOCK/sps + 1)) {
+	if (sps < 1 || sps > BLOCK/2) throw IllegalArgumentException(String::format("FcchDetector sps %d", sps));
+	rotation = 2*M_PI * (GSM_SYMBOL_RATE/4) * sps / rate;
+	reset();
+}
+
+const char *FcchDetector::kernel() { return kernels[kernelIdx].name; }
+
+void FcchDetector::reset() {
+	bufLen = 0;
+	symCount = 0;
+	zre = zim = pwr = 0;
+	inRun = false;
+	runStart = runEnd = 0;
+	bestQ = bestPhase = 0;
+}
+
+void FcchDetector::symbol(const float *s, jlong ts, FcchBurst *found, int max, int& cnt) {
+	float *slot = &sums[3*(symCount % window)];
+	if (symCount >= window) {
+		zre -= slot[0]; zim -= slot[1]; pwr -= slot[2];
+	}
+	slot[0] = s[0]; slot[1] = s[1]; slot[2] = s[2];
+	zre += s[0]; zim += s[1]; pwr += s[2];
+	++symCount;
+	if (symCount < window) return;
+	if (symCount % window == 0) {
+		// recompute to stop rounding drift of running sums
+		zre = zim = pwr = 0;
+		for (int i = 0; i < window; ++i) { zre += sums[3*i]; zim += sums[3*i+1]; pwr += sums[3*i+2]; }
+	}
+
+	jlong start = ts - (jlong)(window - 1)*sps; // first symbol of window
+	// phase is needed only above threshold, compare squared magnitudes first
+	boolean hit = zre*zre + zim*zim > (double)threshold*threshold*pwr*pwr;
+	float q = 0, dphi = 0;
+	if (hit) {
+		q = (float)(sqrt(zre*zre + zim*zim) / pwr);
+		dphi = (float)wrapPhase(atan2(zim, zre) - rotation);
+		hit = fabsf(dphi) < (float)(M_PI/3);
+	}
+	if (hit) {
+		if (!inRun) {
+			inRun = true;
+			runStart = start;
+			bestQ = 0;
+		}
+		runEnd = start;
+		if (q > bestQ) { bestQ = q; bestPhase = dphi; }
+		return;
+	}
+	if (!inRun) return;
+	inRun = false;
+	// plateau of windows fully inside the burst is FCCH_SYMBOLS-window long
+	if (runEnd - runStart < 3*sps || cnt >= max) return;
+	FcchBurst& b = found[cnt++];
+	b.ts = (runStart + runEnd)/2 - (FCCH_SYMBOLS - window)/2*sps;
+	b.freq = (float)(bestPhase * rate / (2*M_PI*sps));
+	b.quality = bestQ;
+}
+
+int FcchDetector::process(const float *x, int n, jlong ts, FcchBurst *found, int max) {
+	if (bufLen > 0 && ts != bufTs + bufLen) reset();
+	if (bufLen == 0) bufTs = ts;
+	int cnt = 0;
+	SymbolSums kern = kernels[kernelIdx].sums;
+	while (n > 0) {
+		int l = BLOCK + sps - bufLen;
+		if (l > n) l = n;
+		memcpy(&buf[2*bufLen], x, 2*l*sizeof(float));
+		bufLen += l; x += 2*l; n -= l;
+
+		int nsym = (bufLen - sps) / sps; // lag samples needed after last symbol
+		if (nsym <= 0) continue;
+		kern(&buf[0], sps, sps, nsym, &tmp[0]);
+		for (int i = 0; i < nsym; ++i) symbol(&tmp[3*i], bufTs + (jlong)i*sps, found, max, cnt);
+		int used = nsym*sps;
+		bufLen -= used;
+		memmove(&buf[0], &buf[2*used], 2*bufLen*sizeof(float));
+		bufTs += used;
+	}
+	return cnt;
+}
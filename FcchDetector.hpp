@@ -0,0 +1,44 @@
+#ifndef FCCHDETECTOR_HPP
+#define FCCHDETECTOR_HPP
+
+#include <lang/String.hpp>
+
+struct FcchBurst {
+	jlong ts;      // tick of first burst symbol (coarse, +-sps/2)
+	float freq;    // frequency offset from nominal +67.7kHz tone (Hz)
+	float quality; // normalized correlation 0..1
+};
+
+// Streaming FCCH search by differential phase.
+// x[n+sps]*conj(x[n]) is summed per symbol (SIMD), then over a sliding window
+// of symbols; FCCH gives steady +pi/2 rotation per symbol and |sum| close to energy.
+class FcchDetector : extends Object {
+private:
+	double rate;
+	int sps;
+	int window;        // symbols in correlation window
+	float threshold;
+	double rotation;   // expected phase step over sps samples
+	Array<float> buf;  // pending complex samples
+	int bufLen;
+	jlong bufTs;       // tick of buf[0]
+	Array<float> sums; // per symbol (re,im,pwr), ring of window entries
+	Array<float> tmp;  // kernel output
+	int symCount;      // symbols since reset
+	double zre, zim, pwr;
+	boolean inRun;
+	jlong runStart, runEnd;
+	float bestQ, bestPhase;
+
+	void symbol(const float *s, jlong ts, FcchBurst *found, int max, int& cnt);
+public:
+	FcchDetector(double rate, int sps, float threshold=0.7f);
+
+	static const char *kernel();
+	void reset();
+	// x: n complex samples starting at tick ts, a gap in ticks resets detector
+	// returns number of bursts stored in found (at most max)
+	int process(const float *x, int n, jlong ts, FcchBurst *found, int max);
+};
+
+#endif
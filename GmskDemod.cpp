@@ -0,0 +1,266 @@
+#include <lang/System.hpp>
+
+#include "GmskDemod.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DEMOD_X86
+#endif
+
+namespace {
+const int MAX_LANES = 8;
+const int TRAIN_POS = 61;    // first training bit in normal burst
+const int TAPS = 5;          // channel taps, 2^(TAPS-1) states
+const int STATES = 16;
+const int LAG_MIN = -3, LAG_MAX = 7; // channel estimate lags searched (symbols)
+const float BIG = 1e30f;
+const float TAIL_LLR = 100.0f;
+
+// GSM 05.02 5.2.3 training sequences
+const uint8_t tscBits[8][26] = {
+	{0,0,1,0,0,1,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,1,0,1,1,1},
+	{0,0,1,0,1,1,0,1,1,1,0,1,1,1,1,0,0,0,1,0,1,1,0,1,1,1},
+	{0,1,0,0,0,0,1,1,1,0,1,1,1,0,1,0,0,1,0,0,0,0,1,1,1,0},
+	{0,1,0,0,0,1,1,1,1,0,1,1,0,1,0,0,0,1,0,0,0,1,1,1,1,0},
+	{0,0,0,1,1,0,1,0,1,1,1,0,0,1,0,0,0,0,0,1,1,0,1,0,1,1},
+	{0,1,0,0,1,1,1,0,1,0,1,1,0,0,0,0,0,1,0,0,1,1,1,0,1,0},
+	{1,0,1,0,0,1,1,1,1,1,0,1,1,0,0,0,1,0,1,0,0,1,1,1,1,1},
+	{1,1,1,0,1,1,1,1,0,0,0,1,0,0,1,0,1,1,1,0,1,1,1,1,0,0},
+};
+
+// ACS over whole burst for lanes bursts at once
+// y: [sym][re/im][lane], E: [32][re/im][lane], dec: [sym][state] lane masks
+// rel: [sym][lane] metric difference of bit decided 3 symbols later, m: final [state][lane]
+typedef void (*Mlse)(const float *y, const float *E, uint8_t *dec, float *rel, float *m);
+
+inline float sq(float x) { return x*x; }
+
+void mlseScalar(const float *y, const float *E, uint8_t *dec, float *rel, float *m) {
+	const int W = 4;
+	float nm[STATES*W];
+	for (int s = 0; s < STATES; ++s)
+		for (int l = 0; l < W; ++l) m[s*W + l] = (s & 7) ? BIG : 0; // tail bits 0..2 are 0
+	for (int n = 3; n < BURST_BITS; ++n) {
+		const float *yr = y + 2*n*W, *yi = yr + W;
+		for (int ns = 0; ns < STATES; ++ns) {
+			int st = ns >> 1;
+			const float *e0 = E + 2*ns*W, *e1 = E + 2*(ns | 16)*W;
+			uint8_t d = 0;
+			for (int l = 0; l < W; ++l) {
+				float a = m[st*W + l] + sq(yr[l] - e0[l]) + sq(yi[l] - e0[W + l]);
+				float b = m[(st | 8)*W + l] + sq(yr[l] - e1[l]) + sq(yi[l] - e1[W + l]);
+				if (b < a) { a = b; d |= (uint8_t)(1 << l); }
+				nm[ns*W + l] = a;
+			}
+			dec[n*STATES + ns] = d;
+		}
+		memcpy(m, nm, sizeof(nm));
+		for (int l = 0; l < W; ++l) {
+			float m0 = BIG, m1 = BIG;
+			for (int s = 0; s < 8; ++s) {
+				if (m[s*W + l] < m0) m0 = m[s*W + l];
+				if (m[(s+8)*W + l] < m1) m1 = m[(s+8)*W + l];
+			}
+			rel[(n-3)*W + l] = fabsf(m0 - m1);
+		}
+	}
+}
+boolean supportedScalar() { return true; }
+
+#ifdef DEMOD_X86
+// SSE2: 4 bursts per vector
+__attribute__((target("sse2")))
+void mlseSSE2(const float *y, const float *E, uint8_t *dec, float *rel, float *mo) {
+	__m128 m[STATES], nm[STATES];
+	for (int s = 0; s < STATES; ++s) m[s] = _mm_set1_ps((s & 7) ? BIG : 0);
+	for (int n = 3; n < BURST_BITS; ++n) {
+		__m128 yr = _mm_loadu_ps(y + 8*n), yi = _mm_loadu_ps(y + 8*n + 4);
+		for (int ns = 0; ns < STATES; ++ns) {
+			int st = ns >> 1;
+			__m128 dr = _mm_sub_ps(yr, _mm_loadu_ps(E + 8*ns)), di = _mm_sub_ps(yi, _mm_loadu_ps(E + 8*ns + 4));
+			__m128 a = _mm_add_ps(m[st], _mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(di, di)));
+			dr = _mm_sub_ps(yr, _mm_loadu_ps(E + 8*(ns | 16)));
+			di = _mm_sub_ps(yi, _mm_loadu_ps(E + 8*(ns | 16) + 4));
+			__m128 b = _mm_add_ps(m[st | 8], _mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(di, di)));
+			dec[n*STATES + ns] = (uint8_t)_mm_movemask_ps(_mm_cmplt_ps(b, a));
+			nm[ns] = _mm_min_ps(a, b);
+		}
+		__m128 m0 = nm[0], m1 = nm[8];
+		for (int s = 0; s < STATES; ++s) m[s] = nm[s];
+		for (int s = 1; s < 8; ++s) { m0 = _mm_min_ps(m0, m[s]); m1 = _mm_min_ps(m1, m[s+8]); }
+		__m128 d = _mm_sub_ps(m0, m1);
+		_mm_storeu_ps(rel + 4*(n-3), _mm_max_ps(d, _mm_sub_ps(_mm_setzero_ps(), d)));
+	}
+	for (int s = 0; s < STATES; ++s) _mm_storeu_ps(mo + 4*s, m[s]);
+}
+boolean supportedSSE2() { return __builtin_cpu_supports("sse2"); }
+
+// AVX2: 8 bursts per vector
+__attribute__((target("avx2")))
+void mlseAVX2(const float *y, const float *E, uint8_t *dec, float *rel, float *mo) {
+	__m256 m[STATES], nm[STATES];
+	for (int s = 0; s < STATES; ++s) m[s] = _mm256_set1_ps((s & 7) ? BIG : 0);
+	for (int n = 3; n < BURST_BITS; ++n) {
+		__m256 yr = _mm256_loadu_ps(y + 16*n), yi = _mm256_loadu_ps(y + 16*n + 8);
+		for (int ns = 0; ns < STATES; ++ns) {
+			int st = ns >> 1;
+			__m256 dr = _mm256_sub_ps(yr, _mm256_loadu_ps(E + 16*ns)), di = _mm256_sub_ps(yi, _mm256_loadu_ps(E + 16*ns + 8));
+			__m256 a = _mm256_add_ps(m[st], _mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(di, di)));
+			dr = _mm256_sub_ps(yr, _mm256_loadu_ps(E + 16*(ns | 16)));
+			di = _mm256_sub_ps(yi, _mm256_loadu_ps(E + 16*(ns | 16) + 8));
+			__m256 b = _mm256_add_ps(m[st | 8], _mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(di, di)));
+			dec[n*STATES + ns] = (uint8_t)_mm256_movemask_ps(_mm256_cmp_ps(b, a, _CMP_LT_OQ));
+			nm[ns] = _mm256_min_ps(a, b);
+		}
+		__m256 m0 = nm[0], m1 = nm[8];
+		for (int s = 0; s < STATES; ++s) m[s] = nm[s];
+		for (int s = 1; s < 8; ++s) { m0 = _mm256_min_ps(m0, m[s]); m1 = _mm256_min_ps(m1, m[s+8]); }
+		__m256 d = _mm256_sub_ps(m0, m1);
+		_mm256_storeu_ps(rel + 8*(n-3), _mm256_max_ps(d, _mm256_sub_ps(_mm256_setzero_ps(), d)));
+	}
+	for (int s = 0; s < STATES; ++s) _mm256_storeu_ps(mo + 8*s, m[s]);
+}
+boolean supportedAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+const struct {
+	const char *name;
+	int lanes;
+	Mlse mlse;
+	boolean (*supported)();
+} kernels[] = {
+	{"scalar", 4, mlseScalar, supportedScalar},
+#ifdef DEMOD_X86
+	{"sse2", 4, mlseSSE2, supportedSSE2},
+	{"avx2", 8, mlseAVX2, supportedAVX2},
+#endif
+};
+
+int selectKernel() {
+	int best = 0;
+	for (int i = 1; i < (int)(sizeof(kernels)/sizeof(kernels[0])); ++i) {
+		if (kernels[i].supported()) best = i;
+	}
+	return best;
+}
+const int kernelIdx = selectKernel();
+
+// sample of symbol m at phase p, GMSK rotation removed: multiply by (-j)^m
+inline void symbolAt(const short *x, int len, int sps, int p, int m, float& re, float& im) {
+	int i = p + m*sps;
+	if (i < 0 || i >= len) { re = im = 0; return; }
+	float a = x[2*i] * (1.0f/32768), b = x[2*i+1] * (1.0f/32768);
+	switch (m & 3) {
+	case 0: re = a; im = b; break;
+	case 1: re = b; im = -a; break;
+	case 2: re = -a; im = -b; break;
+	default: re = -b; im = a; break;
+	}
+}
+}
+
+GmskDemod::GmskDemod(int sps) : sps(sps), y(2*BURST_BITS*MAX_LANES), E(2*32*MAX_LANES),
+		dec(BURST_BITS*STATES), rel(BURST_BITS*MAX_LANES), metric(STATES*MAX_LANES) {
+	if (sps < 1) throw IllegalArgumentException(String::format("GmskDemod sps %d", sps));
+}
+
+const char *GmskDemod::kernel() { return kernels[kernelIdx].name; }
+
+const uint8_t *GmskDemod::training(int tsc) {
+	if (tsc < 0 || tsc > 7) throw IllegalArgumentException(String::format("TSC %d", tsc));
+	return tscBits[tsc];
+}
+
+// channel estimate by correlation with the middle 16 training bits (zero sidelobes for +-5 lags)
+void GmskDemod::estimate(const BurstView& v, int tsc, int lane, int W, BurstSoft& out) {
+	const uint8_t *t = training(tsc);
+	float ref[16];
+	for (int i = 0; i < 16; ++i) ref[i] = t[5+i] ? -1.0f : 1.0f;
+
+	const int lags = LAG_MAX - LAG_MIN + 1;
+	float best = -1, g[2*TAPS] = {0};
+	int bp = 0, bd = 0;
+	for (int p = 0; p < sps; ++p) {
+		float c[2*lags], e[lags];
+		for (int k = 0; k < lags; ++k) {
+			float cr = 0, ci = 0;
+			for (int i = 0; i < 16; ++i) {
+				float re, im;
+				symbolAt(v.ptr, v.len, sps, p, TRAIN_POS + 5 + i + LAG_MIN + k, re, im);
+				cr += ref[i]*re; ci += ref[i]*im;
+			}
+			c[2*k] = cr/16; c[2*k+1] = ci/16;
+			e[k] = c[2*k]*c[2*k] + c[2*k+1]*c[2*k+1];
+		}
+		for (int k = 0; k + TAPS <= lags; ++k) {
+			float s = 0;
+			for (int j = 0; j < TAPS; ++j) s += e[k+j];
+			if (s > best) {
+				best = s; bp = p; bd = LAG_MIN + k;
+				memcpy(g, c + 2*k, sizeof(g));
+			}
+		}
+	}
+	delay[lane] = bd;
+
+	// symbols for equalizer and expected values of all 5 symbol combinations
+	for (int n = 0; n < BURST_BITS; ++n) {
+		symbolAt(v.ptr, v.len, sps, bp, n + bd, y[2*n*W + lane], y[(2*n+1)*W + lane]);
+	}
+	for (int c = 0; c < 32; ++c) {
+		float er = 0, ei = 0;
+		for (int k = 0; k < TAPS; ++k) {
+			float s = (c >> k & 1) ? -1.0f : 1.0f;
+			er += g[2*k]*s; ei += g[2*k+1]*s;
+		}
+		E[2*c*W + lane] = er;
+		E[(2*c+1)*W + lane] = ei;
+	}
+
+	// noise from training residual
+	float nz = 0;
+	int cnt = 0;
+	for (int n = TRAIN_POS + TAPS - 1; n < TRAIN_POS + 26; ++n, ++cnt) {
+		float er = y[2*n*W + lane], ei = y[(2*n+1)*W + lane];
+		for (int k = 0; k < TAPS; ++k) {
+			float s = t[n - TRAIN_POS - k] ? -1.0f : 1.0f;
+			er -= g[2*k]*s; ei -= g[2*k+1]*s;
+		}
+		nz += er*er + ei*ei;
+	}
+	nz /= (float)cnt;
+	noise[lane] = nz > 1e-12f ? nz : 1e-12f;
+
+	double pw = 0;
+	for (int i = 0; i < 2*v.len; ++i) pw += (double)v.ptr[i]*v.ptr[i];
+	out.power = (float)(10*log10(pw / v.len / (32768.0*32768.0) + 1e-20));
+	out.snr = (float)(10*log10(best / noise[lane]));
+	out.toa = (float)bd + (float)bp/(float)sps;
+}
+
+void GmskDemod::demod(const BurstView *v, int count, int tsc, BurstSoft *out) {
+	const int W = kernels[kernelIdx].lanes;
+	for (int b0 = 0; b0 < count; b0 += W) {
+		int lanes = count - b0 < W ? count - b0 : W;
+		if (lanes < W) {
+			memset(&y[0], 0, 2*BURST_BITS*W*sizeof(float));
+			memset(&E[0], 0, 2*32*W*sizeof(float));
+		}
+		for (int l = 0; l < lanes; ++l) estimate(v[b0 + l], tsc, l, W, out[b0 + l]);
+		kernels[kernelIdx].mlse(&y[0], &E[0], &dec[0], &rel[0], &metric[0]);
+
+		for (int l = 0; l < lanes; ++l) {
+			float *soft = out[b0 + l].soft;
+			int st = metric[l] <= metric[8*W + l] ? 0 : 8; // last tail bits are 0
+			for (int n = BURST_BITS-1; n >= 3; --n) {
+				int bit = st & 1;
+				soft[n] = n < BURST_BITS-3 ? (bit ? -rel[n*W + l] : rel[n*W + l]) / noise[l] : TAIL_LLR;
+				st = (st >> 1) | ((dec[n*STATES + st] >> l & 1) << 3);
+			}
+			for (int n = 0; n < 3; ++n) soft[n] = TAIL_LLR;
+		}
+	}
+}
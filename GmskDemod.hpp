@@ -0,0 +1,38 @@
+#ifndef GMSKDEMOD_HPP
+#define GMSKDEMOD_HPP
+
+#include "BurstSlicer.hpp"
+
+#define BURST_BITS 148
+
+struct BurstSoft {
+	float soft[BURST_BITS]; // >0 means bit 0, scaled as LLR
+	float toa;              // time of arrival relative to timeslot start (symbols)
+	float power;            // dBFS
+	float snr;              // dB, from training sequence residual
+};
+
+// Normal burst demodulator: channel estimate from training sequence (5 taps)
+// and 16-state MLSE Viterbi equalizer, bursts are equalized in SIMD lanes side by side.
+class GmskDemod : extends Object {
+private:
+	int sps;
+	Array<float> y;      // symbol spaced samples, [sym][re/im][lane]
+	Array<float> E;      // expected value for 5 symbol combinations, [32][re/im][lane]
+	Array<uint8_t> dec;  // survivor decisions, [sym][state] lane masks
+	Array<float> rel;    // bit reliability, [sym][lane]
+	Array<float> metric; // final metrics, [state][lane]
+	float noise[8];
+	int delay[8];
+
+	void estimate(const BurstView& v, int tsc, int lane, int lanes, BurstSoft& out);
+public:
+	GmskDemod(int sps);
+
+	static const char *kernel();
+	static const uint8_t *training(int tsc); // 26 bits of training sequence code 0..7
+	// demodulate count normal bursts with training sequence tsc
+	void demod(const BurstView *v, int count, int tsc, BurstSoft *out);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include <lang/System.hpp>
+
+#include "GsmClock.hpp"
+
+#include <cmath>
+
+GsmClock::GsmClock(double rate) : rate(rate), qsymTick(4*GSM_SYMBOL_RATE/rate), t0(0), fn0(0), valid(false) {
+	if (rate <= 0) throw IllegalArgumentException(String::format("GsmClock rate %.1lf", rate));
+}
+
+String GsmClock::toString() const {
+	if (!valid) return "GsmClock(invalid)";
+	return String::format("GsmClock(fn0=%d at %.2lf, rate=%.1lf)", fn0, t0, rate);
+}
+
+void GsmClock::set(double tick, int fn) {
+	t0 = tick;
+	fn0 = fnAdd(fn, 0);
+	valid = true;
+}
+
+void GsmClock::setRate(double r, jlong tick) {
+	if (r <= 0) throw IllegalArgumentException(String::format("GsmClock rate %.1lf", r));
+	if (!valid) {
+		rate = r;
+		qsymTick = 4*GSM_SYMBOL_RATE/rate;
+		return;
+	}
+	// move reference to tick, then rescale ticks
+	GsmTime g = toGsm(tick);
+	double q = g.tn*QSYM_PER_BURST + g.symbol*4; // quarter symbols since frame start
+	double ref = (double)tick - q/qsymTick;
+	double scale = r / rate;
+	rate = r;
+	qsymTick = 4*GSM_SYMBOL_RATE/rate;
+	t0 = ref * scale;
+	fn0 = g.fn;
+}
+
+GsmTime GsmClock::toGsm(jlong tick) const {
+	GsmTime g;
+	double q = ((double)tick - t0) * qsymTick;
+	double fr = floor(q / QSYM_PER_FRAME);
+	double r = q - fr*QSYM_PER_FRAME;
+	g.tn = (int)(r / QSYM_PER_BURST);
+	if (g.tn > 7) g.tn = 7; // rounding at frame end
+	g.symbol = (r - g.tn*QSYM_PER_BURST) / 4;
+	g.fn = fnAdd(fn0, (int)fmod(fr, FRAME_MODULUS));
+	return g;
+}
+
+double GsmClock::toTick(int fn, int tn, jlong near) const {
+	double nf = floor(((double)near - t0) * qsymTick / QSYM_PER_FRAME);
+	int fnNear = fnAdd(fn0, (int)fmod(nf, FRAME_MODULUS));
+	double frames = nf + fnDiff(fn, fnNear);
+	return t0 + (frames*QSYM_PER_FRAME + tn*QSYM_PER_BURST) / qsymTick;
+}
@@ -0,0 +1,54 @@
+#ifndef GSMCLOCK_HPP
+#define GSMCLOCK_HPP
+
+#include <lang/String.hpp>
+
+#define GSM_SYMBOL_RATE  (1625000.0 / 6)
+// timeslot is 156.25 symbols, all TDMA timing is kept in quarter symbols
+#define QSYM_PER_BURST   625
+#define QSYM_PER_FRAME   (8*QSYM_PER_BURST)
+#define FRAME_MODULUS    (26*51*2048)
+
+struct GsmTime {
+	int fn;        // frame number (0..FRAME_MODULUS-1)
+	int tn;        // timeslot (0..7)
+	double symbol; // symbol offset inside timeslot (0..156.25)
+};
+
+// Maps sample ticks of rx buffer to GSM frame time and back, O(1) both ways.
+class GsmClock : extends Object {
+private:
+	double rate;     // ticks/s
+	double qsymTick; // quarter symbols per tick
+	double t0;       // tick where frame fn0 (TN0, symbol 0) starts
+	int fn0;
+	boolean valid;
+public:
+	GsmClock() : rate(0), qsymTick(0), t0(0), fn0(0), valid(false) {}
+	GsmClock(double rate);
+	String toString() const;
+
+	// frame fn starts at tick (may be fractional)
+	void set(double tick, int fn);
+	// rate change, ticks are time*rate so they all scale; tick is given at old rate
+	void setRate(double rate, jlong tick);
+	void invalidate() { valid = false; }
+	boolean isValid() const { return valid; }
+	double getRate() const { return rate; }
+
+	GsmTime toGsm(jlong tick) const;
+	// start tick of timeslot (fn,tn), fn is taken nearest to tick near
+	double toTick(int fn, int tn, jlong near) const;
+
+	static int fnAdd(int fn, int d) {
+		int r = (fn + d) % FRAME_MODULUS;
+		return r < 0 ? r + FRAME_MODULUS : r;
+	}
+	// a - b in range -FRAME_MODULUS/2 .. FRAME_MODULUS/2-1
+	static int fnDiff(int a, int b) {
+		int d = fnAdd(a - b, FRAME_MODULUS/2);
+		return d - FRAME_MODULUS/2;
+	}
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include <lang/System.hpp>
+
+#include "GsmCoding.hpp"
+
+// state bit k holds input bit u(n-1-k)
+void convEncode(const uint8_t *in, int n, uint8_t *out) {
+	unsigned st = 0;
+	for (int i = 0; i < n; ++i) {
+		unsigned u = in[i] & 1;
+		out[2*i] = (uint8_t)(u ^ (st >> 2 & 1) ^ (st >> 3 & 1));
+		out[2*i+1] = (uint8_t)(u ^ (st & 1) ^ (st >> 2 & 1) ^ (st >> 3 & 1));
+		st = ((st << 1) | u) & (CONV_STATES-1);
+	}
+}
+
+float viterbiDecode(const float *soft, int n, uint8_t *out) {
+	Array<uint16_t> dec(n); // survivor decisions, bit per state
+	float m[CONV_STATES], nm[CONV_STATES];
+	for (int s = 0; s < CONV_STATES; ++s) m[s] = s == 0 ? 0.0f : -1e30f;
+	for (int i = 0; i < n; ++i) {
+		float s0 = soft[2*i], s1 = soft[2*i+1];
+		unsigned d = 0;
+		for (int ns = 0; ns < CONV_STATES; ++ns) {
+			unsigned u = ns & 1;
+			float best = 0;
+			for (unsigned x = 0; x < 2; ++x) {
+				unsigned st = (ns >> 1) | (x << 3);
+				unsigned c0 = u ^ (st >> 2 & 1) ^ x;
+				unsigned c1 = u ^ (st & 1) ^ (st >> 2 & 1) ^ x;
+				float v = m[st] + (c0 ? -s0 : s0) + (c1 ? -s1 : s1);
+				if (x == 0 || v > best) {
+					best = v;
+					if (x) d |= 1u << ns;
+				}
+			}
+			nm[ns] = best;
+		}
+		dec[i] = (uint16_t)d;
+		for (int s = 0; s < CONV_STATES; ++s) m[s] = nm[s];
+	}
+	unsigned st = 0;
+	for (int i = n-1; i >= 0; --i) {
+		out[i] = (uint8_t)(st & 1);
+		st = (st >> 1) | ((dec[i] >> st & 1) << 3);
+	}
+	return m[0];
+}
+
+uint64_t parityBits(const uint8_t *bits, int n, uint64_t poly, int len) {
+	uint64_t mask = len < 64 ? ((uint64_t)1 << len) - 1 : ~(uint64_t)0;
+	uint64_t r = 0;
+	for (int i = 0; i < n; ++i) {
+		uint64_t fb = (r >> (len-1) & 1) ^ (bits[i] & 1);
+		r = (r << 1) & mask;
+		if (fb) r ^= poly;
+	}
+	return r;
+}
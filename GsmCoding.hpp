@@ -0,0 +1,22 @@
+#ifndef GSMCODING_HPP
+#define GSMCODING_HPP
+
+#include <lang/String.hpp>
+
+#include <cstdint>
+
+// GSM 05.03 rate 1/2 convolutional code, K=5
+// G0 = 1 + D3 + D4, G1 = 1 + D + D3 + D4
+#define CONV_STATES 16
+
+// n input bits (tail included) -> 2n coded bits
+void convEncode(const uint8_t *in, int n, uint8_t *out);
+// soft: 2n values, >0 means bit 0; encoder starts and ends in state 0
+// returns path metric (higher is better)
+float viterbiDecode(const float *soft, int n, uint8_t *out);
+
+// systematic cyclic code remainder of n bits (first bit is highest degree)
+// poly without the leading term, len - degree of generator (<= 64)
+uint64_t parityBits(const uint8_t *bits, int n, uint64_t poly, int len);
+
+#endif
@@ -0,0 +1,248 @@
+#include <lang/System.hpp>
+#include <lang/Math.hpp>
+
+#include "GsmSync.hpp"
+#include "GsmCoding.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SYNC_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SYNC_NEON
+#endif
+
+namespace {
+const int SCH_BITS = 148;
+const int SCH_TRAIN_POS = 42;   // first training bit in burst
+const int SCH_INFO_BITS = 25;
+const int SCH_CODED_BITS = 78;
+const uint64_t SCH_CRC_POLY = 0x175; // D10 + D8 + D6 + D5 + D4 + D2 + 1
+const uint8_t schTraining[64] = {
+	1,0,1,1,1,0,0,1, 0,1,1,0,0,0,1,0, 0,0,0,0,0,1,0,0, 0,0,0,0,1,1,1,1,
+	0,0,1,0,1,1,0,1, 0,1,0,0,0,1,0,1, 0,1,1,1,0,1,1,0, 0,0,0,1,1,0,1,1
+};
+
+// out[lag] = sum ref[k]*y[lag + k*sps] (complex y, real ref), for lag = 0..lags-1
+typedef void (*Correlate)(const float *y, int sps, const float *ref, int nref, int lags, float *out);
+
+void correlateScalar(const float *y, int sps, const float *ref, int nref, int lags, float *out) {
+	for (int l = 0; l < lags; ++l) {
+		float re = 0, im = 0;
+		for (int k = 0; k < nref; ++k) {
+			re += ref[k] * y[2*(l + k*sps)];
+			im += ref[k] * y[2*(l + k*sps) + 1];
+		}
+		out[2*l] = re; out[2*l+1] = im;
+	}
+}
+boolean supportedScalar() { return true; }
+
+#ifdef SYNC_X86
+// SSE2: 2 lags per vector
+__attribute__((target("sse2")))
+void correlateSSE2(const float *y, int sps, const float *ref, int nref, int lags, float *out) {
+	int l = 0;
+	for (; l + 2 <= lags; l += 2) {
+		__m128 acc = _mm_setzero_ps();
+		for (int k = 0; k < nref; ++k) {
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(ref[k]), _mm_loadu_ps(y + 2*(l + k*sps))));
+		}
+		_mm_storeu_ps(out + 2*l, acc);
+	}
+	correlateScalar(y + 2*l, sps, ref, nref, lags - l, out + 2*l);
+}
+boolean supportedSSE2() { return __builtin_cpu_supports("sse2"); }
+
+// AVX2: 8 lags in two vectors
+__attribute__((target("avx2")))
+void correlateAVX2(const float *y, int sps, const float *ref, int nref, int lags, float *out) {
+	int l = 0;
+	for (; l + 8 <= lags; l += 8) {
+		__m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+		for (int k = 0; k < nref; ++k) {
+			__m256 r = _mm256_set1_ps(ref[k]);
+			const float *p = y + 2*(l + k*sps);
+			a0 = _mm256_add_ps(a0, _mm256_mul_ps(r, _mm256_loadu_ps(p)));
+			a1 = _mm256_add_ps(a1, _mm256_mul_ps(r, _mm256_loadu_ps(p + 8)));
+		}
+		_mm256_storeu_ps(out + 2*l, a0);
+		_mm256_storeu_ps(out + 2*l + 8, a1);
+	}
+	correlateScalar(y + 2*l, sps, ref, nref, lags - l, out + 2*l);
+}
+boolean supportedAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+#ifdef SYNC_NEON
+// NEON: 2 lags per vector
+void correlateNEON(const float *y, int sps, const float *ref, int nref, int lags, float *out) {
+	int l = 0;
+	for (; l + 2 <= lags; l += 2) {
+		float32x4_t acc = vdupq_n_f32(0);
+		for (int k = 0; k < nref; ++k) acc = vmlaq_n_f32(acc, vld1q_f32(y + 2*(l + k*sps)), ref[k]);
+		vst1q_f32(out + 2*l, acc);
+	}
+	correlateScalar(y + 2*l, sps, ref, nref, lags - l, out + 2*l);
+}
+boolean supportedNEON() { return true; }
+#endif
+
+const struct {
+	const char *name;
+	Correlate correlate;
+	boolean (*supported)();
+} kernels[] = {
+	{"scalar", correlateScalar, supportedScalar},
+#ifdef SYNC_X86
+	{"sse2", correlateSSE2, supportedSSE2},
+	{"avx2", correlateAVX2, supportedAVX2},
+#endif
+#ifdef SYNC_NEON
+	{"neon", correlateNEON, supportedNEON},
+#endif
+};
+
+int selectKernel() {
+	int best = 0;
+	for (int i = 1; i < (int)(sizeof(kernels)/sizeof(kernels[0])); ++i) {
+		if (kernels[i].supported()) best = i;
+	}
+	return best;
+}
+const int kernelIdx = selectKernel();
+
+// training as +-1 symbols (bit 0 -> +1)
+struct Reference {
+	float v[64];
+	Reference() { for (int i = 0; i < 64; ++i) v[i] = schTraining[i] ? -1.0f : 1.0f; }
+} schRef;
+
+// info bits are the 04.08 SCH octets (BSIC(6) T1(11) T2(5) T3'(3) from msb of octet 0),
+// each octet sent lsb first like osmocom gsm0503_sch_encode
+void toOctets(const uint8_t *bits, uint8_t *sb) {
+	for (int i = 0; i < 4; ++i) sb[i] = 0;
+	for (int i = 0; i < SCH_INFO_BITS; ++i) sb[i/8] = (uint8_t)(sb[i/8] | (bits[i] & 1) << (i%8));
+}
+void fromOctets(const uint8_t *sb, uint8_t *bits) {
+	for (int i = 0; i < SCH_INFO_BITS; ++i) bits[i] = (uint8_t)(sb[i/8] >> (i%8) & 1);
+}
+}
+GsmSync::GsmSync(double rate, int sps) : rate(rate), sps(sps) {
+	if (sps < 1) throw IllegalArgumentException(String::format("GsmSync sps %d", sps));
+	if (Math::abs(rate - GSM_SYMBOL_RATE*sps) > 1.0) {
+		LOGW("GsmSync: rate %.1lf is not %d*symbol rate", rate, sps);
+	}
+}
+
+const char *GsmSync::kernel() { return kernels[kernelIdx].name; }
+
+void GsmSync::schParse(const uint8_t *bits, int& bsic, int& fn) {
+	uint8_t sb[4];
+	toOctets(bits, sb);
+	bsic = sb[0] >> 2 & 0x3f;
+	int t1 = (sb[0] & 3) << 9 | sb[1] << 1 | sb[2] >> 7;
+	int t2 = sb[2] >> 2 & 0x1f;
+	int t3 = ((sb[2] & 3) << 1 | (sb[3] & 1)) * 10 + 1;
+	int d = (t3 - t2) % 26;
+	if (d < 0) d += 26;
+	fn = 51*26*t1 + 51*d + t3;
+}
+
+void GsmSync::schBuild(int bsic, int fn, uint8_t *bits) {
+	int t1 = fn / (26*51), t2 = fn % 26, t3p = (fn % 51 - 1) / 10;
+	uint8_t sb[4];
+	sb[0] = (uint8_t)((bsic & 0x3f) << 2 | t1 >> 9);
+	sb[1] = (uint8_t)(t1 >> 1);
+	sb[2] = (uint8_t)((t1 & 1) << 7 | t2 << 2 | t3p >> 1);
+	sb[3] = (uint8_t)(t3p & 1);
+	fromOctets(sb, bits);
+}
+
+void GsmSync::schBurst(int bsic, int fn, uint8_t *burst) {
+	uint8_t u[39], c[SCH_CODED_BITS];
+	schBuild(bsic, fn, u);
+	uint64_t p = ~parityBits(u, SCH_INFO_BITS, SCH_CRC_POLY, 10);
+	for (int i = 0; i < 10; ++i) u[SCH_INFO_BITS + i] = (uint8_t)(p >> (9-i) & 1);
+	for (int i = 35; i < 39; ++i) u[i] = 0;
+	convEncode(u, 39, c);
+	for (int i = 0; i < SCH_BITS; ++i) burst[i] = 0;
+	for (int i = 0; i < 39; ++i) {
+		burst[3 + i] = c[i];
+		burst[106 + i] = c[39 + i];
+	}
+	for (int i = 0; i < 64; ++i) burst[SCH_TRAIN_POS + i] = schTraining[i];
+}
+
+boolean GsmSync::sch(const float *x, int n, jlong ts, jlong expect, int range, float freq, SchInfo& info) {
+	jlong start = expect - (jlong)range*sps;
+	int lags = 2*range*sps + 1;
+	int len = lags + SCH_BITS*sps;
+	if (start < ts || start + len > ts + n) {
+		LOGE("GsmSync: SCH window %ld+%d outside of samples %ld+%d", start, len, ts, n);
+		return false;
+	}
+	if (y.length < 2*len) y = Array<float>(2*len);
+	if (corr.length < 2*lags) corr = Array<float>(2*lags);
+
+	// remove GMSK rotation (+pi/2 per symbol) and frequency offset
+	const float *p = x + 2*(start - ts);
+	double w = M_PI/(2*sps) + 2*M_PI*freq/rate;
+	double cr = cos(w), ci = -sin(w), rr = 1, ri = 0;
+	for (int i = 0; i < len; ++i) {
+		y[2*i] = (float)(p[2*i]*rr - p[2*i+1]*ri);
+		y[2*i+1] = (float)(p[2*i]*ri + p[2*i+1]*rr);
+		double t = rr*cr - ri*ci;
+		ri = rr*ci + ri*cr;
+		rr = t;
+	}
+
+	kernels[kernelIdx].correlate(&y[2*SCH_TRAIN_POS*sps], sps, schRef.v, 64, lags, &corr[0]);
+	int best = 0;
+	float bp = 0;
+	for (int l = 0; l < lags; ++l) {
+		float e = corr[2*l]*corr[2*l] + corr[2*l+1]*corr[2*l+1];
+		if (e > bp) { bp = e; best = l; }
+	}
+	float hr = corr[2*best] / 64, hi = corr[2*best+1] / 64; // channel estimate
+	float h2 = hr*hr + hi*hi;
+	if (h2 <= 0) return false;
+
+	float e = 0;
+	for (int k = 0; k < 64; ++k) {
+		const float *s = &y[2*(best + (SCH_TRAIN_POS + k)*sps)];
+		e += s[0]*s[0] + s[1]*s[1];
+	}
+	info.quality = bp / (64*e);
+
+	// sub-sample peak position
+	double frac = 0;
+	if (best > 0 && best < lags-1) {
+		float a = corr[2*best-2]*corr[2*best-2] + corr[2*best-1]*corr[2*best-1];
+		float b = corr[2*best+2]*corr[2*best+2] + corr[2*best+3]*corr[2*best+3];
+		float den = a - 2*bp + b;
+		if (den < 0) frac = 0.5 * (a - b) / den;
+	}
+	info.ts = (double)(start + best) + frac;
+
+	float soft[SCH_CODED_BITS];
+	for (int i = 0; i < SCH_CODED_BITS; ++i) {
+		int b = i < 39 ? 3 + i : 106 + i - 39;
+		const float *s = &y[2*(best + b*sps)];
+		soft[i] = (s[0]*hr + s[1]*hi) / h2;
+	}
+	uint8_t u[39];
+	viterbiDecode(soft, 39, u);
+	uint64_t p2 = ~parityBits(u, SCH_INFO_BITS, SCH_CRC_POLY, 10) & 0x3ff;
+	for (int i = 0; i < 10; ++i) {
+		if (u[SCH_INFO_BITS + i] != (p2 >> (9-i) & 1)) {
+			LOGD("GsmSync: SCH CRC error, q=%.2f", info.quality);
+			return false;
+		}
+	}
+	schParse(u, info.bsic, info.fn);
+	return true;
+}
@@ -0,0 +1,36 @@
+#ifndef GSMSYNC_HPP
+#define GSMSYNC_HPP
+
+#include "GsmClock.hpp"
+
+struct SchInfo {
+	int bsic;
+	int fn;        // frame number of SCH burst
+	double ts;     // tick where SCH burst (frame fn) starts
+	float quality; // training correlation to energy ratio
+};
+
+// SCH acquisition: correlate against 64 bit extended training sequence,
+// demodulate and decode SCH (conv. code + CRC), which gives BSIC and FN.
+// Input rate must be GSM_SYMBOL_RATE*sps.
+class GsmSync : extends Object {
+private:
+	double rate;
+	int sps;
+	Array<float> y;    // derotated samples
+	Array<float> corr; // correlation per lag
+public:
+	GsmSync(double rate, int sps);
+
+	static const char *kernel();
+	// x: n samples starting at tick ts; SCH burst expected to start at tick expect
+	// (+-range symbols); freq - offset measured on FCCH
+	boolean sch(const float *x, int n, jlong ts, jlong expect, int range, float freq, SchInfo& info);
+	// SCH info bits (25, octets of 04.08 lsb first) to BSIC and FN, and back (for tests/generators)
+	static void schParse(const uint8_t *bits, int& bsic, int& fn);
+	static void schBuild(int bsic, int fn, uint8_t *bits);
+	// 148 burst bits of SCH
+	static void schBurst(int bsic, int fn, uint8_t *burst);
+};
+
+#endif
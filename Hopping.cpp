@@ -0,0 +1,85 @@
+#include <lang/System.hpp>
+
+#include "Hopping.hpp"
+
+#include <cmath>
+
+namespace {
+// GSM 05.02 table 6.2.3-1
+const uint8_t RNTABLE[114] = {
+	 48,  98,  63,   1,  36,  95,  78, 102,  94,  73,
+	  0,  64,  25,  81,  76,  59, 124,  23, 104, 100,
+	101,  47, 118,  85,  18,  56,  96,  86,  54,   2,
+	 80,  34, 127,  13,   6,  89,  57, 103,  12,  74,
+	 55, 111,  75,  38, 109,  71, 112,  29,  11,  88,
+	 87,  19,   3,  68, 110,  26,  33,  31,   8,  45,
+	 82,  58,  40, 107,  32,   5, 106,  92,  62,  67,
+	 77, 108, 122,  37,  60,  66, 121,  42,  51, 126,
+	117, 114,   4,  90,  43,  52,  53, 113, 120,  72,
+	 16,  49,   7,  79, 119,  61,  22,  84,   9,  97,
+	 91,  15,  21,  24,  46,  39,  93, 105,  65,  70,
+	125,  99,  17, 123,
+};
+}
+
+HoppingSequence::HoppingSequence(const Array<int>& ma, int hsn, int maio) : hsn(hsn), maio(maio), ma(ma) {
+	if (ma.length < 1 || ma.length > 64) throw IllegalArgumentException(String::format("MA length %d", ma.length));
+	if (hsn < 0 || hsn > 63) throw IllegalArgumentException(String::format("HSN %d", hsn));
+	if (maio < 0 || maio >= ma.length) throw IllegalArgumentException(String::format("MAIO %d", maio));
+	if (hsn == 0) return;
+	lut = Array<uint8_t>(HOP_PERIOD);
+	for (int fn = 0; fn < HOP_PERIOD; ++fn) lut[fn] = (uint8_t)mai(fn, ma.length, hsn, maio);
+}
+
+int HoppingSequence::mai(int fn, int n, int hsn, int maio) {
+	if (hsn == 0) return (fn + maio) % n;
+	int t1 = fn / (26*51), t2 = fn % 26, t3 = fn % 51;
+	int nbin = 1;
+	while ((1 << nbin) <= n) ++nbin; // INTEGER(log2(N)) + 1
+	int mask = (1 << nbin) - 1;
+	int m = t2 + RNTABLE[(hsn ^ (t1 & 63)) + t3];
+	int mp = m & mask, tp = t3 & mask;
+	int s = mp < n ? mp : (mp + tp) % n;
+	return (s + maio) % n;
+}
+
+FrequencyHopper::FrequencyHopper(RadioDevice& dev, const GsmClock& clock, const HoppingSequence& seq,
+		const Array<double>& freq, int chan, int ahead) : dev(dev), clock(clock), seq(seq), freq(freq),
+		chan(chan), ahead(ahead), nextFn(-1), lastMai(-1), tunes(0), skipped(0), late(0) {
+	if (freq.length != seq.size()) throw IllegalArgumentException(String::format("%d frequencies for MA of %d", freq.length, seq.size()));
+	if (ahead < 1) throw IllegalArgumentException(String::format("ahead %d", ahead));
+}
+
+String FrequencyHopper::toString() const {
+	return String::format("FrequencyHopper(next fn=%d, tunes=%ld, same=%ld, late=%ld)", nextFn, tunes, skipped, late);
+}
+
+void FrequencyHopper::start(jlong now) {
+	if (!clock.isValid()) throw IllegalStateException("FrequencyHopper: clock not valid");
+	nextFn = GsmClock::fnAdd(clock.toGsm(now).fn, 1);
+	lastMai = -1;
+}
+
+int FrequencyHopper::update(jlong now) {
+	if (nextFn < 0) start(now);
+	int target = GsmClock::fnAdd(clock.toGsm(now).fn, ahead);
+	int cnt = 0;
+	while (GsmClock::fnDiff(target, nextFn) >= 0) {
+		int fn = nextFn;
+		nextFn = GsmClock::fnAdd(nextFn, 1);
+		jlong at = (jlong)ceil(clock.toTick(fn, 0, now) - 1e-6);
+		if (at <= now) {
+			// frame already started, the tune would land inside it
+			++late;
+			lastMai = -1;
+			continue;
+		}
+		int i = seq.index(fn);
+		if (i == lastMai) { ++skipped; continue; }
+		dev.setFreq(freq[i], chan, false, at);
+		lastMai = i;
+		++tunes;
+		++cnt;
+	}
+	return cnt;
+}
@@ -0,0 +1,60 @@
+#ifndef HOPPING_HPP
+#define HOPPING_HPP
+
+#include "RadioDevice.hpp"
+#include "GsmClock.hpp"
+
+// hopping sequence repeats after 64 T1 values (T2, T3 period is 26*51)
+#define HOP_PERIOD (64*26*51)
+
+// GSM 05.02 6.2.3 hopping sequence over mobile allocation (MA) of N ARFCNs.
+// MAI of the whole period is precomputed, so lookup per frame is O(1).
+class HoppingSequence : extends Object {
+private:
+	int hsn;          // hopping sequence number (0 - cyclic)
+	int maio;         // mobile allocation index offset
+	Array<int> ma;    // ARFCNs, ascending
+	Array<uint8_t> lut; // MAI per FN % HOP_PERIOD (hsn != 0)
+public:
+	HoppingSequence(const Array<int>& ma, int hsn, int maio);
+
+	// MAI of frame fn computed by 05.02 formula
+	static int mai(int fn, int n, int hsn, int maio);
+
+	int size() const { return ma.length; }
+	int index(int fn) const {
+		return hsn == 0 ? (int)((fn + maio) % ma.length) : lut[fn % HOP_PERIOD];
+	}
+	int arfcn(int fn) const { return ma[index(fn)]; }
+	int getArfcn(int i) const { return ma[i]; }
+};
+
+// Keeps timed retunes of one rx channel queued ahead of the hopping sequence.
+// Each frame is tuned at its TN0 start, at least ahead-1 frames before it begins.
+class FrequencyHopper : extends Object {
+private:
+	RadioDevice& dev;
+	const GsmClock& clock;
+	const HoppingSequence& seq;
+	Array<double> freq; // downlink frequency (Hz) of each MA entry
+	int chan;
+	int ahead;          // frames queued after the current one
+	int nextFn;         // first frame without queued tune (-1 not started)
+	int lastMai;        // MAI of last queued tune
+	jlong tunes, skipped, late;
+public:
+	FrequencyHopper(RadioDevice& dev, const GsmClock& clock, const HoppingSequence& seq,
+			const Array<double>& freq, int chan=0, int ahead=2);
+	String toString() const;
+
+	// first tuned frame is the one after tick now
+	void start(jlong now);
+	// queue tunes up to ahead frames after tick now, call at least once per frame
+	// returns number of tunes queued
+	int update(jlong now);
+
+	jlong getTunes() const { return tunes; }
+	jlong getLate() const { return late; }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include <lang/System.hpp>
+
+#include "IqRecorder.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define IQREC_ALIGN 4096 // O_DIRECT offset/size alignment (bytes)
+
+boolean IqRecorder::IndexQueue::push(int i) {
+	int h = head.load(std::memory_order_relaxed);
+	int n = (h + 1) % v.length;
+	if (n == tail.load(std::memory_order_acquire)) return false;
+	v[h] = i;
+	head.store(n, std::memory_order_release);
+	return true;
+}
+boolean IqRecorder::IndexQueue::pop(int& i) {
+	int t = tail.load(std::memory_order_relaxed);
+	if (t == head.load(std::memory_order_acquire)) return false;
+	i = v[t];
+	tail.store((t + 1) % v.length, std::memory_order_release);
+	return true;
+}
+
+IqRecorder::IqRecorder(const String& base, int chans, double rate, int blocks) : base(base), chans(chans), rate(rate), count(blocks) {
+	if (chans < 1) throw IllegalArgumentException(String::format("wrong channels %d", chans));
+	if (blocks < 2) throw IllegalArgumentException(String::format("wrong blocks %d", blocks));
+	this->blocks = Array<Block>(count);
+	freeQ.v = Array<int>(count + 1);
+	fullQ.v = Array<int>(count + 1);
+	fd = Array<int>(chans);
+	meta = Array<FILE *>(chans);
+	for (int i = 0; i < chans; ++i) { fd[i] = -1; meta[i] = null; }
+}
+IqRecorder::~IqRecorder() {
+	close();
+}
+
+String IqRecorder::toString() const {
+	return String::format("IqRecorder(%s, %d ch, %s, recorded=%ld, written=%ld, dropped=%ld in %ld pkts, wr errors=%ld)",
+			base.cstr(), chans, direct ? "O_DIRECT" : "buffered", recorded.load(), written.load(),
+			dropped.load(), dropPkts.load(), writeErrors.load());
+}
+
+boolean IqRecorder::open() {
+	if (pool) throw IllegalStateException("IqRecorder already open");
+	poolSize = (size_t)count * chans * IQREC_BLOCK * 2*sizeof(short);
+	void *p = mmap(null, poolSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		LOGE("IqRecorder: can't allocate %ld MiB", (jlong)(poolSize >> 20));
+		return false;
+	}
+	pool = (short *)p;
+	// fault in now, the rx thread must not page-fault
+	if (mlock(pool, poolSize) != 0) memset(pool, 0, poolSize);
+
+	direct = true;
+	for (int ch = 0; ch < chans; ++ch) {
+		String path = String::format("%s.ch%d.iq", base.cstr(), ch);
+		fd[ch] = ::open(path.cstr(), O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT, 0644);
+		if (fd[ch] < 0 && errno == EINVAL) {
+			// filesystem without O_DIRECT (tmpfs)
+			fd[ch] = ::open(path.cstr(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			direct = false;
+		}
+		if (fd[ch] < 0) {
+			LOGE("IqRecorder: can't create '%s': %s", path.cstr(), strerror(errno));
+			close();
+			return false;
+		}
+		String mpath = String::format("%s.meta", path.cstr());
+		meta[ch] = fopen(mpath.cstr(), "w");
+		if (meta[ch] == null) {
+			LOGE("IqRecorder: can't create '%s': %s", mpath.cstr(), strerror(errno));
+			close();
+			return false;
+		}
+		fprintf(meta[ch], "# trm IQ recording, sc16 I/Q\nrate %.6lf\nchan %d\n", rate, ch);
+		fflush(meta[ch]);
+	}
+	for (int i = 0; i < count; ++i) freeQ.push(i);
+	running = true;
+	writer = std::thread(&IqRecorder::writeLoop, this);
+	LOGD("IqRecorder: %s.ch*.iq, %d blocks of %d samples, %s", base.cstr(), count, IQREC_BLOCK, direct ? "O_DIRECT" : "buffered");
+	return true;
+}
+
+void IqRecorder::close() {
+	if (writer.joinable()) {
+		if (cur >= 0) submit();
+		running = false;
+		writer.join();
+	}
+	for (int ch = 0; ch < fd.length; ++ch) {
+		if (fd[ch] >= 0) {
+			// drop padding after the last block
+			if (ftruncate(fd[ch], (off_t)fileEnd * (off_t)(2*sizeof(short))) != 0) ++writeErrors;
+			::close(fd[ch]);
+			fd[ch] = -1;
+		}
+		if (meta[ch]) {
+			fprintf(meta[ch], "# %s\n", toString().cstr());
+			fclose(meta[ch]);
+			meta[ch] = null;
+		}
+	}
+	if (pool) {
+		LOGD("%s", toString().cstr());
+		munmap(pool, poolSize);
+		pool = null;
+	}
+}
+
+// hand the current block to the writer, queue has room for all blocks
+void IqRecorder::submit() {
+	fullQ.push(cur);
+	cur = -1;
+}
+
+void IqRecorder::record(const short *const *bufs, int n, jlong ts) {
+	recorded.fetch_add(n, std::memory_order_relaxed);
+	int done = 0;
+	while (done < n) {
+		if (cur >= 0 && blocks[cur].len > 0 && ts + done != blocks[cur].ts + blocks[cur].len) {
+			// discontinuity, block holds only contiguous samples
+			submit();
+		}
+		if (cur < 0) {
+			if (!freeQ.pop(cur)) {
+				// writer behind, don't wait
+				cur = -1;
+				dropped.fetch_add(n - done, std::memory_order_relaxed);
+				dropPkts.fetch_add(1, std::memory_order_relaxed);
+				return ;
+			}
+			blocks[cur].ts = ts + done;
+			blocks[cur].len = 0;
+		}
+		Block& b = blocks[cur];
+		int l = n - done;
+		if (l > IQREC_BLOCK - b.len) l = IQREC_BLOCK - b.len;
+		for (int ch = 0; ch < chans; ++ch) {
+			memcpy(buf(cur, ch) + 2*b.len, bufs[ch] + 2*done, (size_t)l * 2*sizeof(short));
+		}
+		b.len += l;
+		done += l;
+		if (b.len == IQREC_BLOCK) submit();
+	}
+}
+
+void IqRecorder::tuned(int chan, jlong tick, double freq) {
+	metaLine(chan, String::format("tune %ld %.1lf", tick, freq));
+}
+
+void IqRecorder::metaLine(int chan, const String& s) {
+	std::lock_guard<std::mutex> lk(metaLock);
+	for (int ch = 0; ch < meta.length; ++ch) {
+		if ((chan < 0 || chan == ch) && meta[ch]) {
+			fprintf(meta[ch], "%s\n", s.cstr());
+			fflush(meta[ch]);
+		}
+	}
+}
+
+// short block is padded up to IQREC_ALIGN, the sidecar keeps file offset of each block
+void IqRecorder::writeBlock(int b) {
+	const Block& blk = blocks[b];
+	const size_t smpl = 2*sizeof(short);
+	size_t bytes = ((size_t)blk.len * smpl + IQREC_ALIGN - 1) & ~(size_t)(IQREC_ALIGN - 1);
+	int padded = (int)(bytes / smpl);
+	for (int ch = 0; ch < chans; ++ch) {
+		short *p = buf(b, ch);
+		if (padded > blk.len) memset(p + 2*blk.len, 0, (size_t)(padded - blk.len) * smpl);
+		ssize_t r = pwrite(fd[ch], p, bytes, (off_t)fileOff * (off_t)smpl);
+		if (r != (ssize_t)bytes && writeErrors.fetch_add(1) == 0) {
+			LOGE("IqRecorder: write failed: %s", r < 0 ? strerror(errno) : "short write");
+		}
+	}
+	metaLine(-1, String::format("blk %ld %ld %d", fileOff, blk.ts, blk.len));
+	fileEnd = fileOff + blk.len;
+	fileOff += padded;
+	written.fetch_add(blk.len, std::memory_order_relaxed);
+}
+
+void IqRecorder::writeLoop() {
+	int b;
+	while (running.load()) {
+		if (!fullQ.pop(b)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			continue;
+		}
+		writeBlock(b);
+		freeQ.push(b);
+	}
+	while (fullQ.pop(b)) {
+		writeBlock(b);
+		freeQ.push(b);
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef IQRECORDER_HPP
+#define IQRECORDER_HPP
+
+#include <lang/String.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#define IQREC_BLOCK (1 << 18) // samples per channel in one write (1 MiB)
+
+// Records rx samples of all channels to <base>.ch<N>.iq (sc16 I/Q), each with sidecar
+// <base>.ch<N>.iq.meta, which FileBackend reads on replay.
+// The rx thread only copies into preallocated blocks and never waits: full blocks go
+// through a bounded queue to a writer thread (O_DIRECT, aligned), packets arriving while
+// no block is free are dropped and counted.
+// Sidecar lines: "rate <Hz>", "chan <n>", "tune <tick> <Hz>",
+// "blk <file sample offset> <tick> <samples>" (file is padded to 4 KiB after short blocks).
+class IqRecorder : extends Object {
+private:
+	// single producer/single consumer queue of block indexes
+	struct IndexQueue {
+		Array<int> v;
+		std::atomic<int> head{0}, tail{0};
+		boolean push(int i);
+		boolean pop(int& i);
+	};
+	struct Block {
+		jlong ts;  // tick of first sample
+		int len;   // samples per channel
+	};
+
+	String base;
+	int chans;
+	double rate;
+	int count;                 // blocks in pool
+	short *pool = null;        // [count][chans][IQREC_BLOCK] samples, page aligned
+	size_t poolSize = 0;
+	Array<Block> blocks;
+	IndexQueue freeQ, fullQ;   // rx thread <-> writer
+	int cur = -1;              // block being filled by rx thread
+	Array<int> fd;             // [chans]
+	Array<FILE *> meta;        // [chans]
+	std::mutex metaLock;
+	boolean direct = false;
+	jlong fileOff = 0;         // samples written per channel incl. padding (writer)
+	jlong fileEnd = 0;         // end of last block without padding
+
+	std::thread writer;
+	std::atomic<boolean> running{false};
+	std::atomic<jlong> recorded{0}, written{0};
+	std::atomic<jlong> dropped{0}, dropPkts{0}, writeErrors{0};
+
+	short *buf(int b, int ch) const { return pool + 2*((size_t)(b*chans + ch) * IQREC_BLOCK); }
+	void submit();
+	void writeLoop();
+	void writeBlock(int b);
+	void metaLine(int chan, const String& s); // chan -1: all
+public:
+	// blocks - size of block pool (queue), each holds IQREC_BLOCK samples of all channels
+	IqRecorder(const String& base, int chans, double rate, int blocks=16);
+	~IqRecorder();
+	String toString() const;
+
+	boolean open();
+	// write queued blocks and close files, call after the rx thread stopped
+	void close();
+
+	// (rx thread) n samples of each channel starting at tick ts
+	void record(const short *const *bufs, int n, jlong ts);
+	// (any thread) rx frequency of chan changed at tick
+	void tuned(int chan, jlong tick, double freq);
+
+	jlong getDropped() const { return dropped.load(); }
+	jlong getWritten() const { return written.load(); }
+};
+
+#endif
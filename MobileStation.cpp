@@ -2,6 +2,15 @@
 #include <lang/Math.hpp>
 
 #include "MobileStation.hpp"
+#include "Channelizer.hpp"
+#include "GsmSync.hpp"
+#include "BurstSlicer.hpp"
+#include "ChannelDecoder.hpp"
+#include "PowerScan.hpp"
+#include "SampleConvert.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 /*
 GSM Timing Table
@@ -86,6 +95,26 @@ struct {
 };
 }
 
+namespace {
+// wideband scan: capture SCAN_CHANNELS*200kHz at once and split it with channelizer
+const int SCAN_CHANNELS = 32;
+const int SCAN_USABLE = 24;       // channels inside the analog filter passband
+const int SCAN_FRAMES = 1024;     // channelizer outputs per tune (~5 ms)
+const double SCAN_RATE = SCAN_CHANNELS * 200e3;
+const int SCAN_SPS = 1;           // rx sps while searching for cells
+const int CAMP_SPS = 4;           // rx sps on serving cell
+const double TDMA_FRAME = 120e-3/26;
+
+void removeDC(float *x, int n) {
+	double re = 0, im = 0;
+	for (int i = 0; i < n; ++i) { re += x[2*i]; im += x[2*i+1]; }
+	float mre = (float)(re / n), mim = (float)(im / n);
+	for (int i = 0; i < n; ++i) { x[2*i] -= mre; x[2*i+1] -= mim; }
+}
+
+boolean strongerFirst(const ArfcnPower& a, const ArfcnPower& b) { return a.power > b.power; }
+}
+
 GsmBand upLinkFreq(GsmBand band, int n, double& freq) {
 	for (int i = 0; band_channels[i].band != GsmBand::Undef; ++i) {
 		if (n < band_channels[i].first || n > band_channels[i].last) continue;
@@ -105,7 +134,8 @@ GsmBand dnLinkFreq(GsmBand band, int n, double& freq) {
 }
 
 //TODO read rx_sps,tx_sps from config
-MobileStation::MobileStation() : usrp(4, 4) {
+// device runs at 4 sps, scanning decimates to 1 sps (see setRxSps)
+MobileStation::MobileStation() : usrp(4, 4), arfcn(-1), bsic(-1), tsc(-1), hsn(0), maio(0) {
 }
 MobileStation::~MobileStation() {
 	stop();
@@ -116,6 +146,8 @@ void MobileStation::btsScan(GsmBand band) {
 	//int decimation = (int)(master_clock_freq / GSM_RATE);
 
 	int chan = 0;
+	SpscSampleBuffer& rxb = usrp.getRxBuffer(chan);
+	float samples[2*625];
 	for (int i = 0; band_channels[i].band != GsmBand::Undef; ++i) {
 		if (band != band_channels[i].band) continue;
 		for (int n = band_channels[i].first; n <= band_channels[i].last; ++n) {
@@ -125,26 +157,318 @@ void MobileStation::btsScan(GsmBand band) {
 			upl *= 1e6;
 			dnl *= 1e6;
 
-			boolean done = false;
 			// tune radio to downlink (Base-to-Mobile)
 			usrp.setFreq(dnl, chan, false);
-			while (!done) {
-				usrp.recv();
-				done = true;
-			}
+			jlong t = rxb.settled(rxb.last());
+			if (!capture(rxb, t, samples, 625)) continue;
 		}
 	}
 	
 }
 
-void MobileStation::start() {
-	String addr = "";  // default device (autodetect)
+// copy n samples starting at t from rx buffer as floats (full scale = 1.0)
+// Samples before t are released first: while nobody reads the ring fills up and
+// the producer drops everything new, so the samples at t would never come.
+// skip - when samples at t are gone start at the oldest one, t is moved there
+boolean MobileStation::capture(SpscSampleBuffer& rxb, jlong& t, float *out, int n, boolean skip) {
+	jlong h = rxb.last();
+	rxb.release(t < h ? t : h);
+	jlong tmo = System.currentTimeMillis() + 1000;
+	for (int done = 0; done < n; ) {
+		int l = n - done;
+		const short *p = rxb.peek(t + done, l);
+		if (l < 0 && skip && done == 0) {
+			t = rxb.first();
+			continue;
+		}
+		if (l < 0) {
+			LOGW("capture: samples lost %s", rxb.toString().cstr());
+			return false;
+		}
+		if (l == 0) {
+			if (System.currentTimeMillis() > tmo) {
+				LOGE("capture: no samples");
+				return false;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+		toFloat(out + 2*done, p, 1.0f/32768, 2*l);
+		rxb.consume(l);
+		done += l;
+	}
+	return true;
+}
+
+// switch rx samples per symbol, serving cell clock follows the new tick rate
+boolean MobileStation::setRxSps(int sps) {
+	jlong t = usrp.getRxBuffer(0).last();
+	if (!usrp.setRxSps(sps)) return false;
+	clock.setRate(usrp.getRxRate(), t);
+	return true;
+}
+
+// scan band with wideband captures, one tune covers SCAN_USABLE channels
+std::vector<ArfcnPower> MobileStation::btsScanWide(GsmBand band) {
+	LOGD("btsScanWide %d...", band);
+	std::vector<ArfcnPower> result;
+	int chan = 0;
+	if (!usrp.setRxRate(SCAN_RATE, 4*SCAN_RATE)) {
+		LOGW("scan rate %.2lf MHz not exact, got %.4lf MHz", MHz(SCAN_RATE), MHz(usrp.getRxRate()));
+	}
+	SpscSampleBuffer& rxb = usrp.getRxBuffer(chan);
+
+	const int M = SCAN_CHANNELS;
+	const int n = M * SCAN_FRAMES;
+	const int skip = 16; // outputs while channelizer history fills
+	Channelizer chz(M);
+	Array<float> x(2*n), y(2*n);
+	Array<double> pwr(M);
+
+	int tunes = 0;
+	for (int i = 0; band_channels[i].band != GsmBand::Undef; ++i) {
+		if (band != band_channels[i].band) continue;
+		for (int c = band_channels[i].first; c <= band_channels[i].last; c += SCAN_USABLE) {
+			int center = c + SCAN_USABLE/2; // ARFCN at LO frequency
+			double dnl = band_channels[i].base_freq + 0.2*center + band_channels[i].dnl_offs;
+			usrp.setFreq(dnl*1e6, chan, false);
+			++tunes;
+
+			jlong t = rxb.settled(rxb.last());
+			if (!capture(rxb, t, &x[0], n)) continue;
+			removeDC(&x[0], n);
+			chz.reset();
+			chz.process(&x[0], n, &y[0]);
+
+			for (int k = 0; k < M; ++k) pwr[k] = 0;
+			for (int m = skip; m < SCAN_FRAMES; ++m) {
+				const float *v = &y[2*m*M];
+				for (int k = 0; k < M; ++k) pwr[k] += v[2*k]*v[2*k] + v[2*k+1]*v[2*k+1];
+			}
+			for (int k = -SCAN_USABLE/2; k < SCAN_USABLE/2; ++k) {
+				int arfcn = center + k;
+				if (arfcn < band_channels[i].first || arfcn > band_channels[i].last) continue;
+				double p = pwr[(k + M) % M] / (SCAN_FRAMES - skip);
+				result.push_back({arfcn, (float)(10*log10(p + 1e-20))});
+			}
+		}
+	}
+	usrp.setRxRate(0);
+
+	std::sort(result.begin(), result.end(), strongerFirst);
+	LOGD("btsScanWide: %d channels in %d tunes", (int)result.size(), tunes);
+	return result;
+}
+
+// power of band ARFCNs visible at current rx frequency, averaged over TDMA frames
+// Does not retune, but reads (and releases) rx_buffer, which has a single consumer:
+// must not run while receive() does, call it between receive() runs.
+std::vector<ArfcnPower> MobileStation::powerScan(GsmBand band, int frames) {
+	std::vector<ArfcnPower> result;
+	int chan = 0;
+	double rate = usrp.getRxRate();
+	double fc = usrp.getFreq(chan, false);
+	SpscSampleBuffer& rxb = usrp.getRxBuffer(chan);
+
+	PowerScan ps(rate);
+	const int blk = ps.blockSize() * 16;
+	Array<float> x(2*blk);
+	int nblk = (int)(frames * TDMA_FRAME * rate) / blk + 1;
+	jlong t = rxb.last();
+	for (int b = 0; b < nblk; ++b, t += blk) {
+		if (!capture(rxb, t, &x[0], blk, true)) return result;
+		removeDC(&x[0], blk);
+		ps.process(&x[0], blk);
+	}
+
+	double span = 0.4*rate - 100e3; // channel must fit into analog passband
+	for (int i = 0; band_channels[i].band != GsmBand::Undef; ++i) {
+		if (band != band_channels[i].band) continue;
+		for (int n = band_channels[i].first; n <= band_channels[i].last; ++n) {
+			double offs = (band_channels[i].base_freq + 0.2*n + band_channels[i].dnl_offs)*1e6 - fc;
+			if (Math::abs(offs) > span) continue;
+			result.push_back({n, ps.power(offs)});
+		}
+	}
+	std::sort(result.begin(), result.end(), strongerFirst);
+	return result;
+}
+
+// tune to arfcn and look for frequency correction burst (every 10 or 11 frames)
+boolean MobileStation::fcchSearch(int arfcn, int frames, FcchBurst& fb) {
+	int chan = 0;
+	double dnl;
+	if (dnLinkFreq(GsmBand::Undef, arfcn, dnl) == GsmBand::Undef) {
+		LOGE("fcchSearch: unknown ARFCN %d", arfcn);
+		return false;
+	}
+	usrp.setFreq(dnl*1e6, chan, false);
+	double rate = usrp.getRxRate();
+	SpscSampleBuffer& rxb = usrp.getRxBuffer(chan);
+
+	FcchDetector det(rate, usrp.getRxSps());
+	const int blk = 4096;
+	Array<float> x(2*blk);
+	int nblk = (int)(frames * TDMA_FRAME * rate) / blk + 1;
+	jlong t = rxb.settled(rxb.last());
+	for (int b = 0; b < nblk; ++b, t += blk) {
+		if (!capture(rxb, t, &x[0], blk)) return false;
+		if (det.process(&x[0], blk, t, &fb, 1) > 0) {
+			LOGD("FCCH on ARFCN %d at %ld, offset %.0f Hz, q=%.2f", arfcn, fb.ts, fb.freq, fb.quality);
+			return true;
+		}
+	}
+	return false;
+}
+
+// SCH follows FCCH by one frame, that one is usually consumed already by fcchSearch,
+// so take the next pair: FCCH is 10 frames later, or 11 if fb was in frame 40
+boolean MobileStation::schSync(const FcchBurst& fb) {
+	int chan = 0;
+	double rate = usrp.getRxRate();
+	int sps = usrp.getRxSps();
+	SpscSampleBuffer& rxb = usrp.getRxBuffer(chan);
+
+	const int range = 8; // symbols searched around expected position
+	jlong frame = (jlong)(rate * QSYM_PER_FRAME / (4*GSM_SYMBOL_RATE) + 0.5);
+	jlong first = fb.ts + 11*frame, second = fb.ts + 12*frame;
+	jlong t = first - range*sps;
+	int n = (int)(second - first) + (2*range + 148 + 1)*sps;
+	Array<float> x(2*n);
+	if (!capture(rxb, t, &x[0], n)) return false;
+
+	GsmSync sync(rate, sps);
+	SchInfo info;
+	if (!sync.sch(&x[0], n, t, first, range, fb.freq, info) && !sync.sch(&x[0], n, t, second, range, fb.freq, info)) {
+		LOGW("schSync: no SCH after FCCH at %ld", fb.ts);
+		return false;
+	}
+	bsic = info.bsic;
+	if (tsc < 0) tsc = bsic & 7;
+	clock = GsmClock(rate);
+	clock.set(info.ts, info.fn);
+	LOGN("BSIC %d, FN %d, q=%.2f, %s", bsic, info.fn, info.quality, clock.toString().cstr());
+	return true;
+}
+
+// receive() hops over ma (ARFCNs) instead of staying on arfcn, empty ma disables hopping
+void MobileStation::setHopping(const Array<int>& ma, int hsn, int maio) {
+	this->ma = ma;
+	this->hsn = hsn;
+	this->maio = maio;
+}
+
+// follow serving cell timeslots, mean power and SNR per TN are logged
+// BCCH/CCCH blocks of TN0 are decoded
+void MobileStation::receive(int frames) {
+	if (!clock.isValid()) throw IllegalStateException("MobileStation: not synchronized");
+	SpscSampleBuffer& rxb = usrp.getRxBuffer(0);
+	BurstSlicer slicer(rxb, clock, 8*usrp.getRxSps());
+	slicer.start(rxb.last());
+	slicer.setArfcn(arfcn);
+	std::unique_ptr<HoppingSequence> seq;
+	std::unique_ptr<FrequencyHopper> hopper;
+	if (ma.length > 0) {
+		Array<double> freq(ma.length);
+		for (int i = 0; i < ma.length; ++i) {
+			if (dnLinkFreq(GsmBand::Undef, ma[i], freq[i]) == GsmBand::Undef) {
+				LOGE("receive: unknown ARFCN %d in MA", ma[i]);
+				return ;
+			}
+			freq[i] *= 1e6;
+		}
+		seq.reset(new HoppingSequence(ma, hsn, maio));
+		hopper.reset(new FrequencyHopper(usrp, clock, *seq, freq));
+		hopper->update(rxb.last());
+		// frames before the first queued tune are on the old frequency
+		jlong t = rxb.last();
+		slicer.start((jlong)ceil(clock.toTick(GsmClock::fnAdd(clock.toGsm(t).fn, 1), 0, t)));
+		slicer.setHopping(seq.get());
+	}
+	GmskDemod demod(usrp.getRxSps());
+	ChannelDecoder decoder;
+
+	const int batch = 16;
+	BurstView v[batch];
+	BurstSoft soft[batch];
+	double pwr[8] = {0}, snr[8] = {0};
+	// xCCH blocks are collected and decoded in batches
+	const int maxBlocks = 8;
+	BurstSoft blk[4];
+	int blkFn = -1;
+	Array<float> coded(maxBlocks*XCCH_CODED);
+	int blocks = 0, good = 0, decoded = 0, unsettled = 0;
+	XcchBlock out[maxBlocks];
+	int total = 8*frames;
+	jlong tmo = System.currentTimeMillis() + 1000;
+	while (total > 0) {
+		if (hopper) hopper->update(rxb.last());
+		int n = slicer.next(v, std::min(batch, total));
+		if (n == 0) {
+			if (System.currentTimeMillis() > tmo) {
+				LOGE("receive: no samples");
+				break;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+		tmo = System.currentTimeMillis() + 1000;
+		demod.demod(v, n, tsc, soft);
+		for (int i = 0; i < n; ++i) {
+			if (!v[i].settled) { ++unsettled; continue; }
+			pwr[v[i].tn] += pow(10, soft[i].power/10);
+			snr[v[i].tn] += soft[i].snr;
+			int b = v[i].tn == 0 ? ChannelDecoder::xcchBurst(v[i].fn) : -1;
+			if (b < 0) continue;
+			if (b == 0) blkFn = v[i].fn;
+			else if (blkFn < 0 || GsmClock::fnDiff(v[i].fn, blkFn) != b) continue;
+			blk[b] = soft[i];
+			if (b < 3) continue;
+			const BurstSoft *bb[4] = {&blk[0], &blk[1], &blk[2], &blk[3]};
+			ChannelDecoder::deinterleave(bb, &coded[blocks*XCCH_CODED]);
+			blkFn = -1;
+			if (++blocks == maxBlocks) {
+				good += decoder.decode(&coded[0], blocks, out);
+				decoded += blocks;
+				blocks = 0;
+			}
+		}
+		total -= n;
+	}
+	slicer.release();
+	if (blocks > 0) {
+		good += decoder.decode(&coded[0], blocks, out);
+		decoded += blocks;
+	}
+	LOGN("xCCH blocks: %d/%d decoded, %d bursts skipped while retuning", good, decoded, unsettled);
+	for (int tn = 0; tn < 8; ++tn) {
+		LOGN("TN%d: %.1f dBFS, SNR %.1f dB", tn, 10*log10(pwr[tn]/frames + 1e-20), snr[tn]/frames);
+	}
+	LOGD("%s", slicer.toString().cstr());
+	if (hopper) LOGD("%s", hopper->toString().cstr());
+}
+
+void MobileStation::start(const String& addr) {
 	if (!usrp.open(addr)) return ;
+	setRxSps(SCAN_SPS);
 	Array<String> a = usrp.listClockSources();
 	for (String& s : a) System.out.println(s);
 	a = usrp.listTimeSources();
 	for (String& s : a) System.out.println(s);
-	btsScan(GsmBand::GSM1800);
+	std::vector<ArfcnPower> scan = btsScanWide(GsmBand::GSM1800);
+	for (int i = 0; i < (int)scan.size() && i < 10; ++i) {
+		LOGN("ARFCN %d: %.1f dBFS", scan[i].arfcn, scan[i].power);
+	}
+	FcchBurst fb;
+	for (int i = 0; i < (int)scan.size() && i < 5; ++i) {
+		if (fcchSearch(scan[i].arfcn, 12, fb) && schSync(fb)) {
+			arfcn = scan[i].arfcn;
+			break;
+		}
+	}
+	if (!clock.isValid()) return ;
+	setRxSps(CAMP_SPS);
+	receive(4*26);
 }
 void MobileStation::stop() {
 	LOGD("MobileStation::stop");
@@ -2,6 +2,10 @@
 #define MOBILESTATION_HPP
 
 #include "RadioDevice.hpp"
+#include "FcchDetector.hpp"
+#include "GsmClock.hpp"
+
+#include <vector>
 
 enum class GsmBand {
 	Undef,
@@ -15,19 +19,43 @@ enum class GsmBand {
 	GSM1900,
 };
 
+struct ArfcnPower {
+	int arfcn;
+	float power; // dBFS
+};
+
 class MobileStation : extends Object {
 private:
 	RadioDevice usrp;
 	int arfcn; // Absolute radio-frequency channel number
+	int bsic;
+	int tsc;        // training sequence of normal bursts (BCC of BSIC unless set)
+	GsmClock clock; // rx buffer ticks to FN/TN of serving cell
+	Array<int> ma;  // mobile allocation when hopping (empty - no hopping)
+	int hsn, maio;
+
+	boolean setRxSps(int sps);
 
 public:
 	MobileStation();
 	~MobileStation();
 	String toString() const;
 
-	void start();
+	// addr: device args, "" - autodetect UHD device (see RadioDevice::open)
+	void start(const String& addr="");
 	void stop();
 	void btsScan(GsmBand band);
+	std::vector<ArfcnPower> btsScanWide(GsmBand band);
+	// consumes rx samples, not while receive() runs
+	std::vector<ArfcnPower> powerScan(GsmBand band, int frames);
+	boolean fcchSearch(int arfcn, int frames, FcchBurst& fb);
+	boolean schSync(const FcchBurst& fb);
+	void receive(int frames);
+	void setTsc(int tsc) { this->tsc = tsc; }
+	void setHopping(const Array<int>& ma, int hsn, int maio);
+
+	// n samples from t as floats, waits up to 1 s for them (skip: see MobileStation.cpp)
+	static boolean capture(SpscSampleBuffer& rxb, jlong& t, float *out, int n, boolean skip = false);
 };
 
 
@@ -0,0 +1,56 @@
+#include <lang/System.hpp>
+
+#include "PowerScan.hpp"
+
+#include <cmath>
+
+PowerScan::PowerScan(double rate, int fftSize, int batch) : rate(rate), n(fftSize), batch(batch),
+		fft(fftSize), win(fftSize), work(2*fftSize*batch), acc(fftSize), norm(0), blocks(0) {
+	if (batch < 1) throw IllegalArgumentException(String::format("PowerScan batch %d", batch));
+	double s = 0;
+	for (int i = 0; i < n; ++i) {
+		win[i] = (float)(0.5 - 0.5*cos(2*M_PI*i/n));
+		s += (double)win[i] * win[i];
+	}
+	norm = n * s;
+	reset();
+}
+
+void PowerScan::reset() {
+	for (int i = 0; i < n; ++i) acc[i] = 0;
+	blocks = 0;
+}
+
+void PowerScan::process(const float *x, int len) {
+	int total = len / n;
+	while (total > 0) {
+		int cnt = total < batch ? total : batch;
+		float *w = &work[0];
+		for (int b = 0; b < cnt; ++b, x += 2*n, w += 2*n) {
+			for (int i = 0; i < n; ++i) {
+				w[2*i] = x[2*i] * win[i];
+				w[2*i+1] = x[2*i+1] * win[i];
+			}
+		}
+		fft.transform(&work[0], cnt);
+		w = &work[0];
+		for (int b = 0; b < cnt; ++b, w += 2*n) {
+			for (int i = 0; i < n; ++i) acc[i] += (double)w[2*i]*w[2*i] + (double)w[2*i+1]*w[2*i+1];
+		}
+		blocks += cnt;
+		total -= cnt;
+	}
+}
+
+float PowerScan::power(double offs, double bw) const {
+	if (blocks == 0) return -200.0f;
+	double df = rate / n;
+	int lo = (int)ceil((offs - bw/2) / df);
+	int hi = (int)floor((offs + bw/2) / df);
+	if (lo < -n/2) lo = -n/2;
+	if (hi > n/2 - 1) hi = n/2 - 1;
+	double p = 0;
+	for (int k = lo; k <= hi; ++k) p += acc[k < 0 ? k + n : k];
+	p /= norm * blocks;
+	return (float)(10*log10(p + 1e-20));
+}
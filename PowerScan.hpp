@@ -0,0 +1,31 @@
+#ifndef POWERSCAN_HPP
+#define POWERSCAN_HPP
+
+#include "FFT.hpp"
+
+// Averaged FFT power spectrum (Hann window, non-overlapping blocks).
+// Blocks are transformed in batches, power() integrates bins of one channel.
+class PowerScan : extends Object {
+private:
+	double rate;
+	int n;              // FFT size
+	int batch;          // blocks per FFT call
+	FFT fft;
+	Array<float> win;
+	Array<float> work;  // batch*n complex
+	Array<double> acc;  // accumulated |X|^2, natural bin order
+	double norm;        // n*sum(win^2)
+	int blocks;
+public:
+	PowerScan(double rate, int fftSize=256, int batch=16);
+
+	void reset();
+	int blockSize() const { return n; }
+	int averaged() const { return blocks; }
+	// n complex samples (interleaved I/Q), tail shorter than blockSize() is ignored
+	void process(const float *x, int n);
+	// mean power (dBFS) of band [offs-bw/2, offs+bw/2] relative to center frequency
+	float power(double offs, double bw=180e3) const;
+};
+
+#endif
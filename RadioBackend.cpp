@@ -0,0 +1,18 @@
+#include <lang/System.hpp>
+
+#include "RadioBackend.hpp"
+#include "UhdBackend.hpp"
+#include "VirtualBackend.hpp"
+#include "SynthBackend.hpp"
+
+RadioBackend *RadioBackend::create(const String& args) {
+	RadioBackend *b;
+	if (args.startsWith("file=")) b = new FileBackend();
+	else if (args.startsWith("synth")) b = new SynthBackend();
+	else b = new UhdBackend();
+	if (!b->open(args)) {
+		delete b;
+		return null;
+	}
+	return b;
+}
@@ -0,0 +1,89 @@
+#ifndef RADIOBACKEND_HPP
+#define RADIOBACKEND_HPP
+
+#include <lang/String.hpp>
+
+enum class DeviceType {
+	Undef,
+	USRP1,
+	USRP2,
+	B100,
+	B2xx,
+	E1xx,
+	E3xx,
+	X3xx,
+	UMTRX,
+	LIME_USB,
+	LIME_PCIE,
+	IQFILE, // sc16 file replay
+	SYNTH,  // generated GSM cell
+};
+
+enum class RxError { NONE, TIMEOUT, OVERFLOW, LATE, OTHER };
+struct RxMeta {
+	RxError error;
+	boolean hasTime;
+	jlong ts;        // tick of first sample at rx stream rate
+};
+struct TxMeta {
+	boolean startOfBurst, endOfBurst;
+	boolean hasTime;
+	jlong ts;        // tick of first sample at tx stream rate
+};
+enum class TxEvent { ACK, UNDERFLOW, TIME_ERROR, OTHER };
+
+struct TuneRequest {
+	double freq;
+	double loOffset; // LO offset from freq when rf is chosen by backend
+	double rf;       // LO to use, 0 - backend decides
+	double dsp;      // NCO offset to use with rf, ignored if !manualDsp
+	boolean manualDsp;
+};
+struct TuneResult {
+	double rf;       // LO
+	double dsp;      // NCO offset as passed to tune request
+};
+
+// Sample source/sink behind RadioDevice: SDR hardware (UHD), IQ file replay or
+// synthetic GSM cell. Stream timestamps are ticks at the stream rate, device time is in s.
+class RadioBackend : extends Object {
+public:
+	// "file=<path>,..." replays IQ file, "synth,..." generates signal, anything else is UHD device args
+	static RadioBackend *create(const String& args);
+
+	virtual ~RadioBackend() {}
+	virtual boolean open(const String& args) = 0;
+	virtual String name() const = 0;
+	virtual DeviceType type() const = 0;
+	virtual int channels() const = 0;
+
+	// all setters return actual value
+	virtual double setMasterClock(double clock) = 0;
+	virtual double getMasterClock() = 0;
+	virtual double setRxRate(double rate) = 0;
+	virtual double setTxRate(double rate) = 0;
+	virtual void setBandwidth(double bw, int chan, boolean tx) = 0;
+	virtual void gainRange(int chan, boolean tx, double& min, double& max) = 0;
+	virtual double setGain(double gain, int chan, boolean tx) = 0;
+	virtual void setAntenna(const String& ant, int chan, boolean tx) = 0;
+	// at - device time when the tune applies (<= 0 now)
+	virtual TuneResult tune(const TuneRequest& req, int chan, boolean tx, double at) = 0;
+	virtual double getTime() = 0;
+	virtual void setTime(double t) = 0;
+	virtual Array<String> clockSources() = 0;
+	virtual Array<String> timeSources() = 0;
+
+	// streams are opened after rates are set
+	virtual boolean openStreams() = 0;
+	virtual void close() = 0;
+	virtual int maxPacket() = 0; // samples per rx packet
+	// continuous rx from device time at (<= 0 now)
+	virtual void startRx(double at) = 0;
+	virtual void stopRx() = 0;
+	virtual int recv(short *const *bufs, int n, RxMeta& md, double timeout) = 0;
+	virtual int send(const short *const *bufs, int n, const TxMeta& md) = 0;
+	// next async tx event, false if none
+	virtual boolean txEvent(TxEvent& ev) = 0;
+};
+
+#endif
@@ -3,12 +3,17 @@
 
 #include "RadioDevice.hpp"
 
-#include <uhd/usrp/multi_usrp.hpp>
+#include <algorithm>
+#include <cmath>
+#include <pthread.h>
+#include <sched.h>
 
 // GSM symbol rate = 270.83 kHz
 #define GSMRATE (1625000.0 / 6.0)
 #define SAMPLE_BUF_SZ   (1 << 20)
 #define CHUNK_SIZE 625  //=burst size
+#define GSM_FRAME_TIME (60e-3 / 13)
+#define LO_SETTLE_TIME  200e-6 // PLL lock after RF LO change
 
 
 namespace {
@@ -42,11 +47,6 @@ struct {
 };
 
 
-DeviceType parse_device_type(const String& board) {
-	if (board.equals("LimeSDR-USB")) return DeviceType::LIME_USB;
-	return DeviceType::Undef;
-}
-
 double get_dev_offset(DeviceType type, int rx_sps, int tx_sps) {
 	for (int i=0; uhd_offsets[i].type != DeviceType::Undef; ++i) {
 		if (type == uhd_offsets[i].type && rx_sps == uhd_offsets[i].rx_sps && tx_sps == uhd_offsets[i].tx_sps)
@@ -55,18 +55,36 @@ double get_dev_offset(DeviceType type, int rx_sps, int tx_sps) {
 	LOGW("This configuration not supported (type=%d,rx_sps=%d,tx_sps=%d)", type, rx_sps, tx_sps);
 	return 0.0;
 }
-}
 
-void toFloat(float *out, const short *in, float scale, int len) {
-	for (int i = 0; i < len; i++) out[i] = in[i]*scale;
+// apply scheduling params to calling thread
+void setThreadParams(const char *name, int priority, int cpu) {
+	pthread_t th = pthread_self();
+	pthread_setname_np(th, name);
+	if (cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		int r = pthread_setaffinity_np(th, sizeof(cpus), &cpus);
+		if (r != 0) LOGW("%s: can't pin to cpu %d: %s", name, cpu, strerror(r));
+	}
+	if (priority > 0) {
+		struct sched_param param;
+		param.sched_priority = priority;
+		int r = pthread_setschedparam(th, SCHED_FIFO, &param);
+		if (r != 0) LOGW("%s: can't set SCHED_FIFO priority %d: %s", name, priority, strerror(r));
+	}
 }
-void toShort(short *out, const float *in, float scale, int len) {
-	for (int i = 0; i < len; i++) out[i] = (short)(in[i]*scale);
 }
 
 int SampleBuffer::space() const {
 	return capacity - len;
 }
+int SampleBuffer::space(jlong t) const {
+	if (len == 0) return capacity;
+	if (t < tm0) return -1;
+	jlong n = capacity - (t - tm0);
+	return n > 0 ? (int)n : 0;
+}
 int SampleBuffer::available(jlong t) const {
 	if (t < tm0) return -1; // past
 	jlong tm1 = tm0 + len;
@@ -74,49 +92,93 @@ int SampleBuffer::available(jlong t) const {
 	return (int)(tm1 - t);  // number of samples
 }
 
-// write samples (first sample in buf has time=t)
-int SampleBuffer::write(short *b, int l, jlong t) {
+// prepare writing n samples at t, returns pointer into buffer
+// n is reduced to number of samples which can be written contiguously
+short *SampleBuffer::reserve(int& n, jlong t) {
 	int sz = 2*sizeof(short); // sample size
 
-	if (l < 0 || l > capacity) throw RuntimeException("wrong length "+l);
-	if (l == 0) return 0;
+	if (n <= 0 || n > capacity) throw RuntimeException(String::format("wrong length %d", n));
 	if (len == 0) tm0 = t;
 	if (t < tm0) {
 		LOGW("Attempt to write data in the past");
-		return -1;
+		n = 0;
+		return null;
+	}
+	if (t + n - tm0 > capacity) {
+		// drop oldest samples
+		jlong d = t + n - capacity - tm0;
+		if (d < len) {
+			idx = (idx + (int)d) % capacity;
+			tm0 += d;
+			len -= (int)d;
+		}
+		else {
+			tm0 = t;
+			len = 0;
+		}
+		LOGW("Buffer overflow");
 	}
 	jlong tm1 = tm0 + len;
-	if (t < tm1) {
-		LOGW("Overwriting old data");
-	}
-	else if (tm1 < t) {
-		LOGW("Making Gap in data");
+	if (tm1 < t) {
+		// gap in data, fill with zeros
 		int l1 = (int)(t-tm1);
-		int i1=(idx+l1)%capacity;
-		if (i1+l1 <= capacity) memset(buf+i1*sz, 0, l1*sz);
+		int i1 = (idx+len)%capacity;
+		if (mirrored || i1+l1 <= capacity) memset(buf + 2*i1, 0, l1*sz);
 		else {
 			int rem = capacity-i1;
-			memset(buf + i1*sz, 0, rem*sz);
+			memset(buf + 2*i1, 0, rem*sz);
 			memset(buf, 0, (l1-rem)*sz);
 		}
 	}
 
-	int i0=(idx+(int)(t-tm0))%capacity;
-	if (i0+l <= capacity) {
-		memcpy(buf+i0*sz, b, l*sz);
-	}
-	else {
-		int rem = capacity-i0;
-		memcpy(buf + i0*sz, b, rem*sz);
-		memcpy(buf, b + rem*sz, (l-rem)*sz);
-	}
-	if (tm1 < t + l) tm1 = t + l;
-	len = (int)(tm1-tm0);
-	if (len > capacity) {
-		idx = (i0+len+capacity)%capacity;
-		len = capacity;
-		tm0 = t-capacity;
-		LOGW("Buffer overflow");
+	int i0 = (idx+(int)(t-tm0))%capacity;
+	if (!mirrored && n > capacity - i0) n = capacity - i0;
+	tmResv = t;
+	return buf + 2*i0;
+}
+// n samples written at pointer returned by reserve
+void SampleBuffer::commit(int n) {
+	tmResv += n;
+	if (tm0 + len < tmResv) len = (int)(tmResv - tm0);
+}
+
+// returns pointer to samples starting from t
+// n is reduced to number of samples available contiguously (0 - future, -1 - past)
+const short *SampleBuffer::peek(jlong t, int& n) {
+	if (n <= 0) throw RuntimeException(String::format("wrong length %d", n));
+	jlong tm1 = tm0 + len;
+	if (t < tm0) { n = -1; return null; } // past data
+	if (t >= tm1) { n = 0; return null; } //future data
+
+	int i0 = (idx+(int)(t-tm0))%capacity;
+	if (n > tm1 - t) n = (int)(tm1 - t);
+	if (!mirrored && n > capacity - i0) n = capacity - i0;
+	tmPeek = t;
+	return buf + 2*i0;
+}
+// release samples up to peeked timestamp + n
+void SampleBuffer::consume(int n) {
+	tmPeek += n;
+	if (tmPeek <= tm0) return ;
+	jlong d = tmPeek - tm0;
+	if (d > len) d = len;
+	idx = (idx + (int)d) % capacity;
+	tm0 += d;
+	len -= (int)d;
+}
+
+// write samples (first sample in buf has time=t)
+int SampleBuffer::write(const short *b, int l, jlong t) {
+	int sz = 2*sizeof(short); // sample size
+
+	if (l < 0 || l > capacity) throw RuntimeException(String::format("wrong length %d", l));
+	for (int done = 0; done < l; ) {
+		int n = l - done;
+		short *p = reserve(n, t + done);
+		if (p == null) return -1;
+		memcpy(p, b + 2*done, n*sz);
+		commit(n);
+		done += n;
 	}
 	return l;
 }
@@ -126,85 +188,229 @@ int SampleBuffer::write(short *b, int l, jlong t) {
 int SampleBuffer::read(short *b, int l, jlong t) {
 	int sz = 2*sizeof(short); // sample size
 
-	if (l <= 0) throw RuntimeException("wrong length "+l);
-	if (t < tm0) return -1; // past data
-	jlong tm1 = tm0 + len;
-	if (t >= tm1) return 0; //future data
+	if (l <= 0) throw RuntimeException(String::format("wrong length %d", l));
+	int done = 0;
+	while (done < l) {
+		int n = l - done;
+		const short *p = peek(t + done, n);
+		if (n <= 0) return done > 0 ? done : n;
+		memcpy(b + 2*done, p, n*sz);
+		consume(n);
+		done += n;
+	}
+	return done;
+}
+
+SpscSampleBuffer::SpscSampleBuffer(int capacity, double rate, boolean mirror) : mirrored(mirror), owned(true), rate(rate), tmHead(0), tmTail(0), tmBase(0), dropped(0) {
+	if (capacity <= 0) throw RuntimeException(String::format("wrong capacity %d", capacity));
+	int c = 1;
+	while (c < capacity) c <<= 1;
+	buf = ringAlloc(c, mirrored);
+	this->capacity = c;
+}
+SpscSampleBuffer::SpscSampleBuffer(int capacity, double rate, SampleArena& arena) : owned(false), rate(rate), tmHead(0), tmTail(0), tmBase(0), dropped(0) {
+	if (capacity <= 0 || (capacity & (capacity-1)) != 0) throw RuntimeException(String::format("wrong capacity %d", capacity));
+	buf = arena.ring(capacity, mirrored);
+	if ((capacity & (capacity-1)) != 0) throw RuntimeException(String::format("wrong arena ring capacity %d", capacity));
+	this->capacity = capacity;
+}
 
-	int n = (int)(tm1-t); //number of available samples (from t to tm1)
-	if (l > n) l = n;
+void SpscSampleBuffer::reset(double rate) {
+	this->rate = rate;
+	tmHead.store(0);
+	tmTail.store(0);
+	tmBase.store(0);
+	dropped.store(0);
+	resync = false;
+	std::lock_guard<std::mutex> lk(unsetLock);
+	for (int i = 0; i < SETTLE_WINDOWS; ++i) unsetFrom[i] = unsetTo[i] = 0;
+	unsetNext = 0;
+}
 
-	int i0=(idx+(int)(t-tm0))%capacity;
-	if (i0+l <= capacity) {
-		memcpy(b, buf+i0*sz, l*sz);
+void SpscSampleBuffer::unsettled(jlong from, jlong to) {
+	if (to <= from) return;
+	std::lock_guard<std::mutex> lk(unsetLock);
+	unsetFrom[unsetNext] = from;
+	unsetTo[unsetNext] = to;
+	unsetNext = (unsetNext + 1) % SETTLE_WINDOWS;
+}
+boolean SpscSampleBuffer::isSettled(jlong t, int n) const {
+	std::lock_guard<std::mutex> lk(unsetLock);
+	for (int i = 0; i < SETTLE_WINDOWS; ++i) {
+		if (t + n > unsetFrom[i] && t < unsetTo[i]) return false;
 	}
-	else {
-		int rem = capacity-i0;
-		memcpy(b, buf + i0*sz, rem*sz);
-		memcpy(b + rem*sz, buf, (l-rem)*sz);
+	return true;
+}
+jlong SpscSampleBuffer::settled(jlong t) const {
+	std::lock_guard<std::mutex> lk(unsetLock);
+	// windows may chain, move past each one containing t
+	for (int k = 0; k < SETTLE_WINDOWS; ++k) {
+		boolean moved = false;
+		for (int i = 0; i < SETTLE_WINDOWS; ++i) {
+			if (t >= unsetFrom[i] && t < unsetTo[i]) { t = unsetTo[i]; moved = true; }
+		}
+		if (!moved) break;
 	}
-	idx = (i0 + l)%capacity;
-	tm0 = t + l;
-	len = (int)(tm1-tm0);
-	return l;
+	return t;
 }
 
-class UHDdata {
-public:
-	uhd::usrp::multi_usrp::sptr usrp_dev;
-	uhd::rx_streamer::sptr rx_stream;
-	uhd::tx_streamer::sptr tx_stream;
-};
+int SpscSampleBuffer::space() const {
+	jlong h = tmHead.load(std::memory_order_relaxed);
+	return capacity - (int)(h - first(tmTail.load(std::memory_order_acquire)));
+}
+int SpscSampleBuffer::available(jlong t) const {
+	jlong h = tmHead.load(std::memory_order_acquire);
+	if (t < first(tmTail.load(std::memory_order_relaxed))) return -1; // past
+	if (t >= h) return 0; // future
+	return (int)(h - t);  // number of samples
+}
+
+// prepare writing n samples at t (t >= last()), returns pointer into ring
+// n is reduced to number of samples which can be written contiguously, 0 on overflow
+short *SpscSampleBuffer::reserve(int& n, jlong t) {
+	int sz = 2*sizeof(short); // sample size
+
+	if (n <= 0 || n > capacity) throw RuntimeException(String::format("wrong length %d", n));
+	jlong h = tmHead.load(std::memory_order_relaxed);
+	jlong s = first(tmTail.load(std::memory_order_acquire));
+	resync = false;
+	if (t < h) { n = 0; return null; }
+	if (t > h) {
+		if (h == s) {
+			// empty, resync to the new timestamp on commit
+			resync = true;
+			s = t;
+		}
+		else if (t - s < capacity) {
+			// fill the gap with zeros
+			int l1 = (int)(t - h);
+			int i1 = (int)(h & (capacity-1));
+			if (mirrored || i1+l1 <= capacity) memset(buf + 2*i1, 0, l1*sz);
+			else {
+				int rem = capacity-i1;
+				memset(buf + 2*i1, 0, rem*sz);
+				memset(buf, 0, (l1-rem)*sz);
+			}
+		}
+	}
+
+	int i0 = (int)(t & (capacity-1));
+	int l = capacity - (int)(t - s);
+	if (!mirrored && l > capacity - i0) l = capacity - i0;
+	if (n > l) n = l;
+	if (n <= 0) { n = 0; return null; }
+	tmResv = t;
+	return buf + 2*i0;
+}
+// publish n samples written at pointer returned by reserve
+void SpscSampleBuffer::commit(int n) {
+	if (n <= 0) return ;
+	if (resync) {
+		tmBase.store(tmResv, std::memory_order_relaxed);
+		resync = false;
+	}
+	tmResv += n;
+	tmHead.store(tmResv, std::memory_order_release);
+}
+
+// write samples (first sample in buf has time=t)
+// never overwrites unread samples, on overflow the newest samples are dropped
+int SpscSampleBuffer::write(const short *b, int l, jlong t) {
+	int sz = 2*sizeof(short); // sample size
+
+	if (l < 0 || l > capacity) throw RuntimeException(String::format("wrong length %d", l));
+	if (l == 0) return 0;
+	jlong h = tmHead.load(std::memory_order_relaxed);
+	if (t < h) {
+		// overlaps published data, keep only the new part
+		if (t + l <= h) return -1;
+		int n = (int)(h - t);
+		b += 2*n; l -= n; t = h;
+	}
+
+	int done = 0;
+	while (done < l) {
+		int n = l - done;
+		short *p = reserve(n, t + done);
+		if (p == null) break;
+		memcpy(p, b + 2*done, n*sz);
+		commit(n);
+		done += n;
+	}
+	if (done < l) dropped.fetch_add(l - done, std::memory_order_relaxed);
+	return done;
+}
+
+// returns pointer to samples starting from t
+// n is reduced to number of samples available contiguously (0 - future, -1 - past)
+const short *SpscSampleBuffer::peek(jlong t, int& n) {
+	if (n <= 0) throw RuntimeException(String::format("wrong length %d", n));
+	jlong h = tmHead.load(std::memory_order_acquire);
+	if (t < first(tmTail.load(std::memory_order_relaxed))) { n = -1; return null; } // past data
+	if (t >= h) { n = 0; return null; } //future data
+
+	int i0 = (int)(t & (capacity-1));
+	if (n > h - t) n = (int)(h - t);
+	if (!mirrored && n > capacity - i0) n = capacity - i0;
+	tmPeek = t;
+	return buf + 2*i0;
+}
+// release samples up to peeked timestamp + n to the producer
+void SpscSampleBuffer::consume(int n) {
+	tmPeek += n;
+	tmTail.store(tmPeek, std::memory_order_release);
+}
+void SpscSampleBuffer::release(jlong t) {
+	if (t > tmTail.load(std::memory_order_relaxed)) tmTail.store(t, std::memory_order_release);
+}
+
+// read samples starting from t
+// samples older than t+return value are released to the producer
+int SpscSampleBuffer::read(short *b, int l, jlong t) {
+	int sz = 2*sizeof(short); // sample size
+
+	if (l <= 0) throw RuntimeException(String::format("wrong length %d", l));
+	int done = 0;
+	while (done < l) {
+		int n = l - done;
+		const short *p = peek(t + done, n);
+		if (n <= 0) return done > 0 ? done : n;
+		memcpy(b + 2*done, p, n*sz);
+		consume(n);
+		done += n;
+	}
+	return done;
+}
 
 RadioDevice::RadioDevice(int rx_sps, int tx_sps) {
 	this->rx_sps = rx_sps;
 	this->tx_sps = tx_sps;
 }
 RadioDevice::~RadioDevice() {
-	if (uhd) { close(); delete uhd; }
+	if (backend) close();
 }
 String RadioDevice::toString() const {
-	return String::format("%s", uhd->usrp_dev->get_mboard_name().c_str());
+	return backend ? backend->name() : String("not opened");
 }
 
 boolean RadioDevice::open(const String& args) {
-	rx_pkt_cnt = tx_pkt_cnt = 0;
-	// Find UHD devices
-	uhd::device_addr_t addr(args.intern());
-	uhd::device_addrs_t dev_addrs = uhd::device::find(addr);
-	if (dev_addrs.size() == 0) {
-	    LOGE("No UHD devices found with address '%s'", args.cstr());
-	    return false;
-	}
-
-	if (!uhd) uhd = new UHDdata;
-	LOGD("Using discovered UHD device %s", dev_addrs[0].to_string().c_str());
-	try {
-	    uhd->usrp_dev = uhd::usrp::multi_usrp::make(addr);
-	} catch(...) {
-	    LOGE("UHD make failed, device '%s'", args);
-	    return false;
-	}
-
-	uhd::property_tree::sptr prop_tree = uhd->usrp_dev->get_device()->get_tree();
-	String board = uhd->usrp_dev->get_mboard_name();
-	//String dev_name = prop_tree->access<std::string>("/name").get();
-	devType = parse_device_type(board);
-	if (devType == DeviceType::Undef) {
-	    LOGE("Parse device type failed for '%s'", board.cstr());
-		return false;
-	}
-
-	if (devType == DeviceType::B2xx) chans = 2;
-	else if (devType == DeviceType::UMTRX) chans = 2;
-	else chans = 1;
+	tx_pkt_cnt = 0;
+	if (backend) close();
+	backend = RadioBackend::create(args);
+	if (!backend) return false;
+	devType = backend->type();
+	chans = backend->channels();
 	LOGD("DeviceType %d, chans=%d", devType, chans);
 
 	rx_gain = Array<double>(chans);
 	tx_gain = Array<double>(chans);
 	rx_freq = Array<double>(chans);
 	tx_freq = Array<double>(chans);
-	rx_buffer = Array<SampleBuffer>(chans);
+	rx_lo = Array<double>(chans);
+	tx_lo = Array<double>(chans);
+	for (int i = 0; i < chans; ++i) rx_lo[i] = tx_lo[i] = 0;
+	tuneCache.clear();
+	rx_buffer = Array<SpscSampleBuffer>(chans);
 	tx_buffer = Array<SampleBuffer>(chans);
 
 	// set master clock
@@ -235,86 +441,84 @@ boolean RadioDevice::open(const String& args) {
 	}
 	double actual_clock = -1;
 	if (master_clock_freq > 0) {
-		uhd->usrp_dev->set_master_clock_rate(master_clock_freq);
-		double actual_clock = uhd->usrp_dev->get_master_clock_rate();
+		actual_clock = backend->setMasterClock(master_clock_freq);
 		master_clock_offset = actual_clock - master_clock_freq;
 		if (Math::abs(master_clock_offset) > 1.0) {
 			LOGE("Failed to set master clock rate %.2lf", MHz(master_clock_freq));
 			return false;
 		}
 	}
+	master_clock = master_clock_freq;
 	LOGD("master_clock_freq %.2lf MHz(err=%.2lf)  rx/tx rate %.2lf/%.2lf MHz",
 			MHz(actual_clock), MHz(master_clock_offset), MHz(rx_rate), MHz(tx_rate));
 
-	// set rx/tx rate
-	uhd->usrp_dev->set_rx_rate(rx_rate);
-	uhd->usrp_dev->set_tx_rate(tx_rate);
-	rx_rate = uhd->usrp_dev->get_rx_rate();
-	tx_rate = uhd->usrp_dev->get_tx_rate();
+	// set rx/tx rate, rx_buffer runs at GSM rate (resampled when device rate differs)
+	dev_rx_rate = gsm_dev_rate = backend->setRxRate(rx_rate);
+	tx_rate = backend->setTxRate(tx_rate);
+	rx_spp = 3*CHUNK_SIZE;
+	if (!rxResampler(GSMRATE * rx_sps)) return false;
+	gsm_rx_rate = rx_rate;
+	if (txAhead <= 0) txAhead = (int)(tx_rate * GSM_FRAME_TIME);
 
 	// set rx/tx bandwidth
-	if (devType == DeviceType::LIME_USB || devType == DeviceType::LIME_PCIE) {
-		for (int i = 0; i < chans; i++) {
-			uhd->usrp_dev->set_tx_bandwidth(5e6, i);
-			uhd->usrp_dev->set_rx_bandwidth(5e6, i);
-		}
-	}
-	else {
-		for (int i = 0; i < chans; i++) {
-			uhd->usrp_dev->set_tx_bandwidth(1e6, i);
-			uhd->usrp_dev->set_rx_bandwidth(1e6, i);
-		}
+	if (devType == DeviceType::LIME_USB || devType == DeviceType::LIME_PCIE) rx_bw = 5e6;
+	else rx_bw = 1e6;
+	for (int i = 0; i < chans; i++) {
+		backend->setBandwidth(rx_bw, i, true);
+		backend->setBandwidth(rx_bw, i, false);
 	}
 
 	// get rx/tx streams
-	uhd::stream_args_t stream_args;
-	if (devType == DeviceType::LIME_USB || devType == DeviceType::LIME_PCIE) {
-		stream_args = uhd::stream_args_t("sc12");
-		stream_args.args["latency"] = (devType == DeviceType::LIME_USB) ? "0.0" : "0.3";
-	}
-	else {
-		stream_args = uhd::stream_args_t("sc16");
+	if (!backend->openStreams()) {
+		LOGE("Can't open streams of %s", backend->name().cstr());
+		return false;
 	}
-	//stream_args = uhd::stream_args_t("sc16"); //TODO check one setting for all
-	for (int i = 0; i < chans; i++)
-		stream_args.channels.push_back(i);
-
-	uhd->rx_stream = uhd->usrp_dev->get_rx_stream(stream_args);
-	uhd->tx_stream = uhd->usrp_dev->get_tx_stream(stream_args);
 
-	//set timing offset
-	double offs = get_dev_offset(devType, rx_sps, tx_sps);
-	ts_offs = (jlong)(offs * rx_rate);
+	//set timing offset (no delay in virtual devices)
+	ts_offs = 0;
+	if (devType != DeviceType::IQFILE && devType != DeviceType::SYNTH) {
+		double offs = get_dev_offset(devType, rx_sps, tx_sps);
+		ts_offs = (jlong)(offs * rx_rate);
+	}
 
+	// preallocate all rx/tx buffers and staging
 	int buf_len = SAMPLE_BUF_SZ / sizeof(uint32_t);
+	int smpl_sz = 2*sizeof(short);
+	flush_spp = backend->maxPacket();
+	size_t staging = (size_t)((2*chans*rx_spp + flush_spp) * smpl_sz + (2*chans+1)*64);
+	if (!arena.create(2*chans, buf_len, staging, numaNode)) {
+		LOGE("Can't allocate sample buffers");
+		return false;
+	}
 	for (int i = 0; i < rx_buffer.length; ++i) {
-		rx_buffer[i] = std::move(SampleBuffer(buf_len, rx_rate));
+		rx_buffer[i] = std::move(SpscSampleBuffer(buf_len, rx_rate, arena));
+	}
+	for (int i = 0; i < tx_buffer.length; ++i) {
+		tx_buffer[i] = std::move(SampleBuffer(buf_len, tx_rate, arena));
+	}
+	rx_staging = Array<short *>(chans);
+	for (int i = 0; i < chans; ++i) {
+		rx_staging[i] = (short *)arena.staging((size_t)(rx_spp * smpl_sz));
 	}
+	rx_resampled = Array<short *>(chans);
+	for (int i = 0; i < chans; ++i) {
+		rx_resampled[i] = (short *)arena.staging((size_t)(rx_spp * smpl_sz));
+	}
+	flush_buf = (short *)arena.staging((size_t)(flush_spp * smpl_sz));
 
 	//set rx/tx gains
-	uhd::gain_range_t range = uhd->usrp_dev->get_rx_gain_range();
+	double gmin, gmax;
 	for (int i = 0; i < rx_gain.length; ++i) {
-		double gain = (range.start() + range.stop()) / 2;
-		uhd->usrp_dev->set_rx_gain(gain, i);
-		rx_gain[i] = uhd->usrp_dev->get_rx_gain(i);
+		backend->gainRange(i, false, gmin, gmax);
+		rx_gain[i] = backend->setGain((gmin + gmax) / 2, i, false);
 	}
-	range = uhd->usrp_dev->get_tx_gain_range();
 	for (int i = 0; i < tx_gain.length; ++i) {
-		double gain = (range.start() + range.stop()) / 2;
-		uhd->usrp_dev->set_tx_gain(gain, i);
-		tx_gain[i] = uhd->usrp_dev->get_tx_gain(i);
+		backend->gainRange(i, true, gmin, gmax);
+		tx_gain[i] = backend->setGain((gmin + gmax) / 2, i, true);
 	}
 
-	// print usrp configuration
-	//LOGN("USRP config:\n%s", uhd->usrp_dev->get_pp_string().c_str());
-
-	uhd::stream_cmd_t cmd = uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE;
-	cmd.num_samps = uhd->rx_stream->get_max_num_samps()*2;
-	cmd.stream_now = true;
-	uhd->usrp_dev->issue_stream_cmd(cmd);
-
 	//reset the tick counter offset to 0 to avoid getting
-	uhd->usrp_dev->set_time_now(0.0);
+	backend->setTime(0.0);
 
 	restart();
 	return true;
@@ -322,13 +526,13 @@ boolean RadioDevice::open(const String& args) {
 
 void RadioDevice::close() {
 	LOGD("RadioDevice::close");
-	if (uhd && uhd->usrp_dev) {
-		uhd::stream_cmd_t stream_cmd = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
-		uhd->usrp_dev->issue_stream_cmd(stream_cmd);
-
-		uhd->rx_stream.reset();
-		uhd->tx_stream.reset();
-		uhd->usrp_dev.reset();
+	txStop();
+	rxStop();
+	closeRecorder();
+	if (backend) {
+		backend->close();
+		delete backend;
+		backend = null;
 	}
 	else {
 		LOGW("RadioDevice - not running");
@@ -336,69 +540,235 @@ void RadioDevice::close() {
 }
 
 boolean RadioDevice::setAntenna(const String& rx, const String& tx) {
-	if (!uhd->usrp_dev) throw IllegalStateException("Device not opened");
-	uhd->usrp_dev->set_rx_antenna("TX/RX");  // possible: ["TX/RX", "RX2", "CAL"]
-	uhd->usrp_dev->set_tx_antenna("TX/RX");  // possible: ["TX/RX", "RX2", "CAL"]
+	if (!backend) throw IllegalStateException("Device not opened");
+	backend->setAntenna("TX/RX", 0, false);  // possible: ["TX/RX", "RX2", "CAL"]
+	backend->setAntenna("TX/RX", 0, true);   // possible: ["TX/RX", "RX2", "CAL"]
 	return true;
 }
-boolean RadioDevice::setFreq(double freq, int chan, bool tx) {
-	if (!uhd->usrp_dev) throw IllegalStateException("Device not opened");
-	LOGD("RadioDevice::setFreq(f=%.2lf,ch=%d,%s)", MHz(freq), chan, tx?"TX":"RX");
-	uhd::tune_request_t treq = uhd::tune_request_t(freq, master_clock_offset);
+// at - rx_buffer tick when the new frequency applies (0 - now)
+// timed tune is queued on the device and doesn't stop streaming
+// rx samples taken while the tune takes effect are marked unsettled in rx_buffer
+boolean RadioDevice::setFreq(double freq, int chan, bool tx, jlong at) {
+	if (!backend) throw IllegalStateException("Device not opened");
+	LOGD("RadioDevice::setFreq(f=%.2lf,ch=%d,%s,at=%ld)", MHz(freq), chan, tx?"TX":"RX", at);
+	Array<double>& lo = tx ? tx_lo : rx_lo;
+	jlong key = (llround(freq) << 8) | (chan << 1) | (tx ? 1 : 0);
+	TuneRequest treq = {freq, master_clock_offset, 0, 0, false};
+	boolean dspOnly = false;
+	auto it = tuneCache.find(key);
+	if (it != tuneCache.end()) {
+		// tuned before, use the same LO/NCO split
+		treq.rf = it->second.rf;
+		treq.dsp = it->second.dsp;
+		treq.manualDsp = true;
+		dspOnly = it->second.rf == lo[chan];
+	}
+	else if (lo[chan] > 0 && Math::abs(freq - lo[chan]) < rx_bw/2 - 100e3) {
+		// channel fits into analog passband at current LO, move only the NCO
+		treq.rf = lo[chan];
+		dspOnly = true;
+	}
+
+	jlong from = tx ? 0 : rx_buffer[chan].last();
+	TuneResult res = backend->tune(treq, chan, tx, at > 0 ? (double)at / rx_rate : 0);
+	tuneCache[key] = res;
+	lo[chan] = res.rf;
 	if (tx) {
-		uhd->usrp_dev->set_tx_freq(treq, chan);
 		tx_freq[chan] = freq;
+		return true;
+	}
+	rx_freq[chan] = freq;
+	if (recorder) recorder->tuned(chan, at > 0 ? at : from, freq);
+
+	jlong settle = dspOnly ? 0 : (jlong)(LO_SETTLE_TIME * rx_rate);
+	if (at > 0) {
+		// switch happens exactly at the tick
+		rx_buffer[chan].unsettled(at, at + settle);
 	}
 	else {
-		uhd->usrp_dev->set_rx_freq(treq, chan);
-		rx_freq[chan] = freq;
+		// samples up to now may be from either frequency
+		jlong now = (jlong)llround(backend->getTime() * rx_rate);
+		rx_buffer[chan].unsettled(from, now + settle);
+	}
+	return true;
+}
+// rx_buffer gets rate, stream at dev_rx_rate is resampled when they differ
+boolean RadioDevice::rxResampler(double rate) {
+	rx_resampler.clear();
+	rx_rate = dev_rx_rate;
+	if (Math::abs(dev_rx_rate - rate) < 1.0) return true;
+	int P, Q;
+	if (!Resampler::ratio(dev_rx_rate, rate, P, Q)) {
+		LOGE("Can't resample rx %.3lf MHz to %.3lf MHz", MHz(dev_rx_rate), MHz(rate));
+		return false;
 	}
+	for (int i = 0; i < chans; ++i) rx_resampler.emplace_back(new Resampler(P, Q));
+	// resampled packet must fit rx_resampled
+	rs_spp = (int)((jlong)(rx_spp - 2) * Q / P);
+	if (rs_spp > rx_spp) rs_spp = rx_spp;
+	rx_rate = rate;
+	LOGD("rx resampling %.3lf MHz -> %.3lf MHz (%d/%d, %d taps, %s)", MHz(dev_rx_rate), MHz(rx_rate),
+			P, Q, rx_resampler[0]->tapsPerPhase(), Resampler::kernel());
 	return true;
 }
+
+// change rx rate of opened device, rate=0 goes back to rate set by open()
+// clock - master clock to use with new rate (0 - keep current)
+boolean RadioDevice::setRxRate(double rate, double clock) {
+	if (!backend) throw IllegalStateException("Device not opened");
+	double devRate = rate;
+	if (rate <= 0) {
+		rate = gsm_rx_rate;
+		devRate = gsm_dev_rate;
+		clock = master_clock;
+	}
+	LOGD("RadioDevice::setRxRate(%.3lf MHz, clock %.3lf MHz)", MHz(rate), MHz(clock));
+	txStop();
+	rxStop();
+	closeRecorder();
+	backend->stopRx();
+
+	if (clock > 0 && Math::abs(backend->getMasterClock() - clock) > 1.0) {
+		if (Math::abs(backend->setMasterClock(clock) - clock) > 1.0) {
+			LOGE("Failed to set master clock rate %.2lf", MHz(clock));
+		}
+		// tx rate is derived from the master clock too
+		backend->setTxRate(tx_rate);
+		tuneCache.clear(); // NCO resolution changed
+	}
+	dev_rx_rate = backend->setRxRate(devRate);
+	rxResampler(rate);
+	double bw = dev_rx_rate > rx_bw ? dev_rx_rate : rx_bw;
+	for (int i = 0; i < chans; i++) backend->setBandwidth(bw, i, false);
+
+	for (int i = 0; i < rx_buffer.length; ++i) rx_buffer[i].reset(rx_rate);
+	restart();
+	return Math::abs(rx_rate - rate) < 1.0;
+}
+
+// switch rx_buffer between 1..4 samples per symbol, device rate and stream are kept,
+// rx_buffer is decimated in software from the rate set by open()
+// ticks stay time*rate, so tick t before the switch is t*sps/old_sps after it
+boolean RadioDevice::setRxSps(int sps) {
+	if (!backend) throw IllegalStateException("Device not opened");
+	if (sps < 1 || sps > 4) throw IllegalArgumentException(String::format("wrong sps %d", sps));
+	if (sps == rx_sps) return true;
+	double rate = GSMRATE * sps;
+	if (rate > gsm_dev_rate + 1.0) {
+		LOGE("rx sps %d above device rate %.3lf MHz", sps, MHz(gsm_dev_rate));
+		return false;
+	}
+	LOGD("RadioDevice::setRxSps(%d) %.3lf MHz", sps, MHz(rate));
+	if (Math::abs(dev_rx_rate - gsm_dev_rate) > 1.0) {
+		// wideband rate active, applied by setRxRate(0)
+		rx_sps = sps;
+		gsm_rx_rate = rate;
+		return true;
+	}
+	// txLoop derives tx time from rx_buffer and rx_rate (txNow), keep it off them too
+	boolean tx = txThread.joinable();
+	txStop();
+	rxStop();
+	closeRecorder();
+	double old = rx_rate;
+	boolean ok = rxResampler(rate);
+	if (ok) {
+		rx_sps = sps;
+		gsm_rx_rate = rx_rate;
+	}
+	else rxResampler(old);
+	for (int i = 0; i < rx_buffer.length; ++i) rx_buffer[i].reset(rx_rate);
+	rxStart();
+	if (tx) txStart();
+	return ok;
+}
+
 Array<String> RadioDevice::listClockSources() {
-	if (!uhd->usrp_dev) throw IllegalStateException("Device not opened");
-	std::vector<std::string> l = uhd->usrp_dev->get_clock_sources(0);
-	Array<String> a((int)l.size());
-	for (int i=0; a.length; ++i) a[i] = l[i];
-	return a;
+	if (!backend) throw IllegalStateException("Device not opened");
+	return backend->clockSources();
 }
 Array<String> RadioDevice::listTimeSources() {
-	if (!uhd->usrp_dev) throw IllegalStateException("Device not opened");
-	std::vector<std::string> l = uhd->usrp_dev->get_time_sources(0);
-	Array<String> a((int)l.size());
-	for (int i=0; a.length; ++i) a[i] = l[i];
-	return a;
+	if (!backend) throw IllegalStateException("Device not opened");
+	return backend->timeSources();
 }
 
 void RadioDevice::restart() {
-	if (!uhd->usrp_dev) throw IllegalStateException("Device not opened");
+	if (!backend) throw IllegalStateException("Device not opened");
 	double delay = 0.1;
-	uhd::time_spec_t current = uhd->usrp_dev->get_time_now();
-	uhd::stream_cmd_t cmd = uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS;
-	cmd.stream_now = false;
-	cmd.time_spec = uhd::time_spec_t(current.get_real_secs() + delay);
-	uhd->usrp_dev->issue_stream_cmd(cmd);
+	txStop();
+	rxStop();
+	backend->startRx(backend->getTime() + delay);
 	rx_flush(10);
+	rxStart();
+	txStart();
+}
+
+// must be called before restart() to take effect
+void RadioDevice::setRxThread(int priority, int cpu) {
+	rxPriority = priority;
+	rxCpu = cpu;
+}
+
+// must be called before restart() to take effect
+void RadioDevice::setTxThread(int priority, int cpu, int ahead) {
+	txPriority = priority;
+	txCpu = cpu;
+	txAhead = ahead;
+}
+
+void RadioDevice::rxStart() {
+	rxRunning = true;
+	rxThread = std::thread(&RadioDevice::rxLoop, this);
+}
+void RadioDevice::rxStop() {
+	if (!rxThread.joinable()) return ;
+	rxRunning = false;
+	rxThread.join();
+	LOGD("rx thread stopped: %s", rxStats.toString().cstr());
+}
+
+boolean RadioDevice::startRecording(const String& base, int blocks) {
+	if (!backend) throw IllegalStateException("Device not opened");
+	std::unique_ptr<IqRecorder> r(new IqRecorder(base, chans, rx_rate, blocks));
+	if (!r->open()) return false;
+	for (int i = 0; i < chans; ++i) r->tuned(i, rx_buffer[i].last(), rx_freq[i]);
+	boolean run = rxThread.joinable();
+	rxStop();
+	closeRecorder();
+	recorder = std::move(r);
+	if (run) rxStart();
+	return true;
+}
+void RadioDevice::stopRecording() {
+	boolean run = rxThread.joinable();
+	rxStop();
+	closeRecorder();
+	if (run) rxStart();
+}
+// rx thread must be stopped
+void RadioDevice::closeRecorder() {
+	if (!recorder) return ;
+	recorder->close();
+	LOGN("recording stopped: %s", recorder->toString().cstr());
+	recorder.reset();
 }
 
 void RadioDevice::rx_flush(int num_pkts) {
-	if (!uhd->usrp_dev) throw IllegalStateException("Device not opened");
-	uhd::rx_metadata_t md;
+	if (!backend) throw IllegalStateException("Device not opened");
+	RxMeta md;
 	double timeout = 0.5; //500ms
-	int rx_spp = (int)uhd->rx_stream->get_max_num_samps(); // samples per packet
-	short dummy[2*rx_spp];
 
 	std::vector<short *> pkt_ptrs;
 	for (int i = 0; i < chans; i++)
-		pkt_ptrs.push_back(dummy);
+		pkt_ptrs.push_back(flush_buf);
 
 	if (num_pkts <= 0) num_pkts=1;
 	while (num_pkts-- > 0) {
-		uhd->rx_stream->recv(pkt_ptrs, rx_spp, md, timeout, true);
-		if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
-			LOGE("recv error = %s(%d)", md.strerror().c_str(), md.error_code);
+		backend->recv(&pkt_ptrs[0], flush_spp, md, timeout);
+		if (md.error != RxError::NONE) {
+			LOGE("recv error %d", (int)md.error);
 		}
-		if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
+		if (md.error == RxError::TIMEOUT) {
 			LOGE("recv timeout");
 			break;
 		}
@@ -406,64 +776,229 @@ void RadioDevice::rx_flush(int num_pkts) {
 	LOGD("rx_flush done");
 }
 
-void RadioDevice::recv() {
-	if (!uhd->usrp_dev) throw IllegalStateException("Device not opened");
-	uhd::rx_metadata_t md;
-	//int rx_spp = (int)uhd->rx_stream->get_max_num_samps(); // samples per packet
-	int rx_spp = 3*CHUNK_SIZE;
-	short pkt_bufs[chans][2*rx_spp];
+// RX streaming thread: keeps the transport drained and feeds rx_buffer
+void RadioDevice::rxLoop() {
+	setThreadParams("rx", rxPriority, rxCpu);
+
+	RxMeta md;
+	// rx_staging is used only when rx_buffer can't take packet in place
+	std::vector<short *> pkt_ptrs(chans);
+
+	while (rxRunning.load(std::memory_order_relaxed)) {
+		// receive directly into rx_buffer at expected timestamp
+		jlong ts0 = rx_buffer[0].last();
+		int n = rx_spp;
+		boolean inplace = rx_resampler.empty(); // resampled stream goes through staging
+		for (int i = 0; inplace && i < chans; i++) {
+			int l = n;
+			pkt_ptrs[i] = rx_buffer[i].reserve(l, ts0);
+			if (l < n) n = l;
+			if (pkt_ptrs[i] == null) inplace = false;
+		}
+		if (!inplace) {
+			n = rx_resampler.empty() ? rx_spp : rs_spp;
+			for (int i = 0; i < chans; i++) pkt_ptrs[i] = rx_staging[i];
+		}
 
-	std::vector<short *> pkt_ptrs;
-	for (int i = 0; i < chans; i++)
-		pkt_ptrs.push_back(pkt_bufs[i]);
-
-	//feed rx_buffer
-	while (rx_buffer[0].space() >= rx_spp) {
-		int num_smpls = (int)uhd->rx_stream->recv(pkt_ptrs, rx_spp, md, 0.1, true);
-		if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
-			LOGE("recv error = %s(%d)", md.strerror().c_str(), md.error_code);
-			if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) break;
-			if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) ;
+		int num_smpls = backend->recv(&pkt_ptrs[0], n, md, 0.1);
+		if (md.error != RxError::NONE) {
+			if (md.error == RxError::TIMEOUT) ++rxStats.timeouts;
+			else if (md.error == RxError::OVERFLOW) ++rxStats.overflows;
+			else if (md.error == RxError::LATE) ++rxStats.late;
+			else ++rxStats.errors;
 			continue;
 		}
-		if (num_smpls == 0) throw IllegalStateException("No samples");
-		if (!md.has_time_spec) throw IllegalStateException("No timestamp");
+		if (num_smpls == 0 || !md.hasTime) {
+			++rxStats.errors;
+			continue;
+		}
+
+		++rxStats.packets;
+		if (!rx_resampler.empty()) {
+			// stream ticks map exactly to rx_buffer ticks (t*P/Q)
+			jlong ts = md.ts;
+			int m = 0;
+			for (int i = 0; i < chans; i++) {
+				m = rx_resampler[i]->process(rx_staging[i], num_smpls, ts, rx_resampled[i]);
+				if (m == 0) continue;
+				if (rx_buffer[i].write(rx_resampled[i], m, rx_resampler[i]->outTime()) < 0 && i == 0) ++rxStats.late;
+			}
+			if (recorder && m > 0) recorder->record(&rx_resampled[0], m, rx_resampler[0]->outTime());
+			continue;
+		}
+		jlong ts = md.ts;
+
+		if (inplace && ts == ts0) {
+			if (recorder) recorder->record(&pkt_ptrs[0], num_smpls, ts);
+			for (int i = 0; i < chans; i++) rx_buffer[i].commit(num_smpls);
+			continue;
+		}
+		// stream discontinuity or no space, place samples by their timestamp
+		for (int i = 0; i < chans; i++) {
+			if (inplace) memcpy(rx_staging[i], pkt_ptrs[i], num_smpls*2*sizeof(short));
+			if (rx_buffer[i].write(rx_staging[i], num_smpls, ts) < 0 && i == 0) ++rxStats.late;
+		}
+		if (recorder) recorder->record(&rx_staging[0], num_smpls, ts);
+	}
+}
+
+void RadioDevice::txStart() {
+	txBusy = 0;
+	txRunning = true;
+	txThread = std::thread(&RadioDevice::txLoop, this);
+}
+void RadioDevice::txStop() {
+	if (!txThread.joinable()) return ;
+	{
+		std::lock_guard<std::mutex> lk(txMutex);
+		txRunning = false;
+	}
+	txCond.notify_all();
+	txThread.join();
+	LOGD("tx thread stopped: %s", txStats.toString().cstr());
+}
 
-		++rx_pkt_cnt;
-		jlong ts = md.time_spec.to_ticks(rx_rate);
+// queue burst to be sent at ts (tx ticks), bufs[chans] are copied
+// false when ts is beyond the tx_buffer span from now or there is no space for it
+boolean RadioDevice::sendBurst(const short *const *bufs, int len, jlong ts) {
+	if (len <= 0) throw IllegalArgumentException(String::format("wrong length %d", len));
+	boolean wake;
+	{
+		std::lock_guard<std::mutex> lk(txMutex);
+		// writing further ahead would evict samples of bursts queued before
+		if (ts + len - txNow() > tx_buffer[0].getCapacity()) {
+			++txStats.rejected;
+			return false;
+		}
+		// never touch samples not sent yet (txLoop behind) or being sent by txLoop
+		for (int i = 0; i < tx_buffer.length; ++i) {
+			if (ts < txBusy || tx_buffer[i].space(ts) < len) {
+				++txStats.rejected;
+				return false;
+			}
+		}
+		for (int i = 0; i < tx_buffer.length; ++i) {
+			if (tx_buffer[i].write(bufs[i], len, ts) != len) return false;
+		}
+		wake = txQueue.empty() || ts < txQueue.top().ts;
+		txQueue.push({ts, len});
+	}
+	if (wake) txCond.notify_one();
+	return true;
+}
 
-		LOGD("recv samples %d t=%ld samples = %d", rx_pkt_cnt, ts, num_smpls);
+// current device time (tx ticks) estimated from the rx stream
+jlong RadioDevice::txNow() const {
+	jlong t = rx_buffer[0].last();
+	if (t == 0) return (jlong)llround(backend->getTime() * tx_rate);
+	return (jlong)((double)t * tx_rate / rx_rate);
+}
 
-		for (int i = 0; i < rx_buffer.length; ++i) {
-			rx_buffer[i].write(pkt_bufs[i], num_smpls, ts);
+void RadioDevice::txAsyncEvents() {
+	TxEvent ev;
+	while (backend->txEvent(ev)) {
+		switch (ev) {
+		case TxEvent::ACK:
+			break;
+		case TxEvent::UNDERFLOW:
+			++txStats.underruns;
+			break;
+		case TxEvent::TIME_ERROR:
+			++txStats.late;
+			break;
+		default:
+			++txStats.errors;
+			break;
 		}
-		readTimestamp += num_smpls;
 	}
 }
 
-void RadioDevice::send() {
-	uhd::tx_metadata_t md;
-	md.has_time_spec = true;
-	md.start_of_burst = false;
-	md.end_of_burst = false;
+// TX scheduler thread: sends queued bursts txAhead samples before their deadline
+void RadioDevice::txLoop() {
+	setThreadParams("tx", txPriority, txCpu);
 
-	int tx_spp = CHUNK_SIZE * tx_sps;
+	TxMeta md;
+	md.hasTime = true;
+	md.startOfBurst = true;
+	md.endOfBurst = false;
+	md.ts = 0;
 
-	short pkt_bufs[chans][2*tx_spp];
-	std::vector<short *> pkt_ptrs;
-	for (int i = 0; i < chans; i++)
-		pkt_ptrs.push_back(pkt_bufs[i]);
+	int tx_spp = CHUNK_SIZE * tx_sps;
+	std::vector<const short *> pkt_ptrs(chans);
+
+	std::unique_lock<std::mutex> lk(txMutex);
+	// close the burst in progress, next send starts a new one at its timestamp
+	auto closeBurst = [&]() {
+		if (md.startOfBurst) return ;
+		md.endOfBurst = true;
+		md.hasTime = false;
+		lk.unlock();
+		backend->send(&pkt_ptrs[0], 0, md);
+		lk.lock();
+		md.hasTime = true;
+		md.startOfBurst = true;
+	};
+	while (txRunning) {
+		if (txQueue.empty()) {
+			lk.unlock();
+			txAsyncEvents();
+			lk.lock();
+			if (txQueue.empty()) txCond.wait_for(lk, std::chrono::milliseconds(10));
+			continue;
+		}
 
-	//release tx_buffer
-	while (tx_buffer[0].available(writeTimestamp) >= tx_spp) {
-		int len = tx_spp;
-		for (int i = 0; i < tx_buffer.length; ++i) {
-			tx_buffer[i].read(pkt_bufs[i], len, writeTimestamp);
+		TxBurst b = txQueue.top();
+		jlong now = txNow();
+		jlong wait = b.ts - txAhead - now;
+		if (wait > 0) {
+			double tm = std::min((double)wait / tx_rate, 10e-3);
+			txCond.wait_for(lk, std::chrono::microseconds((long)(tm * 1e6)));
+			continue;
+		}
+		txQueue.pop();
+		if (b.ts <= now) {
+			++txStats.late;
+			closeBurst();
+			continue;
 		}
 
-		md.time_spec = uhd::time_spec_t::from_ticks(writeTimestamp, tx_rate);
-		int num_smpls = (int)uhd->tx_stream->send(pkt_ptrs, len, md);
+		jlong ts = b.ts;
+		for (int rem = b.len; rem > 0; ) {
+			// send directly from tx_buffer
+			int len = std::min(rem, tx_spp);
+			for (int i = 0; i < tx_buffer.length; ++i) {
+				int n = len;
+				pkt_ptrs[i] = tx_buffer[i].peek(ts, n);
+				if (n < len) len = n;
+			}
+			if (len <= 0) {
+				++txStats.errors;
+				closeBurst();
+				break;
+			}
+			rem -= len;
+			// keep the burst open only when next one continues it
+			md.endOfBurst = rem == 0 && (txQueue.empty() || txQueue.top().ts != ts + len);
+			md.ts = ts;
+
+			// pkt_ptrs point into tx_buffer, sendBurst keeps off them until consumed
+			txBusy = ts + len;
+			lk.unlock();
+			int num_smpls = backend->send(&pkt_ptrs[0], len, md);
+			lk.lock();
+
+			for (int i = 0; i < tx_buffer.length; ++i) {
+				tx_buffer[i].consume(len);
+			}
+			if (num_smpls != len) ++txStats.errors;
+			++tx_pkt_cnt;
+			ts += len;
+			md.startOfBurst = md.endOfBurst;
+		}
+		++txStats.bursts;
 
-		writeTimestamp += num_smpls;
+		lk.unlock();
+		txAsyncEvents();
+		lk.lock();
 	}
 }
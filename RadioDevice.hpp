@@ -4,35 +4,40 @@
 #include <lang/String.hpp>
 #include <lang/System.hpp>
 
+#include "RadioBackend.hpp"
+#include "IqRecorder.hpp"
+#include "RingMemory.hpp"
+#include "Resampler.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
 #define DEFAULT_RX_SPS      1
 #define DEFAULT_TX_SPS      4
 
 #define MHz(f) ((f)/1e6)
 
-enum class DeviceType {
-	Undef,
-	USRP1,
-	USRP2,
-	B100,
-	B2xx,
-	E1xx,
-	E3xx,
-	X3xx,
-	UMTRX,
-	LIME_USB,
-	LIME_PCIE,
-};
-
 class SampleBuffer : extends Object {
 private:
 	short *buf; // 1sample = 2*short
 	int capacity;
+	boolean mirrored; // any window up to capacity is contiguous
+	boolean owned;    // memory not from arena
 	int idx,len;
 	double rate; //ticks/s - allows to convert between time in ticks and real time(in s)
 	jlong tm0;   //timestamp of sample first sample in buffer (counted in ticks, 1sample=1tick)
+	jlong tmResv = 0, tmPeek = 0; // positions of pending reserve/peek
 	void move(SampleBuffer& o) {
 		buf = o.buf; o.buf=null;
 		capacity = o.capacity; o.capacity = 0;
+		mirrored = o.mirrored;
+		owned = o.owned;
 		idx = o.idx;
 		len = o.len;
 		rate = o.rate;
@@ -40,66 +45,250 @@ private:
 	}
 public:
 	SampleBuffer& operator=(SampleBuffer&& o) {
+		if (owned) ringFree(buf, capacity, mirrored);
 		move(o);
 		return *this;
 	}
-	SampleBuffer() : capacity(0) {}
-	SampleBuffer(int capacity, double rate) : capacity(capacity), idx(0), len(0), rate(rate) {
-		buf = new short[2*capacity]; // 1sample = 2short
+	SampleBuffer() : buf(null), capacity(0), mirrored(false), owned(false) {}
+	SampleBuffer(int capacity, double rate, boolean mirror=true) : capacity(capacity), mirrored(mirror), owned(true), idx(0), len(0), rate(rate) {
+		buf = ringAlloc(this->capacity, mirrored);
 		tm0 = 0; // or LONG_MIN
 	}
+	SampleBuffer(int capacity, double rate, SampleArena& arena) : capacity(capacity), owned(false), idx(0), len(0), rate(rate) {
+		buf = arena.ring(this->capacity, mirrored);
+		tm0 = 0;
+	}
 	virtual ~SampleBuffer() {
-		delete[] buf;
+		if (owned) ringFree(buf, capacity, mirrored);
 	}
 
 	String toString() const {
-		return String::format("cap=%d,idx=%d,len=%d,tm0=%ld",capacity,idx,len,tm0);
+		return String::format("cap=%d,idx=%d,len=%d,tm0=%ld%s",capacity,idx,len,tm0,mirrored?",mirrored":"");
 	}
 
+	int getCapacity() const { return capacity; }
 	int available(jlong t) const;
 	int space() const;
-	int write(short *b, int l, jlong t);
+	int space(jlong t) const; // samples writable at t without dropping unread ones (-1 past)
+	int write(const short *b, int l, jlong t);
+	int read(short *b, int l, jlong t);
+
+	// zero-copy access, pointers stay valid until next reserve/write
+	short *reserve(int& n, jlong t);
+	void commit(int n);
+	const short *peek(jlong t, int& n);
+	void consume(int n);
+};
+
+// Lock-free single-producer/single-consumer variant of SampleBuffer.
+// Producer (write, space) and consumer (available, read) may run on separate threads.
+// Positions are absolute timestamps in ticks, ring index = tick & (capacity-1).
+class SpscSampleBuffer : extends Object {
+private:
+	short *buf; // 1sample = 2*short
+	int capacity; // power of 2
+	boolean mirrored; // any window up to capacity is contiguous
+	boolean owned;    // memory not from arena
+	double rate;
+	std::atomic<jlong> tmHead;  // (producer) timestamp after last written sample
+	std::atomic<jlong> tmTail;  // (consumer) timestamp of first unread sample
+	std::atomic<jlong> tmBase;  // (producer) timestamp of first valid sample, moves when stream is resynced
+	std::atomic<jlong> dropped; // samples lost on overflow
+	// (any) samples taken while LO settles, ring of recent windows
+	static const int SETTLE_WINDOWS = 8;
+	mutable std::mutex unsetLock;
+	jlong unsetFrom[SETTLE_WINDOWS] = {0}, unsetTo[SETTLE_WINDOWS] = {0};
+	int unsetNext = 0;
+	jlong tmResv = 0; // (producer) position of pending reserve
+	boolean resync = false;
+	jlong tmPeek = 0; // (consumer) position of pending peek
+	void move(SpscSampleBuffer& o) {
+		buf = o.buf; o.buf=null;
+		capacity = o.capacity; o.capacity = 0;
+		mirrored = o.mirrored;
+		owned = o.owned;
+		rate = o.rate;
+		tmHead.store(o.tmHead.load());
+		tmTail.store(o.tmTail.load());
+		tmBase.store(o.tmBase.load());
+		dropped.store(o.dropped.load());
+		for (int i = 0; i < SETTLE_WINDOWS; ++i) { unsetFrom[i] = o.unsetFrom[i]; unsetTo[i] = o.unsetTo[i]; }
+		unsetNext = o.unsetNext;
+	}
+	jlong first(jlong tail) const { jlong b = tmBase.load(std::memory_order_relaxed); return tail < b ? b : tail; }
+public:
+	// not thread safe, use only when producer and consumer are stopped
+	SpscSampleBuffer& operator=(SpscSampleBuffer&& o) {
+		if (owned) ringFree(buf, capacity, mirrored);
+		move(o);
+		return *this;
+	}
+	SpscSampleBuffer() : buf(null), capacity(0), mirrored(false), owned(false), rate(0), tmHead(0), tmTail(0), tmBase(0), dropped(0) {}
+	SpscSampleBuffer(int capacity, double rate, boolean mirror=true);
+	SpscSampleBuffer(int capacity, double rate, SampleArena& arena); // capacity must be power of 2
+	virtual ~SpscSampleBuffer() {
+		if (owned) ringFree(buf, capacity, mirrored);
+	}
+
+	String toString() const {
+		return String::format("cap=%d,first=%ld,last=%ld,dropped=%ld%s",capacity,first(),last(),overflows(),mirrored?",mirrored":"");
+	}
+
+	double getRate() const { return rate; }
+	boolean isMirrored() const { return mirrored; }
+	jlong first() const { return first(tmTail.load(std::memory_order_acquire)); } // oldest readable sample
+	jlong last() const { return tmHead.load(std::memory_order_acquire); }         // after newest sample
+	jlong overflows() const { return dropped.load(std::memory_order_relaxed); }
+	// drop all samples and change rate, use only when producer and consumer are stopped
+	void reset(double rate);
+
+	// samples in [from,to) are not usable, e.g. LO settling after retune (any thread)
+	// last SETTLE_WINDOWS windows are kept, enough for tunes queued some frames ahead
+	void unsettled(jlong from, jlong to);
+	// false if [t,t+n) overlaps unsettled samples
+	boolean isSettled(jlong t, int n) const;
+	// first tick at or after t which is settled
+	jlong settled(jlong t) const;
+
+	// consumer side
+	int available(jlong t) const;
 	int read(short *b, int l, jlong t);
+	const short *peek(jlong t, int& n); // zero-copy read
+	void consume(int n);
+	void release(jlong t); // release samples before t without peek
+	// producer side
+	int space() const;
+	int write(const short *b, int l, jlong t);
+	short *reserve(int& n, jlong t); // zero-copy write
+	void commit(int n);
+};
+
+// counters kept by the RX streaming thread
+struct RxStats {
+	std::atomic<long> packets{0};
+	std::atomic<long> overflows{0}; // device/transport overflows
+	std::atomic<long> timeouts{0};
+	std::atomic<long> late{0};      // late commands and packets older than rx_buffer head
+	std::atomic<long> errors{0};    // other recv errors
+	String toString() const {
+		return String::format("pkts=%ld,ovf=%ld,tmo=%ld,late=%ld,err=%ld",
+				packets.load(),overflows.load(),timeouts.load(),late.load(),errors.load());
+	}
+};
+
+// counters kept by the TX scheduler thread
+struct TxStats {
+	std::atomic<long> bursts{0};
+	std::atomic<long> late{0};      // dropped before send or reported by device (time error)
+	std::atomic<long> underruns{0};
+	std::atomic<long> errors{0};    // sequence errors, short sends
+	std::atomic<long> rejected{0};  // not queued, too far ahead or no space
+	String toString() const {
+		return String::format("bursts=%ld,late=%ld,udr=%ld,err=%ld,rej=%ld",
+				bursts.load(),late.load(),underruns.load(),errors.load(),rejected.load());
+	}
 };
 
-class UHDdata;
 class RadioDevice : extends Object {
 private:
-	UHDdata *uhd = null;
+	RadioBackend *backend = null;
 
 	DeviceType devType = DeviceType::Undef;
 	int chans = 0; // number of channels
 	int rx_sps = 0, tx_sps = 0; //samplaes per symbol(1..4)
-	double rx_rate = 0, tx_rate = 0;
+	double rx_rate = 0, tx_rate = 0; // rx_rate is rx_buffer rate
+	double dev_rx_rate = 0;   // rx stream rate, differs from rx_rate when resampling
 	double master_clock_offset = 0;
-	long rx_pkt_cnt = 0, tx_pkt_cnt = 0;
-	jlong readTimestamp;
-	jlong writeTimestamp;
+	double master_clock = 0;  // set by open() (0 - device default)
+	double gsm_rx_rate = 0;   // rx rate set by open()
+	double gsm_dev_rate = 0;  // rx stream rate set by open()
+	double rx_bw = 0;         // rx bandwidth set by open()
+	long tx_pkt_cnt = 0;
 	jlong ts_offs = 0;
 
 	Array<double> rx_gain, tx_gain; //[chans]
 	Array<double> rx_freq, tx_freq; //[chans]
-	Array<SampleBuffer> rx_buffer;
+	Array<double> rx_lo, tx_lo;     //[chans] RF LO frequency (0 - not tuned)
+	std::map<jlong,TuneResult> tuneCache; // key: frequency (Hz), chan, direction
+	SampleArena arena; // memory for rx/tx buffers and staging
+	int numaNode = -1;
+	Array<SpscSampleBuffer> rx_buffer;
 	Array<SampleBuffer> tx_buffer;
+	int rx_spp = 0, flush_spp = 0; // samples per packet
+	Array<short *> rx_staging; //[chans]
+	std::vector<std::unique_ptr<Resampler>> rx_resampler; //[chans], empty if stream runs at rx_rate
+	Array<short *> rx_resampled; //[chans] resampler output
+	int rs_spp = 0; // stream samples per packet when resampling
+	short *flush_buf = null;
+	std::unique_ptr<IqRecorder> recorder; // taps rx_buffer input (rx thread)
+
+	std::thread rxThread;
+	std::atomic<boolean> rxRunning{false};
+	int rxPriority = 0; // SCHED_FIFO priority (0 - default scheduling)
+	int rxCpu = -1;     // cpu core to pin rx thread to (-1 - any)
+	RxStats rxStats;
+
+	struct TxBurst {
+		jlong ts; // timestamp of first sample (tx ticks)
+		int len;
+		boolean operator>(const TxBurst& o) const { return ts > o.ts; }
+	};
+	std::priority_queue<TxBurst, std::vector<TxBurst>, std::greater<TxBurst>> txQueue; // ordered by deadline
+	std::mutex txMutex; // guards txQueue and tx_buffer
+	std::condition_variable txCond;
+	std::thread txThread;
+	std::atomic<boolean> txRunning{false};
+	int txPriority = 0;
+	int txCpu = -1;
+	int txAhead = 0; // send bursts this number of samples before their timestamp (0 - one TDMA frame)
+	TxStats txStats;
+	jlong txBusy = 0; // tx_buffer samples before it are sent, or being sent without txMutex
+
+	void rxStart();
+	void rxStop();
+	void rxLoop();
+	boolean rxResampler(double rate);
+	void closeRecorder();
+	void txStart();
+	void txStop();
+	void txLoop();
+	jlong txNow() const;
+	void txAsyncEvents();
 
 public:
 	RadioDevice(int rx_sps=DEFAULT_RX_SPS, int tx_sps=DEFAULT_TX_SPS);
 	~RadioDevice();
 	String toString() const;
 
+	// args: UHD device args, "file=<path>,..." or "synth,..." (see RadioBackend)
 	boolean open(const String& args);
 	void close();
 	void restart(); //start receiving
+	void setNumaNode(int node) { numaNode = node; } // must be called before open()
+	void setRxThread(int priority, int cpu);
+	void setTxThread(int priority, int cpu, int ahead);
 
 	boolean setAntenna(const String& rx, const String& tx);
-	boolean setFreq(double freq, int chan, bool tx);
+	boolean setFreq(double freq, int chan, bool tx, jlong at=0);
+	double getFreq(int chan, bool tx) const { return tx ? tx_freq[chan] : rx_freq[chan]; }
+	boolean setRxRate(double rate, double clock=0);
+	boolean setRxSps(int sps);
+	double getRxRate() const { return rx_rate; }
+	int getRxSps() const { return rx_sps; }
 
 	Array<String> listClockSources();
 	Array<String> listTimeSources();
 
+	SpscSampleBuffer& getRxBuffer(int chan) { return rx_buffer[chan]; }
+	const RxStats& getRxStats() const { return rxStats; }
+	const TxStats& getTxStats() const { return txStats; }
+
 	void rx_flush(int pkts);
-	void recv();
-	void send();
+	// record rx samples of all channels to <base>.ch<N>.iq (see IqRecorder),
+	// stopped by rate changes
+	boolean startRecording(const String& base, int blocks=16);
+	void stopRecording();
+	boolean sendBurst(const short *const *bufs, int len, jlong ts);
 };
 
 
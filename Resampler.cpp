@@ -0,0 +1,216 @@
+#include <lang/System.hpp>
+
+#include "Resampler.hpp"
+#include "SampleConvert.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_NEON
+#endif
+
+namespace {
+const int BLOCK = 4096;     // input samples converted per step
+const int MAX_FACTOR = 1024; // largest P or Q accepted by ratio()
+
+// complex x times real taps (duplicated for I and Q), n floats (multiple of 8)
+typedef void (*DotIQ)(const float *x, const float *h, int n, float *out);
+
+void dotScalar(const float *x, const float *h, int n, float *out) {
+	float re = 0, im = 0;
+	for (int i = 0; i < n; i += 2) {
+		re += x[i]*h[i];
+		im += x[i+1]*h[i+1];
+	}
+	out[0] = re; out[1] = im;
+}
+boolean supportedScalar() { return true; }
+
+#ifdef RESAMPLER_X86
+__attribute__((target("sse2")))
+void dotSSE2(const float *x, const float *h, int n, float *out) {
+	__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+	for (int i = 0; i < n; i += 8) {
+		a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+	}
+	float r[4];
+	_mm_storeu_ps(r, _mm_add_ps(a0, a1));
+	out[0] = r[0] + r[2]; out[1] = r[1] + r[3];
+}
+boolean supportedSSE2() { return __builtin_cpu_supports("sse2"); }
+
+__attribute__((target("avx2")))
+void dotAVX2(const float *x, const float *h, int n, float *out) {
+	__m256 a = _mm256_setzero_ps();
+	for (int i = 0; i < n; i += 8) {
+		a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i)));
+	}
+	float r[8];
+	_mm256_storeu_ps(r, a);
+	out[0] = r[0] + r[2] + r[4] + r[6]; out[1] = r[1] + r[3] + r[5] + r[7];
+}
+boolean supportedAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+#ifdef RESAMPLER_NEON
+void dotNEON(const float *x, const float *h, int n, float *out) {
+	float32x4_t a0 = vdupq_n_f32(0), a1 = vdupq_n_f32(0);
+	for (int i = 0; i < n; i += 8) {
+		a0 = vmlaq_f32(a0, vld1q_f32(x + i), vld1q_f32(h + i));
+		a1 = vmlaq_f32(a1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+	}
+	float r[4];
+	vst1q_f32(r, vaddq_f32(a0, a1));
+	out[0] = r[0] + r[2]; out[1] = r[1] + r[3];
+}
+boolean supportedNEON() { return true; }
+#endif
+
+const struct {
+	const char *name;
+	DotIQ dot;
+	boolean (*supported)();
+} kernels[] = {
+	{"scalar", dotScalar, supportedScalar},
+#ifdef RESAMPLER_X86
+	{"sse2", dotSSE2, supportedSSE2},
+	{"avx2", dotAVX2, supportedAVX2},
+#endif
+#ifdef RESAMPLER_NEON
+	{"neon", dotNEON, supportedNEON},
+#endif
+};
+
+int selectKernel() {
+	int best = 0;
+	for (int i = 1; i < (int)(sizeof(kernels)/sizeof(kernels[0])); ++i) {
+		if (kernels[i].supported()) best = i;
+	}
+	return best;
+}
+const int kernelIdx = selectKernel();
+
+jlong floorDiv(jlong a, jlong b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+jlong gcd(jlong a, jlong b) { while (b) { jlong t = a % b; a = b; b = t; } return a; }
+}
+
+Resampler::Resampler(int P, int Q, int taps) : P(P), Q(Q) {
+	if (P < 1 || Q < 1 || P > MAX_FACTOR || Q > MAX_FACTOR)
+		throw IllegalArgumentException(String::format("Resampler ratio %d/%d", P, Q));
+	jlong g = gcd(P, Q);
+	this->P = P = (int)(P / g);
+	this->Q = Q = (int)(Q / g);
+	// wider filter when decimating, transition band scales with taps per phase
+	if (taps <= 0) taps = 4 * (int)ceil(4.0 * (Q > P ? (double)Q / P : 1.0));
+	T = (taps + 3) & ~3;
+
+	// windowed sinc (Blackman) at upsampled rate, odd length so delay is integer
+	int L = P*T;
+	if (L % 2 == 0) --L;
+	D = (L - 1) / 2;
+	double fc = 0.5 * (Q > P ? (double)P / Q : 1.0) / P; // cycles per upsampled sample
+	Array<double> proto(P*T);
+	double sum = 0;
+	for (int i = 0; i < P*T; ++i) {
+		proto[i] = 0;
+		if (i >= L) continue;
+		double x = 2 * fc * (double)(i - D);
+		double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+		double w = L == 1 ? 1.0 : 0.42 - 0.5 * cos(2 * M_PI * i / (L - 1)) + 0.08 * cos(4 * M_PI * i / (L - 1));
+		proto[i] = sinc * w;
+		sum += proto[i];
+	}
+	// each phase has unity gain: y = sum_r h[ph + rP] x[imax - r], stored reversed
+	this->taps = Array<float>(2*P*T);
+	for (int ph = 0; ph < P; ++ph) {
+		for (int s = 0; s < T; ++s) {
+			float v = (float)(proto[ph + (T - 1 - s)*P] * P / sum);
+			this->taps[2*(ph*T + s)] = v;
+			this->taps[2*(ph*T + s) + 1] = v;
+		}
+	}
+	hist = Array<float>(2*(T - 1 + BLOCK));
+	work = Array<float>(2*maxOutput(BLOCK));
+	reset();
+}
+
+boolean Resampler::ratio(double inRate, double outRate, int& P, int& Q) {
+	// GSM and device rates are multiples of 1/6 Hz (1625000/6 symbol rate)
+	jlong a = (jlong)llround(outRate * 6), b = (jlong)llround(inRate * 6);
+	if (a <= 0 || b <= 0 || fabs((double)a - outRate * 6) > 1e-3 || fabs((double)b - inRate * 6) > 1e-3) return false;
+	jlong g = gcd(a, b);
+	if (a / g > MAX_FACTOR || b / g > MAX_FACTOR) return false;
+	P = (int)(a / g);
+	Q = (int)(b / g);
+	return true;
+}
+
+const char *Resampler::kernel() { return kernels[kernelIdx].name; }
+
+jlong Resampler::toOutput(jlong inTick) const {
+	return floorDiv(inTick * P + Q - 1, Q);
+}
+
+void Resampler::reset() {
+	histLen = 0;
+	histTick = 0;
+	inNext = -1;
+	outTick = outFirst = 0;
+}
+
+// history before ts is taken as zeros, first output is the first output tick at or after ts
+void Resampler::restart(jlong ts) {
+	histLen = T - 1;
+	histTick = ts - histLen;
+	for (int i = 0; i < 2*histLen; ++i) hist[i] = 0;
+	outTick = toOutput(ts);
+	inNext = ts;
+}
+
+int Resampler::process(const short *in, int n, jlong ts, short *out) {
+	if (n < 0) throw IllegalArgumentException(String::format("wrong length %d", n));
+	if (ts != inNext) restart(ts);
+	outFirst = outTick;
+	DotIQ dot = kernels[kernelIdx].dot;
+	int total = 0;
+	while (n > 0) {
+		int l = n < BLOCK ? n : BLOCK;
+		toFloat(&hist[2*histLen], in, 1.0f, 2*l);
+		histLen += l;
+		in += 2*l; n -= l;
+		inNext += l;
+
+		// outputs whose newest input tick is already in hist
+		jlong end = histTick + histLen;
+		jlong u = outTick * Q + D;
+		int m = 0;
+		for (;;) {
+			jlong i = u / P;
+			if (i >= end) break;
+			int ph = (int)(u - i*P);
+			dot(&hist[2*(int)(i - T + 1 - histTick)], &taps[2*ph*T], 2*T, &work[2*m]);
+			++m;
+			u += Q;
+		}
+		outTick += m;
+		toShort(out + 2*total, &work[0], 1.0f, 2*m);
+		total += m;
+
+		// keep only what the next output needs
+		int drop = (int)(u / P - (T - 1) - histTick);
+		if (drop > histLen) drop = histLen;
+		if (drop > 0) {
+			histLen -= drop;
+			histTick += drop;
+			memmove(&hist[0], &hist[2*drop], (size_t)(2*histLen)*sizeof(float));
+		}
+	}
+	return total;
+}
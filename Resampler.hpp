@@ -0,0 +1,47 @@
+#ifndef RESAMPLER_HPP
+#define RESAMPLER_HPP
+
+#include <lang/String.hpp>
+
+// Streaming rational polyphase resampler for sc16 I/Q, output rate = input rate * P/Q.
+// Timestamps are exact: output tick k is the input signal at input tick k*Q/P
+// (filter delay is compensated), so input tick t maps to output tick t*P/Q.
+class Resampler : extends Object {
+private:
+	int P, Q;          // interpolation/decimation factors (reduced)
+	int T;             // taps per phase (multiple of 4)
+	jlong D;           // filter delay in upsampled samples
+	Array<float> taps; // per phase, reversed, each tap twice (I and Q): [P][2T]
+	Array<float> hist; // float input, T-1 history + block
+	int histLen;       // complex samples in hist
+	jlong histTick;    // input tick of hist[0]
+	jlong inNext;      // expected input tick of next call (-1 after reset)
+	jlong outTick;     // tick of next output sample
+	jlong outFirst;    // tick of first sample returned by last process()
+	Array<float> work; // float output before conversion
+
+	void restart(jlong ts);
+public:
+	// taps per phase 0 - chosen from the ratio
+	Resampler(int P, int Q, int taps=0);
+
+	// reduced P/Q for out/in rates, false if the ratio isn't a small fraction
+	static boolean ratio(double inRate, double outRate, int& P, int& Q);
+	static const char *kernel();
+
+	int interpolation() const { return P; }
+	int decimation() const { return Q; }
+	int tapsPerPhase() const { return T; }
+	// upper bound of outputs for n inputs
+	int maxOutput(int n) const { return (int)((jlong)n * P / Q) + 2; }
+	jlong toOutput(jlong inTick) const;
+
+	void reset();
+	// in: n samples starting at input tick ts, a gap in ticks restarts the stream
+	// out: at least maxOutput(n) samples, returns number of output samples
+	int process(const short *in, int n, jlong ts, short *out);
+	// output tick of out[0] written by last process()
+	jlong outTime() const { return outFirst; }
+};
+
+#endif
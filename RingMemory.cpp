@@ -0,0 +1,235 @@
+#include <lang/System.hpp>
+
+#include "RingMemory.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+const int SAMPLE_SIZE = 2*sizeof(short);
+
+int memfd(const char *name) {
+#ifdef SYS_memfd_create
+	return (int)syscall(SYS_memfd_create, name, 1U); // MFD_CLOEXEC
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void *mirrorMap(size_t bytes) {
+	int fd = memfd("samples");
+	if (fd < 0) return null;
+	if (ftruncate(fd, (off_t)bytes) != 0) {
+		::close(fd);
+		return null;
+	}
+	// reserve address range for both copies, then map the file over it twice
+	uint8_t *addr = (uint8_t *)mmap(null, 2*bytes, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		::close(fd);
+		return null;
+	}
+	void *a1 = mmap(addr, bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0);
+	void *a2 = mmap(addr + bytes, bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0);
+	::close(fd);
+	if (a1 != addr || a2 != addr + bytes) {
+		munmap(addr, 2*bytes);
+		return null;
+	}
+	return addr;
+}
+}
+
+short *ringAlloc(int& capacity, boolean& mirrored) {
+	if (mirrored) {
+		int page = (int)sysconf(_SC_PAGESIZE) / SAMPLE_SIZE; // samples per page
+		int c = (capacity + page - 1) / page * page;
+		void *p = mirrorMap((size_t)c * SAMPLE_SIZE);
+		if (p != null) {
+			capacity = c;
+			return (short *)p;
+		}
+		LOGW("mirrored ring not available (%s), using heap", strerror(errno));
+		mirrored = false;
+	}
+	return new short[2*capacity]; // 1sample = 2short
+}
+
+void ringFree(short *buf, int capacity, boolean mirrored) {
+	if (buf == null) return ;
+	if (mirrored) munmap(buf, 2 * (size_t)capacity * SAMPLE_SIZE);
+	else delete[] buf;
+}
+
+namespace {
+const size_t DEFAULT_HUGE_PAGE = 2 << 20;
+const int MPOL_BIND_ = 2;
+const unsigned MFD_CLOEXEC_ = 1U;
+const unsigned MFD_HUGETLB_ = 4U;
+
+size_t hugePageSize() {
+	size_t sz = 0;
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f != null) {
+		char line[128];
+		unsigned long kb;
+		while (fgets(line, sizeof(line), f)) {
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) { sz = kb << 10; break; }
+		}
+		fclose(f);
+	}
+	return sz ? sz : DEFAULT_HUGE_PAGE;
+}
+size_t alignUp(size_t x, size_t a) { return (x + a - 1) / a * a; }
+}
+
+// ring memory file: each ring is mapped twice back-to-back
+boolean SampleArena::mapRings(size_t pg, boolean hugetlb) {
+	size_t ringBytes = alignUp((size_t)ringCapacity * SAMPLE_SIZE, pg);
+#ifdef SYS_memfd_create
+	fd = (int)syscall(SYS_memfd_create, "samples", MFD_CLOEXEC_ | (hugetlb ? MFD_HUGETLB_ : 0));
+#else
+	fd = -1;
+#endif
+	if (fd < 0) return false;
+	if (ftruncate(fd, (off_t)(ringBytes * ringCount)) != 0) {
+		::close(fd); fd = -1;
+		return false;
+	}
+	ringsSize = 2 * ringBytes * ringCount;
+	// MAP_FIXED over the reservation needs pg aligned addresses (EINVAL for hugetlb
+	// otherwise), reserve one page more and trim to the aligned part
+	uint8_t *r = (uint8_t *)mmap(null, ringsSize + pg, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED) {
+		::close(fd); fd = -1;
+		return false;
+	}
+	rings = (uint8_t *)alignUp((size_t)r, pg);
+	size_t slack = (size_t)(rings - r);
+	if (slack > 0) munmap(r, slack);
+	munmap(rings + ringsSize, pg - slack);
+	for (int i = 0; i < ringCount; ++i) {
+		uint8_t *a = rings + 2 * ringBytes * i;
+		off_t offs = (off_t)(ringBytes * i);
+		void *a1 = mmap(a, ringBytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, offs);
+		void *a2 = mmap(a + ringBytes, ringBytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, offs);
+		if (a1 != a || a2 != a + ringBytes) {
+			munmap(rings, ringsSize); rings = null;
+			::close(fd); fd = -1;
+			return false;
+		}
+	}
+	ringCapacity = (int)(ringBytes / SAMPLE_SIZE);
+	return true;
+}
+
+uint8_t *SampleArena::mapStage(size_t size, boolean hugetlb) {
+	int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+	if (hugetlb) flags |= MAP_HUGETLB;
+	void *p = mmap(null, size, PROT_READ|PROT_WRITE, flags, -1, 0);
+	return p == MAP_FAILED ? null : (uint8_t *)p;
+}
+
+// bind to numa node, lock and fault in pages
+void SampleArena::prepare(uint8_t *addr, size_t size, int numaNode) {
+	if (numaNode >= 0) {
+#ifdef SYS_mbind
+		unsigned long mask = 1UL << numaNode;
+		if (syscall(SYS_mbind, addr, size, MPOL_BIND_, &mask, sizeof(mask)*8 + 1, 0) != 0)
+			LOGW("arena: can't bind to numa node %d: %s", numaNode, strerror(errno));
+#endif
+	}
+	if (mlock(addr, size) != 0) {
+		LOGW("arena: mlock failed: %s", strerror(errno));
+		locked = false;
+	}
+	memset(addr, 0, size);
+}
+
+boolean SampleArena::create(int rings, int capacity, size_t staging, int numaNode) {
+	release();
+	ringCount = rings;
+	ringCapacity = capacity;
+	size_t hp = hugePageSize();
+	size_t pg = (size_t)sysconf(_SC_PAGESIZE);
+
+	huge = true;
+	locked = true;
+	if (ringCount > 0) {
+		if (!mapRings(hp, true)) {
+			huge = false;
+			ringCapacity = capacity;
+			if (!mapRings(pg, false)) {
+				// no memfd, plain rings without mirror
+				ringsSize = alignUp((size_t)capacity * SAMPLE_SIZE * ringCount, pg);
+				this->rings = mapStage(ringsSize, false);
+				if (this->rings == null) {
+					LOGE("arena: can't allocate rings: %s", strerror(errno));
+					release();
+					return false;
+				}
+			}
+		}
+		if (fd >= 0) {
+			// both copies share pages, prepare the first copy of each ring
+			size_t ringBytes = (size_t)ringCapacity * SAMPLE_SIZE;
+			for (int i = 0; i < ringCount; ++i) prepare(this->rings + 2*ringBytes*i, ringBytes, numaNode);
+		}
+		else prepare(this->rings, ringsSize, numaNode);
+	}
+
+	if (staging > 0) {
+		stageSize = alignUp(staging, hp);
+		stage = mapStage(stageSize, true);
+		if (stage == null) {
+			huge = false;
+			stageSize = alignUp(staging, pg);
+			stage = mapStage(stageSize, false);
+		}
+		if (stage == null) {
+			LOGE("arena: can't allocate staging: %s", strerror(errno));
+			release();
+			return false;
+		}
+		prepare(stage, stageSize, numaNode);
+	}
+	LOGD("arena: %s", toString().cstr());
+	return true;
+}
+
+void SampleArena::release() {
+	if (rings != null) munmap(rings, ringsSize);
+	if (stage != null) munmap(stage, stageSize);
+	if (fd >= 0) ::close(fd);
+	rings = stage = null;
+	fd = -1;
+	ringsSize = stageSize = stageUsed = 0;
+	ringCount = ringUsed = 0;
+}
+
+String SampleArena::toString() const {
+	return String::format("rings=%d/%d cap=%d%s staging=%zu/%zu%s%s", ringUsed, ringCount, ringCapacity,
+			fd >= 0 ? " mirrored" : "", stageUsed, stageSize, huge ? " hugepages" : "", locked ? " locked" : "");
+}
+
+short *SampleArena::ring(int& capacity, boolean& mirrored) {
+	if (ringUsed >= ringCount || capacity > ringCapacity)
+		throw RuntimeException(String::format("arena: no ring for capacity %d (%s)", capacity, toString().cstr()));
+	mirrored = fd >= 0;
+	size_t ringBytes = (size_t)ringCapacity * SAMPLE_SIZE;
+	uint8_t *p = rings + (mirrored ? 2 : 1) * ringBytes * ringUsed;
+	++ringUsed;
+	capacity = ringCapacity;
+	return (short *)p;
+}
+
+void *SampleArena::staging(size_t bytes) {
+	size_t sz = alignUp(bytes, 64);
+	if (stageUsed + sz > stageSize)
+		throw RuntimeException(String::format("arena: no staging for %zu bytes (%s)", bytes, toString().cstr()));
+	void *p = stage + stageUsed;
+	stageUsed += sz;
+	return p;
+}
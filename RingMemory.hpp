@@ -0,0 +1,53 @@
+#ifndef RINGMEMORY_HPP
+#define RINGMEMORY_HPP
+
+#include <lang/String.hpp>
+
+// Storage for sample rings (1sample = 2*short).
+// Mirrored memory maps the same pages twice back-to-back, so buf[2*(capacity+i)]
+// aliases buf[2*i] and any window of up to capacity samples is contiguous.
+// Heap memory is the fallback when mirroring is not available.
+
+// allocate ring for at least capacity samples, capacity is rounded up to whole pages when mirrored
+short *ringAlloc(int& capacity, boolean& mirrored);
+void ringFree(short *buf, int capacity, boolean mirrored);
+
+// Preallocated memory for all rings and staging buffers of a device.
+// Prefers hugepages, pages are locked (mlock) and faulted in on create,
+// optionally bound to a NUMA node, so the hot path never allocates nor page-faults.
+class SampleArena : extends Object {
+private:
+	int fd = -1;           // memfd backing the rings (-1: rings not mirrored)
+	boolean huge = false;
+	boolean locked = false;
+	int ringCapacity = 0;  // samples per ring
+	int ringCount = 0, ringUsed = 0;
+	uint8_t *rings = null; // all rings, each mapped twice when mirrored
+	size_t ringsSize = 0;
+	uint8_t *stage = null; // staging buffers
+	size_t stageSize = 0, stageUsed = 0;
+
+	SampleArena(const SampleArena&) = delete;
+	SampleArena& operator=(const SampleArena&) = delete;
+	boolean mapRings(size_t pg, boolean hugetlb);
+	uint8_t *mapStage(size_t size, boolean hugetlb);
+	void prepare(uint8_t *addr, size_t size, int numaNode);
+public:
+	SampleArena() {}
+	~SampleArena() { release(); }
+
+	// rings - number of rings with capacity samples each, staging - bytes for staging buffers
+	boolean create(int rings, int capacity, size_t staging, int numaNode = -1);
+	void release();
+
+	boolean isHuge() const { return huge; }
+	boolean isLocked() const { return locked; }
+	String toString() const;
+
+	// next ring, capacity is set to actual ring capacity (>= requested)
+	short *ring(int& capacity, boolean& mirrored);
+	// staging buffer, 64 bytes aligned
+	void *staging(size_t bytes);
+};
+
+#endif
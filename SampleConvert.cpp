@@ -0,0 +1,220 @@
+#include <lang/System.hpp>
+
+#include "SampleConvert.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
+namespace {
+inline short saturate(float x) {
+	if (x >= 32767.0f) return 32767;
+	if (x <= -32768.0f) return -32768;
+	return (short)lrintf(x);
+}
+
+void toFloatScalar(float *out, const short *in, float scale, int len) {
+	for (int i = 0; i < len; i++) out[i] = in[i]*scale;
+}
+void toShortScalar(short *out, const float *in, float scale, int len) {
+	for (int i = 0; i < len; i++) out[i] = saturate(in[i]*scale);
+}
+void toFloatIQScalar(float *out, const short *in, float scaleI, float scaleQ, int len) {
+	for (int i = 0; i < len; i++) {
+		out[2*i] = in[2*i]*scaleI;
+		out[2*i+1] = in[2*i+1]*scaleQ;
+	}
+}
+void toShortIQScalar(short *out, const float *in, float scaleI, float scaleQ, int len) {
+	for (int i = 0; i < len; i++) {
+		out[2*i] = saturate(in[2*i]*scaleI);
+		out[2*i+1] = saturate(in[2*i+1]*scaleQ);
+	}
+}
+boolean supportedScalar() { return true; }
+
+#ifdef CONVERT_X86
+// SSE2: 8 values per iteration
+__attribute__((target("sse2")))
+void toFloatSSE2(float *out, const short *in, const __m128 vs, int len) {
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vs));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vs));
+	}
+	// tail: scale vector is periodic with 2 values
+	float sc[4];
+	_mm_storeu_ps(sc, vs);
+	for (; i < len; i++) out[i] = in[i]*sc[i&1];
+}
+__attribute__((target("sse2")))
+void toShortSSE2(short *out, const float *in, const __m128 vs, int len) {
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), vs));
+		__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), vs));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+	}
+	float sc[4];
+	_mm_storeu_ps(sc, vs);
+	for (; i < len; i++) out[i] = saturate(in[i]*sc[i&1]);
+}
+__attribute__((target("sse2")))
+void toFloatSSE2(float *out, const short *in, float scale, int len) {
+	toFloatSSE2(out, in, _mm_set1_ps(scale), len);
+}
+__attribute__((target("sse2")))
+void toShortSSE2(short *out, const float *in, float scale, int len) {
+	toShortSSE2(out, in, _mm_set1_ps(scale), len);
+}
+__attribute__((target("sse2")))
+void toFloatIQSSE2(float *out, const short *in, float scaleI, float scaleQ, int len) {
+	toFloatSSE2(out, in, _mm_setr_ps(scaleI, scaleQ, scaleI, scaleQ), 2*len);
+}
+__attribute__((target("sse2")))
+void toShortIQSSE2(short *out, const float *in, float scaleI, float scaleQ, int len) {
+	toShortSSE2(out, in, _mm_setr_ps(scaleI, scaleQ, scaleI, scaleQ), 2*len);
+}
+boolean supportedSSE2() { return __builtin_cpu_supports("sse2"); }
+
+// AVX2: 16 values per iteration
+__attribute__((target("avx2")))
+void toFloatAVX2(float *out, const short *in, const __m256 vs, int len) {
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i + 8)));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), vs));
+		_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), vs));
+	}
+	float sc[8];
+	_mm256_storeu_ps(sc, vs);
+	for (; i < len; i++) out[i] = in[i]*sc[i&1];
+}
+__attribute__((target("avx2")))
+void toShortAVX2(short *out, const float *in, const __m256 vs, int len) {
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m256i lo = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i), vs));
+		__m256i hi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), vs));
+		// packs works within 128-bit lanes, restore order
+		__m256i x = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+		_mm256_storeu_si256((__m256i *)(out + i), x);
+	}
+	float sc[8];
+	_mm256_storeu_ps(sc, vs);
+	for (; i < len; i++) out[i] = saturate(in[i]*sc[i&1]);
+}
+__attribute__((target("avx2")))
+void toFloatAVX2(float *out, const short *in, float scale, int len) {
+	toFloatAVX2(out, in, _mm256_set1_ps(scale), len);
+}
+__attribute__((target("avx2")))
+void toShortAVX2(short *out, const float *in, float scale, int len) {
+	toShortAVX2(out, in, _mm256_set1_ps(scale), len);
+}
+__attribute__((target("avx2")))
+void toFloatIQAVX2(float *out, const short *in, float scaleI, float scaleQ, int len) {
+	toFloatAVX2(out, in, _mm256_setr_ps(scaleI, scaleQ, scaleI, scaleQ, scaleI, scaleQ, scaleI, scaleQ), 2*len);
+}
+__attribute__((target("avx2")))
+void toShortIQAVX2(short *out, const float *in, float scaleI, float scaleQ, int len) {
+	toShortAVX2(out, in, _mm256_setr_ps(scaleI, scaleQ, scaleI, scaleQ, scaleI, scaleQ, scaleI, scaleQ), 2*len);
+}
+boolean supportedAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+#ifdef CONVERT_NEON
+// NEON: 8 values per iteration
+void toFloatNEON(float *out, const short *in, const float32x4_t vs, int len) {
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		int16x8_t x = vld1q_s16(in + i);
+		vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), vs));
+		vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), vs));
+	}
+	float sc[4];
+	vst1q_f32(sc, vs);
+	for (; i < len; i++) out[i] = in[i]*sc[i&1];
+}
+inline int32x4_t roundNEON(float32x4_t x) {
+#ifdef __aarch64__
+	return vcvtnq_s32_f32(x);
+#else
+	// round half away from zero
+	uint32x4_t neg = vcltq_f32(x, vdupq_n_f32(0.0f));
+	float32x4_t h = vbslq_f32(neg, vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f));
+	return vcvtq_s32_f32(vaddq_f32(x, h));
+#endif
+}
+void toShortNEON(short *out, const float *in, const float32x4_t vs, int len) {
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		int32x4_t lo = roundNEON(vmulq_f32(vld1q_f32(in + i), vs));
+		int32x4_t hi = roundNEON(vmulq_f32(vld1q_f32(in + i + 4), vs));
+		vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	float sc[4];
+	vst1q_f32(sc, vs);
+	for (; i < len; i++) out[i] = saturate(in[i]*sc[i&1]);
+}
+void toFloatNEON(float *out, const short *in, float scale, int len) {
+	toFloatNEON(out, in, vdupq_n_f32(scale), len);
+}
+void toShortNEON(short *out, const float *in, float scale, int len) {
+	toShortNEON(out, in, vdupq_n_f32(scale), len);
+}
+void toFloatIQNEON(float *out, const short *in, float scaleI, float scaleQ, int len) {
+	const float sc[4] = {scaleI, scaleQ, scaleI, scaleQ};
+	toFloatNEON(out, in, vld1q_f32(sc), 2*len);
+}
+void toShortIQNEON(short *out, const float *in, float scaleI, float scaleQ, int len) {
+	const float sc[4] = {scaleI, scaleQ, scaleI, scaleQ};
+	toShortNEON(out, in, vld1q_f32(sc), 2*len);
+}
+boolean supportedNEON() { return true; }
+#endif
+
+const ConvertKernels kernels[] = {
+	{"scalar", toFloatScalar, toShortScalar, toFloatIQScalar, toShortIQScalar, supportedScalar},
+#ifdef CONVERT_X86
+	{"sse2", toFloatSSE2, toShortSSE2, toFloatIQSSE2, toShortIQSSE2, supportedSSE2},
+	{"avx2", toFloatAVX2, toShortAVX2, toFloatIQAVX2, toShortIQAVX2, supportedAVX2},
+#endif
+#ifdef CONVERT_NEON
+	{"neon", toFloatNEON, toShortNEON, toFloatIQNEON, toShortIQNEON, supportedNEON},
+#endif
+};
+
+const ConvertKernels& selectKernels() {
+	int n = sizeof(kernels)/sizeof(kernels[0]);
+	int best = 0;
+	for (int i = 1; i < n; ++i) {
+		if (kernels[i].supported()) best = i;
+	}
+	LOGD("sample conversion kernels: %s", kernels[best].name);
+	return kernels[best];
+}
+}
+
+int convertKernelsCount() {
+	return sizeof(kernels)/sizeof(kernels[0]);
+}
+const ConvertKernels& convertKernels(int i) {
+	if (i < 0 || i >= convertKernelsCount()) throw IllegalArgumentException(String::format("kernel %d", i));
+	return kernels[i];
+}
+const ConvertKernels& convertKernels() {
+	static const ConvertKernels& k = selectKernels();
+	return k;
+}
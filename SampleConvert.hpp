@@ -0,0 +1,37 @@
+#ifndef SAMPLECONVERT_HPP
+#define SAMPLECONVERT_HPP
+
+#include <lang/String.hpp>
+
+// sc16 <-> float conversion kernels
+// len - number of values (toFloat/toShort) or I/Q samples (*IQ variants)
+struct ConvertKernels {
+	const char *name;
+	void (*toFloat)(float *out, const short *in, float scale, int len);
+	void (*toShort)(short *out, const float *in, float scale, int len);
+	// interleaved I/Q converted and scaled in one pass, separate gain for I and Q
+	void (*toFloatIQ)(float *out, const short *in, float scaleI, float scaleQ, int len);
+	void (*toShortIQ)(short *out, const float *in, float scaleI, float scaleQ, int len);
+	boolean (*supported)();
+};
+
+// all kernels built in, scalar first; unsupported ones are skipped at selection
+int convertKernelsCount();
+const ConvertKernels& convertKernels(int i);
+// best kernel for this cpu (selected once at runtime)
+const ConvertKernels& convertKernels();
+
+inline void toFloat(float *out, const short *in, float scale, int len) {
+	convertKernels().toFloat(out, in, scale, len);
+}
+inline void toShort(short *out, const float *in, float scale, int len) {
+	convertKernels().toShort(out, in, scale, len);
+}
+inline void toFloatIQ(float *out, const short *in, float scaleI, float scaleQ, int len) {
+	convertKernels().toFloatIQ(out, in, scaleI, scaleQ, len);
+}
+inline void toShortIQ(short *out, const float *in, float scaleI, float scaleQ, int len) {
+	convertKernels().toShortIQ(out, in, scaleI, scaleQ, len);
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <lang/System.hpp>
+#include <lang/Math.hpp>
+
+#include "SynthBackend.hpp"
+#include "ChannelDecoder.hpp"
+#include "GsmClock.hpp"
+#include "GsmSync.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+const int NOISE_LEN = 1 << 16; // complex samples in noise table
+const double SYMS_PER_BURST = 156.25;
+const double SYMS_PER_FRAME = 8 * SYMS_PER_BURST;
+
+short clip(double v) {
+	if (v > 32767) return 32767;
+	if (v < -32767) return -32767;
+	return (short)v;
+}
+}
+
+boolean SynthBackend::parse(const String& args) {
+	cellFreq = atof(option(args, "freq", "1822.8e6").cstr());
+	bsic = atoi(option(args, "bsic", "43").cstr());
+	fnStart = atoi(option(args, "fn", "0").cstr());
+	snr = atof(option(args, "snr", "30").cstr());
+	foffs = atof(option(args, "foffs", "0").cstr());
+	if (bsic < 0 || bsic > 63 || fnStart < 0 || fnStart >= FRAME_MODULUS) {
+		LOGE("synth: wrong bsic %d or fn %d", bsic, fnStart);
+		return false;
+	}
+
+	// Box-Muller, per component sigma from SNR
+	double sigma = amp / sqrt(2 * pow(10, snr / 10));
+	noise = Array<short>(2*NOISE_LEN);
+	for (int i = 0; i < NOISE_LEN; ++i) {
+		rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+		double u1 = ((rnd >> 8) + 1.0) / 16777217.0;
+		rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+		double u2 = (rnd >> 8) / 16777216.0;
+		double r = sigma * sqrt(-2 * log(u1));
+		noise[2*i] = clip(r * cos(2*M_PI*u2));
+		noise[2*i+1] = clip(r * sin(2*M_PI*u2));
+	}
+	LOGD("synth: cell %.3lf MHz, bsic %d, fn %d, snr %.1lf dB, offset %.1lf Hz", cellFreq/1e6, bsic, fnStart, snr, foffs);
+	return true;
+}
+
+// tail, stealing and training bits around data bits 3..59, 88..144
+void SynthBackend::normalBurst(uint8_t *b) {
+	for (int i = 0; i < 3; ++i) b[i] = b[BURST_BITS - 1 - i] = 0;
+	b[60] = b[87] = 1;
+	memcpy(b + 61, GmskDemod::training(bsic & 7), 26);
+}
+
+void SynthBackend::makeBurst() {
+	if (tn == 0) {
+		int f = fn % 51;
+		if (f % 10 == 0 && f != 50) {
+			memset(burst, 0, sizeof(burst)); // FCCH
+			return;
+		}
+		if (f % 10 == 1) {
+			GsmSync::schBurst(bsic, fn, burst);
+			return;
+		}
+		int b = ChannelDecoder::xcchBurst(fn);
+		if (b >= 0) {
+			if (blockFn != fn - b) {
+				uint8_t data[XCCH_BYTES];
+				memset(data, 0x2b, sizeof(data));
+				data[0] = 0x01; // L2 pseudo length 0
+				data[1] = (uint8_t)(fn / 51);
+				ChannelDecoder::encode(data, block);
+				for (int i = 0; i < 4; ++i) normalBurst(block[i]);
+				blockFn = fn - b;
+			}
+			memcpy(burst, block[b], sizeof(burst));
+			return;
+		}
+	}
+	for (int i = 0; i < BURST_BITS; ++i) {
+		rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+		burst[i] = (uint8_t)(rnd >> 31);
+	}
+	normalBurst(burst);
+}
+
+// symbol k of a burst spans [start+k, start+k+1), guard is 8.25 symbols of ones
+void SynthBackend::nextSymbol() {
+	phi += step * (symEnd - symStart);
+	symStart = symEnd;
+	double end = (tn + 1) * SYMS_PER_BURST;
+	if (symStart >= end) {
+		bit = 0;
+		if (++tn == 8) {
+			tn = 0;
+			fn = GsmClock::fnAdd(fn, 1);
+			tau -= SYMS_PER_FRAME;
+			symStart -= SYMS_PER_FRAME;
+			phi = fmod(phi, 2*M_PI);
+		}
+		makeBurst();
+		end = (tn + 1) * SYMS_PER_BURST;
+	}
+	else ++bit;
+	symEnd = symStart + 1 < end ? symStart + 1 : end;
+	uint8_t b = bit < BURST_BITS ? burst[bit] : 1;
+	step = (b ^ prev) ? -M_PI/2 : M_PI/2;
+	prev = b;
+}
+
+// tick t is the last sample of symbol time (t+1)*dtau, so a symbol is complete at its last sample
+void SynthBackend::restart(jlong ts) {
+	genRate = rate;
+	dtau = GSM_SYMBOL_RATE / rate;
+	double s = (double)(ts + 1) * dtau;
+	jlong f = (jlong)floor(s / SYMS_PER_FRAME);
+	fn = GsmClock::fnAdd(fnStart, (int)(f % FRAME_MODULUS));
+	tau = s - (double)f * SYMS_PER_FRAME;
+	tn = (int)(tau / SYMS_PER_BURST);
+	if (tn > 7) tn = 7;
+	bit = (int)(tau - tn * SYMS_PER_BURST);
+	makeBurst();
+	// enter the symbol holding tau
+	symStart = symEnd = tn * SYMS_PER_BURST + bit;
+	--bit;
+	prev = bit >= 0 && bit < BURST_BITS ? burst[bit] : 1;
+	step = 0;
+	phi = 0;
+	nextSymbol();
+}
+
+int SynthBackend::produce(short *out, int n, jlong ts, double freq) {
+	if (ts != next || rate != genRate) restart(ts);
+	next = ts + n;
+	double df = cellFreq - freq + foffs;
+	boolean visible = Math::abs(df) < rate / 2;
+	double drot = 2*M_PI * df / rate;
+	rot = fmod(rot, 2*M_PI);
+	rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+	int ni = (int)(rnd & (NOISE_LEN - 1));
+	for (int i = 0; i < n; ++i) {
+		while (tau >= symEnd) nextSymbol();
+		double re = noise[2*ni], im = noise[2*ni+1];
+		if (visible) {
+			double ph = phi + step * (tau - symStart) + rot;
+			re += amp * cos(ph);
+			im += amp * sin(ph);
+		}
+		out[2*i] = clip(re);
+		out[2*i+1] = clip(im);
+		ni = (ni + 1) & (NOISE_LEN - 1);
+		tau += dtau;
+		rot += drot;
+	}
+	return n;
+}
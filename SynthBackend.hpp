@@ -0,0 +1,51 @@
+#ifndef SYNTHBACKEND_HPP
+#define SYNTHBACKEND_HPP
+
+#include "VirtualBackend.hpp"
+#include "GmskDemod.hpp"
+
+// Generated GSM cell on one carrier, at any stream rate (MSK, continuous phase).
+// TN0 carries the 51-multiframe: FCCH, SCH, BCCH/CCCH blocks (L2 fill frames with
+// the 51-multiframe number in byte 1), TN1-7 random normal bursts with TSC = BCC.
+// Frame fn (synth arg) starts at tick 0, the cell shows only when tuned within rate/2.
+// args: synth,freq=<Hz>,bsic=<n>,fn=<n>,snr=<dB>,foffs=<Hz>,throttle=0|1
+class SynthBackend : public VirtualBackend {
+private:
+	double cellFreq = 1822.8e6; // ARFCN 600 (DCS1800)
+	int bsic = 0x2b;
+	int fnStart = 0;
+	double snr = 30;
+	double foffs = 0;           // carrier offset
+
+	Array<short> noise;         // gaussian noise, I/Q
+	uint32_t rnd = 1;
+	float amp = 8192;
+
+	// generator position
+	jlong next = -1;            // tick expected by produce (-1 not started)
+	double genRate = 0;
+	double dtau = 0;            // symbols per tick
+	double tau = 0;             // symbols since start of frame fn
+	int fn = 0, tn = 0, bit = 0;
+	double symStart = 0, symEnd = 0; // current symbol span
+	double phi = 0;             // MSK phase at symStart
+	double step = 0;            // MSK phase change per symbol
+	uint8_t prev = 0;
+	double rot = 0;             // phase of frequency offset
+	uint8_t burst[BURST_BITS];
+	int blockFn = -1;           // first frame of encoded xCCH block
+	uint8_t block[4][BURST_BITS];
+
+	void restart(jlong ts);
+	void nextSymbol();
+	void makeBurst();
+	void normalBurst(uint8_t *b);
+protected:
+	boolean parse(const String& args);
+	int produce(short *out, int n, jlong ts, double freq);
+public:
+	String name() const { return String::format("synth %.1lf MHz bsic %d", cellFreq/1e6, bsic); }
+	DeviceType type() const { return DeviceType::SYNTH; }
+};
+
+#endif
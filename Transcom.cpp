@@ -1,7 +1,11 @@
 #include <lang/Number.hpp>
 #include "Transcom.hpp"
 
-#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace {
 int makeParam(int a, int b) { return ((a&0xff)<<8) | (b&0xff); }
@@ -10,7 +14,7 @@ void setupChannel(Shared<DatagramChannel> chn, const String& host, int port) {
 	chn->connect(InetSocketAddress(host, port));
 }
 
-byte dummy_burst[148] = {
+const uint8_t dummy_burst[TRXD_BITS] = {
     0,0,0,
     1,1,1,1,1,0,1,1,0,1,1,1,0,1,1,0,0,0,0,0,1,0,1,0,0,1,0,0,1,1,1,0,
     0,0,0,0,1,0,0,1,0,0,0,1,0,0,0,0,0,0,0,1,1,1,1,1,0,0,0,1,1,1,0,0,
@@ -23,196 +27,174 @@ byte dummy_burst[148] = {
 
 uint32_t Transcom::nextFrame() {
 	//currentFrame = (currentFrame + CLOCK_ADVANCE)%FRAME_MODULUS;
-	currentFrame = (currentFrame + 1)%FRAME_MODULUS;
+	currentFrame = (uint32_t)GsmClock::fnAdd((int)currentFrame, 1);
 	return currentFrame;
 }
 
-void Transcom::sendCommand(Command cmd, int param) {
+void Transcom::sendCommand(Command cmd, int param, TrxCallback cb, boolean required) {
 	if (!transceiverAvailable && cmd != Command::POWEROFF) {
-		LOGE("transceiver not available, command '%d' not send", cmd);
-		return ;
+		LOGE("transceiver not available, command '%s' not send", TrxProtocol::name(cmd));
+	}
+	else if (control.submit(cmd, param, TrxClock::now(), cb, required)) return ;
+	// callers wait for cb, it must run for commands never queued too
+	if (cb) {
+		TrxRsp rsp;
+		rsp.cmd = cmd;
+		rsp.status = TRXC_ABORTED;
+		rsp.params = 0;
+		cb(rsp);
+	}
+}
+
+// edge triggered: every source is read until it would block
+void Transcom::readClock(int fd) {
+	ssize_t l;
+	while ((l = ::recv(fd, ctrlBuf, sizeof(ctrlBuf) - 1, MSG_DONTWAIT)) >= 0) {
+		lastRx = TrxClock::now();
+		uint32_t clock;
+		if (l > 0 && TrxProtocol::parseClock(ctrlBuf, (int)l, clock) && clock < FRAME_MODULUS) handleClock((int)clock);
+		else {
+			ctrlBuf[l] = 0;
+			LOGE("Unrecognized clock message '%s'", ctrlBuf);
+		}
 	}
-	String msg = "CMD ";
-	switch (cmd) {
-	case Command::POWEROFF:
-		msg += "POWEROFF";
-		break;
-	case Command::RXTUNE:
-		msg += String::format("RXTUNE %d", param);
-		break;
-	case Command::TXTUNE:
-		msg += String::format("TXTUNE %d", param);
-		break;
-	case Command::SETTSC:
-		msg += String::format("SETTSC %d", param);
-		break;
-	case Command::SETBSIC:
-		msg += String::format("SETBSIC %d", param);
-		break;
-	case Command::POWERON:
-		msg += "POWERON";
-		break;
-	case Command::SETRXGAIN:
-		msg += String::format("SETRXGAIN %d", param);
-		break;
-	case Command::SETPOWER:
-		msg += String::format("SETPOWER %d", param);
-		break;
-	case Command::SETSLOT:
-		msg += String::format("SETSLOT %d %d", (param>>8)&0xff, param&0xff);
-		break;
+}
+void Transcom::readControl(int fd) {
+	ssize_t l;
+	while ((l = ::recv(fd, ctrlBuf, sizeof(ctrlBuf) - 1, MSG_DONTWAIT)) >= 0) {
+		lastRx = TrxClock::now();
+		if (l > 0 && TrxProtocol::parseResponse(ctrlBuf, (int)l, rsp)) control.response(rsp, lastRx);
+		else {
+			ctrlBuf[l] = 0;
+			LOGE("Unrecognized response '%s'", ctrlBuf);
+		}
+	}
+}
+void Transcom::readData(int fd) {
+	// drain in batches of datagrams
+	int r;
+	do {
+		r = trxd.receive(fd);
+		if (r > 0) lastRx = TrxClock::now();
+		while (trxd.next(burst)) handleData(burst);
+	} while (r == TRXD_BATCH);
+}
+void Transcom::readTimer() {
+	jlong now = TrxClock::now();
+	int fn;
+	int n = frameClock.expired(now, fn);
+	if (n == 0) return ;
+	if (now - lastRx > RX_TIMEOUT) {
+		lost();
+		return ;
 	}
-	msg += '\0';
-	Array<byte> bytes = msg.getBytes();
-	ctrlChn->write(*nio::ByteBuffer::wrap(bytes));
+	for (int i = 0; i < n; ++i) handleFrame(GsmClock::fnAdd(fn, i));
+}
+
+void Transcom::lost() {
+	if (transceiverAvailable) LOGW("Nothing received (transceiver not available)");
+	transceiverAvailable = false;
+	setupDone = false;
+	frameClock.stop();
+	uplink.clear();
+	control.abort();
+	// probe, next one after RX_TIMEOUT
+	lastRx = TrxClock::now();
+	sendCommand(Command::POWEROFF);
 }
 
 void Transcom::run() {
 	transceiverAvailable = true;
-	Shared<nio::ByteBuffer> buf = nio::ByteBuffer::allocate(1000);
-
-	//TODO use Selector
-	struct ::pollfd fds[3];
-	fds[0].fd = clockChn->getFDVal();
-	fds[0].events = POLLIN;
-	fds[1].fd = ctrlChn->getFDVal();
-	fds[1].events = POLLIN;
-	fds[2].fd = dataChn->getFDVal();
-	fds[2].events = POLLIN;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) throw io::IOException(String("epoll ") + strerror(errno));
+	const int fds[] = {clockChn->getFDVal(), ctrlChn->getFDVal(), dataChn->getFDVal(), frameClock.getFD()};
+	for (int i = 0; i < 4; ++i) {
+		struct epoll_event ev;
+		ev.events = EPOLLIN|EPOLLET;
+		ev.data.u32 = (uint32_t)i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) != 0) throw io::IOException(String("epoll_ctl ") + strerror(errno));
+	}
+	lastRx = TrxClock::now();
 	running = true;
 	while (running) {
-		fds[0].revents = 0;
-		fds[1].revents = 0;
-		fds[2].revents = 0;
-
-		int n = ::poll(fds, 3, 1000);
+		struct epoll_event events[4];
+		// wake for the next TRXC retransmit, at latest after RX_TIMEOUT
+		jlong wait = control.poll(TrxClock::now());
+		int n = epoll_wait(epfd, events, 4, wait < 0 || wait >= RX_TIMEOUT ? 1000 : (int)(wait / 1000000) + 1);
 		if (n == 0) {
-			if (transceiverAvailable) LOGW("Nothing received (transceiver not available)");
-			transceiverAvailable = false;
-			setupDone = false;
-			sendCommand(Command::POWEROFF);
+			if (TrxClock::now() - lastRx > RX_TIMEOUT) lost();
 			continue;
 		}
 		if (n == -1) {
-			throw io::IOException(String("poll ") + strerror(errno));
+			if (errno == EINTR) continue;
+			throw io::IOException(String("epoll_wait ") + strerror(errno));
 		}
-		if (fds[0].revents) {
-			buf->clear();
-			clockChn->receive(*buf);
-			String msg(buf->array());
-			try {
-				if (!msg.startsWith("IND CLOCK ")) throw Exception();
-				int clock = Integer::parseInt(msg.substring(10));
-				handleClock(clock);
+		for (int i = 0; i < n; ++i) {
+			switch (events[i].data.u32) {
+			case 0: readClock(fds[0]); break;
+			case 1: readControl(fds[1]); break;
+			case 2: readData(fds[2]); break;
+			case 3: readTimer(); break;
 			}
-			catch (const Exception& ex) {
-				LOGE("Unrecognized clock message "+msg+"\n"+ex.toString());
-			}
-		}
-		if (fds[1].revents) {
-			buf->clear();
-			ctrlChn->receive(*buf);
-			handleResponse(String(buf->array()));
-		}
-		if (fds[2].revents) {
-			buf->clear();
-			dataChn->receive(*buf);
-			buf->flip();
-			handleData(*buf);
 		}
+		trxd.flush(fds[2]);
 	}
 }
 
-// based on osmo-bts-trx/trx_if.c(462) trx_if_data
-void Transcom::sendData(uint8_t tn, uint32_t fn, uint8_t gain, nio::ByteBuffer& data) {
+boolean Transcom::sendData(uint8_t tn, uint32_t fn, uint8_t gain, const uint8_t *bits, int n) {
 	if (!transceiverAvailable) {
 		LOGE("transceiver not available, data not sent");
-		return ;
-	}
-	if (tn < 0 || tn > 7) throw IllegalArgumentException(String::format("TN=%d", tn));
-
-	Shared<nio::ByteBuffer> buf = nio::ByteBuffer::allocate(1000);
-	buf->put(tn);    // timeslot number (0..7)
-	buf->putInt(fn); // frame number
-	buf->put(gain);  // signal power
-	StringBuilder sb(2*DATA_RECV_SIZE);
-	while (data.position() < data.limit()) {
-		byte x = data.get();
-		buf->put(x);
-		sb.append(String::format("%u,",x));
+		return false;
 	}
-	while (buf->position() < DATA_SEND_SIZE) {
-		buf->put(0);
-		sb.append("N");
-	}
-	buf->flip();
-	LOGD("sendData(tn=%d, fn=%d, gain=%d, bytes=%d", tn, fn, gain, buf->limit());
-	LOGD(sb.toString());
-	dataChn->write(*buf);
+	LOGD("sendData(tn=%d, fn=%d, gain=%d", tn, fn, gain);
+	return uplink.put(tn, (int)fn, gain, bits, n);
 }
 void Transcom::sendDummyPacket() {
-	Shared<nio::ByteBuffer> data = nio::ByteBuffer::allocate(148);
-	for (int i = 0; i < 148; ++i) data->put(dummy_burst[i]);
-	byte tn = 0;
-	data->flip();
-	sendData(tn, nextFrame(), 0, *data);
-	++tn; data->flip();
-	sendData(tn, nextFrame(), 0, *data);
-/*
-	sendData(tn+2, nextFrame(), 0, *data);
-	sendData(tn+3, nextFrame(), 0, *data);
-	sendData(tn+4, nextFrame(), 0, *data);
-*/
-}
-
-void Transcom::handleResponse(const String& resp) {
-	LOGD("Response: %s", resp.cstr());
+	sendData(0, nextFrame(), 0, dummy_burst, TRXD_BITS);
+	sendData(1, nextFrame(), 0, dummy_burst, TRXD_BITS);
 }
+
 void Transcom::handleClock(int clk) {
-	if (!transceiverAvailable) {
-	}
 	transceiverAvailable = true;
 	LOGD("Clock: %d", clk);
-	trxFrame = clk;
-	currentFrame = trxFrame;
-	currentFrame = (currentFrame + CLOCK_ADVANCE)%FRAME_MODULUS;
-	if (!setupDone) setupTrx();
-	else {
-		jlong tm = System.currentTimeMillis();
-		if (sendTm < tm) {
-			sendTm = tm + 1000;
-			sendDummyPacket();
-		}
+	trxFrame = (uint32_t)clk;
+	frameClock.lock(clk, lastRx);
+	if (!setupDone && !setupRunning) {
+		setupTrx();
+		dummyFn = GsmClock::fnAdd(clk, DUMMY_PERIOD);
 	}
 }
-void Transcom::handleData(nio::ByteBuffer& data) {
-	int pos = data.position();
-	int lim = data.limit();
-	int rem = (pos <= lim ? lim - pos : 0);
-	if (rem != DATA_RECV_SIZE) {
-		LOGE("Wrong data length: %d", rem);
-		return ;
+// frame fn begins at transceiver, bursts due CLOCK_ADVANCE frames ahead leave now
+void Transcom::handleFrame(int fn) {
+	currentFrame = (uint32_t)GsmClock::fnAdd(fn, CLOCK_ADVANCE);
+	if (uplink.flush((int)currentFrame, trxd) > 0) {
+		trxd.flush(dataChn->getFDVal());
+		sendLatency.add(TrxClock::now() - frameClock.deadline());
 	}
-	uint8_t tn = data.get();      // timeslot number
-	uint32_t fn = data.getInt();  // frame number
-	int8_t rssi = (uint8_t)-data.get();
-	float toa = data.getShort()/256.0f;
-	if (tn < 0 || tn > 7) {
-		LOGE("Invalid TN = %d", tn);
-		return ;
+	if (setupDone && GsmClock::fnDiff(fn, dummyFn) >= 0) {
+		dummyFn = GsmClock::fnAdd(fn, DUMMY_PERIOD);
+		LOGD("TRXD sent %ld bursts in %ld calls, received %ld in %ld calls, errors %ld",
+				trxd.sent, trxd.sendCalls, trxd.received, trxd.recvCalls, trxd.errors);
+		LOGD("Uplink queued %ld, sent %ld, late %ld, rejected %ld",
+				uplink.queued, uplink.sent, uplink.late, uplink.rejected);
+		LOGD("TRXC sent %ld, retransmits %ld, responses %ld, unmatched %ld, failures %ld",
+				control.sent, control.retransmits, control.responses, control.unmatched, control.failures);
+		LOGD("Frame clock missed %ld, jumps %ld, slips %ld, send latency %s",
+				frameClock.missed, frameClock.jumps, frameClock.slips, sendLatency.toString().cstr());
+		sendDummyPacket();
 	}
-
-	LOGD("[%d bytes] tn=%d fn=%u rssi=%d  toa=%4.2f", rem, tn, fn, rssi, toa);
-	StringBuilder sb(2*DATA_RECV_SIZE);
-	while (data.position() < data.limit()) {
-		int x = 127 - (data.get()&0xff);
-		sb.append(String::format("%d,",x));
-	}
-	LOGD("Data: %s", sb.toString().cstr());
+}
+void Transcom::handleData(const TrxdRx& burst) {
+	LOGD("tn=%d fn=%u rssi=%d  toa=%4.2f", burst.tn, burst.fn, burst.rssi, burst.toa);
 }
 
+// one round trip per level: POWEROFF | tuning, slots | POWERON
 void Transcom::setupTrx() {
+	setupRunning = true;
 	sendCommand(Command::POWEROFF);
+	control.barrier();
+
 	//sendCommand(Command::RXTUNE, 885400); //set by bts
 	//sendCommand(Command::TXTUNE, 930400);
 	sendCommand(Command::TXTUNE, 885400); // for arfcn=1001
@@ -224,7 +206,6 @@ void Transcom::setupTrx() {
 
 	sendCommand(Command::SETTSC, 7);
 	sendCommand(Command::SETBSIC, 63);
-	sendCommand(Command::POWERON);
 	sendCommand(Command::SETRXGAIN, 10);
 	sendCommand(Command::SETPOWER, 0);
 	sendCommand(Command::SETSLOT, makeParam(0, 5));
@@ -235,7 +216,28 @@ void Transcom::setupTrx() {
 	sendCommand(Command::SETSLOT, makeParam(5, 1));
 	sendCommand(Command::SETSLOT, makeParam(6, 1));
 	sendCommand(Command::SETSLOT, makeParam(7, 1));
-	setupDone = true;
+	control.barrier();
+
+	sendCommand(Command::POWERON, 0, [this](const TrxRsp& rsp) {
+		setupRunning = false;
+		setupDone = !TrxControl::failed(rsp);
+		if (setupDone) LOGN("Transceiver setup done");
+		else LOGE("Transceiver setup failed, %s status %d", TrxProtocol::name(rsp.cmd), rsp.status);
+	});
+}
+
+void Transcom::retune(int rxKHz, int txKHz, TrxCallback cb) {
+	control.barrier();
+	sendCommand(Command::POWEROFF);
+	control.barrier();
+	sendCommand(Command::RXTUNE, rxKHz);
+	sendCommand(Command::TXTUNE, txKHz);
+	control.barrier();
+	sendCommand(Command::POWERON, 0, cb);
+}
+
+Transcom::~Transcom() {
+	if (epfd >= 0) ::close(epfd);
 }
 
 void Transcom::start() {
@@ -246,5 +248,6 @@ void Transcom::start() {
 	setupChannel(clockChn, trxHost, trxPort);
 	setupChannel(ctrlChn, trxHost, trxPort+1);
 	setupChannel(dataChn, trxHost, trxPort+2);
+	control.setFD(ctrlChn->getFDVal());
 	run();
 }
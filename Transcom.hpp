@@ -4,28 +4,22 @@
 #include <lang/Exception.hpp>
 #include <nio/channels/Channel.hpp>
 
+#include "TrxProtocol.hpp"
+#include "TrxClock.hpp"
+#include "BurstQueue.hpp"
+#include "TrxControl.hpp"
+
 using namespace nio::channels;
 class Transcom : extends Object {
 private:
-	static const int DATA_RECV_SIZE = 158;
-	static const int DATA_SEND_SIZE = 154;
-	static const int FRAME_MODULUS = 2715648;
 	static const int CLOCK_ADVANCE = 20;
+	static const int DUMMY_PERIOD = 216; // frames, about 1 s
+	static const jlong RX_TIMEOUT = 1000000000L; // ns without any message from transceiver
 
 	const String trxHost;
 	const int trxPort;
 
-	enum class Command {
-		POWEROFF,
-		RXTUNE,
-		TXTUNE,
-		SETTSC,
-		SETBSIC,
-		POWERON,
-		SETRXGAIN,
-		SETPOWER,
-		SETSLOT,
-	};
+	typedef TrxCommand Command;
 
 	Shared<Selector> selector;
 	Shared<DatagramChannel> clockChn;
@@ -35,18 +29,37 @@ private:
 	boolean running = false;
 	boolean transceiverAvailable = false;
 	boolean setupDone = false;
+	boolean setupRunning = false;
 	uint32_t trxFrame;
 	uint32_t currentFrame = 0;
-	jlong sendTm = 0;
+	int dummyFn = -1;          // frame of next dummy packet
+
+	int epfd = -1;
+	TrxClock frameClock;
+	jlong lastRx = 0;          // monotonic ns of last message received (or probe sent)
+	LatencyHistogram sendLatency; // frame boundary to bursts sent
+
+	// message buffers, nothing is allocated per message
+	char ctrlBuf[TRXC_MAX];    // received TRXC
+	TrxdBatch trxd;
+	BurstQueue uplink;
+	TrxControl control;
+	TrxdRx burst;
+	TrxRsp rsp;
 
 	uint32_t nextFrame();
 
-	void sendCommand(const Command cmd, int param = 0);
-	void sendData(uint8_t tn, uint32_t fn, uint8_t gain, nio::ByteBuffer& data);
+	void sendCommand(const Command cmd, int param = 0, TrxCallback cb = null, boolean required = true);
 
-	void handleResponse(const String& rsp);
 	void handleClock(int clk);
-	void handleData(nio::ByteBuffer& data);
+	void handleData(const TrxdRx& burst);
+	void handleFrame(int fn);
+
+	void readClock(int fd);
+	void readControl(int fd);
+	void readData(int fd);
+	void readTimer();
+	void lost();
 
 	void sendDummyPacket();
 	void setupTrx();
@@ -56,7 +69,14 @@ public:
 
 	Transcom(String host, int port=DAFAULT_TRX_PORT) : trxHost(host), trxPort(port) {
 	}
+	~Transcom();
 	void start();
+
+	// (loop thread) POWEROFF, tune both ways, POWERON; frequencies in kHz
+	void retune(int rxKHz, int txKHz, TrxCallback cb = null);
+	// (loop thread) burst for frame fn of transceiver, sent CLOCK_ADVANCE frames before it
+	// starts; false when too late or too far ahead
+	boolean sendData(uint8_t tn, uint32_t fn, uint8_t gain, const uint8_t *bits, int n);
 };
 
 
@@ -0,0 +1,115 @@
+#include <lang/Exception.hpp>
+
+#include "TrxClock.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+void LatencyHistogram::reset() {
+	for (int i = 0; i < BINS; ++i) bins[i] = 0;
+	count = sum = max = 0;
+}
+void LatencyHistogram::add(jlong ns) {
+	jlong us = ns < 0 ? 0 : ns / 1000;
+	int b = 0;
+	while (b < BINS - 1 && us >= (1L << b)) ++b;
+	++bins[b];
+	++count;
+	sum += us;
+	if (us > max) max = us;
+}
+String LatencyHistogram::toString() const {
+	char buf[BINS*24 + 64];
+	int l = 0;
+	for (int i = 0; i < BINS; ++i) {
+		if (bins[i] == 0) continue;
+		if (i < BINS - 1) l += snprintf(buf + l, sizeof(buf) - (size_t)l, "<%ldus:%ld ", 1L << i, bins[i]);
+		else l += snprintf(buf + l, sizeof(buf) - (size_t)l, ">=%ldus:%ld ", 1L << (i - 1), bins[i]);
+	}
+	snprintf(buf + l, sizeof(buf) - (size_t)l, "avg %ldus max %ldus", count ? sum / count : 0, max);
+	return String(buf);
+}
+
+TrxClock::TrxClock() {
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (fd < 0) throw RuntimeException(String::format("timerfd_create: %s", strerror(errno)));
+}
+TrxClock::~TrxClock() {
+	if (fd >= 0) ::close(fd);
+}
+
+jlong TrxClock::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (jlong)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void TrxClock::arm(jlong t) {
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = t / 1000000000L;
+	its.it_value.tv_nsec = t % 1000000000L;
+	if (t <= 0) its.it_value.tv_nsec = 1; // 0 would disarm
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, null) != 0) {
+		throw RuntimeException(String::format("timerfd_settime: %s", strerror(errno)));
+	}
+}
+
+void TrxClock::lock(int fn, jlong t) {
+	if (locked) {
+		// frame running clock expects now
+		int expect = GsmClock::fnAdd(lockFn, (int)floor(((double)t - lockTime) / TRX_FRAME_NS + 0.5));
+		int d = GsmClock::fnDiff(fn, expect);
+		if (d != 0) {
+			++slips;
+			LOGD("TrxClock: IND CLOCK %d, expected %d", fn, expect);
+		}
+		if (d < -TRX_MAX_CATCHUP || d > TRX_MAX_CATCHUP) {
+			++jumps;
+			nextFn = GsmClock::fnAdd(fn, 1);
+		}
+	}
+	else nextFn = GsmClock::fnAdd(fn, 1);
+	lockTime = (double)t;
+	lockFn = fn;
+	locked = true;
+	// frames already ticked are not repeated when the grid moves back
+	arm(boundary(GsmClock::fnDiff(nextFn, lockFn)));
+}
+
+void TrxClock::stop() {
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(fd, 0, &its, null);
+	uint64_t exp;
+	while (::read(fd, &exp, sizeof(exp)) > 0) ;
+	locked = false;
+}
+
+int TrxClock::expired(jlong t, int& fn) {
+	uint64_t exp;
+	while (::read(fd, &exp, sizeof(exp)) > 0) ;
+	if (!locked) return 0;
+	jlong k = (jlong)floor(((double)t - lockTime) / TRX_FRAME_NS);
+	int cur = GsmClock::fnAdd(lockFn, (int)(k % FRAME_MODULUS));
+	int n = GsmClock::fnDiff(cur, nextFn) + 1;
+	if (n > TRX_MAX_CATCHUP) {
+		// slept through many frames, restart at the current one
+		++jumps;
+		n = 1;
+		nextFn = cur;
+	}
+	if (n > 1) missed += n - 1;
+	fn = nextFn;
+	if (n > 0) {
+		nextFn = GsmClock::fnAdd(cur, 1);
+		last = boundary(k);
+	}
+	else n = 0;
+	arm(boundary(GsmClock::fnDiff(nextFn, lockFn)));
+	return n;
+}
@@ -0,0 +1,61 @@
+#ifndef TRXCLOCK_HPP
+#define TRXCLOCK_HPP
+
+#include <lang/String.hpp>
+
+#include "GsmClock.hpp"
+
+#define TRX_FRAME_NS (60e6 / 13) // GSM frame period
+#define TRX_MAX_CATCHUP 26       // more frames late is a clock jump, not caught up
+
+// Latency in power of 2 microsecond bins.
+class LatencyHistogram : extends Object {
+private:
+	static const int BINS = 16;   // last bin is >= 2^14 us
+	jlong bins[BINS];
+	jlong count = 0, sum = 0, max = 0;
+public:
+	LatencyHistogram() { reset(); }
+	void reset();
+	void add(jlong ns);
+	jlong getCount() const { return count; }
+	jlong getMax() const { return max; }
+	// "<1us:n <2us:n ... avg max"
+	String toString() const;
+};
+
+// Frame clock of transceiver, locked to IND CLOCK and ticking through a timerfd
+// (CLOCK_MONOTONIC, armed at absolute frame boundaries so it doesn't drift).
+// Times are monotonic ns, see now().
+class TrxClock : extends Object {
+private:
+	int fd = -1;
+	boolean locked = false;
+	double lockTime = 0;    // start of frame lockFn
+	int lockFn = 0;
+	int nextFn = 0;         // first frame not yet ticked
+	jlong last = 0;         // boundary of last ticked frame
+
+	jlong boundary(jlong k) const { return (jlong)(lockTime + (double)k * TRX_FRAME_NS); }
+	void arm(jlong t);
+public:
+	jlong missed = 0;       // ticks caught up late
+	jlong jumps = 0;        // IND CLOCK or wakeup off by more than TRX_MAX_CATCHUP
+	jlong slips = 0;        // IND CLOCK not matching the running clock
+
+	TrxClock();
+	~TrxClock();
+	int getFD() const { return fd; }
+	boolean isLocked() const { return locked; }
+
+	static jlong now();
+	// frame fn started at t, starts ticking from the next boundary
+	void lock(int fn, jlong t);
+	void stop();
+	// after the fd got readable at t: count of frames due from fn on, timer rearmed
+	int expired(jlong t, int& fn);
+	// boundary of the latest frame returned by expired()
+	jlong deadline() const { return last; }
+};
+
+#endif
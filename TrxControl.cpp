@@ -0,0 +1,157 @@
+#include <lang/System.hpp>
+
+#include "TrxControl.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+boolean TrxControl::failed(const TrxRsp& rsp) {
+	if (rsp.cmd == TrxCommand::SETFORMAT) return rsp.status < 0;
+	return rsp.status != 0;
+}
+
+boolean TrxControl::matches(const Entry& e, const TrxRsp& rsp) {
+	if (e.state != State::SENT || e.cmd != rsp.cmd) return false;
+	// RSP repeats parameters of these, others answer with value applied (SETRXGAIN, SETPOWER)
+	// or nothing and match by name
+	if (rsp.params == 0) return true;
+	switch (e.cmd) {
+	case TrxCommand::SETSLOT:
+		return rsp.param[0] == ((e.param >> 8) & 0xff);
+	case TrxCommand::RXTUNE:
+	case TrxCommand::TXTUNE:
+	case TrxCommand::SETTSC:
+	case TrxCommand::SETBSIC:
+		return rsp.param[0] == e.param;
+	default:
+		return true;
+	}
+}
+
+int TrxControl::pending() const {
+	int n = 0;
+	for (const Entry& e : cmds) if (e.state != State::FREE) ++n;
+	return n;
+}
+
+boolean TrxControl::submit(TrxCommand cmd, int param, jlong now, TrxCallback cb, boolean required) {
+	for (Entry& e : cmds) {
+		if (e.state != State::FREE) continue;
+		e.state = State::WAITING;
+		e.cmd = cmd;
+		e.param = param;
+		e.level = level;
+		e.required = required;
+		e.seq = seq++;
+		e.tries = 0;
+		e.len = TrxProtocol::encodeCommand(e.msg, sizeof(e.msg), cmd, param);
+		e.cb = cb;
+		advance(now);
+		return true;
+	}
+	LOGE("TRXC: too many commands pending, '%s' not sent", TrxProtocol::name(cmd));
+	return false;
+}
+
+void TrxControl::send(Entry& e, jlong now) {
+	if (e.tries > 0) ++retransmits;
+	e.state = State::SENT;
+	e.sentAt = now;
+	++e.tries;
+	++sent;
+	if (fd < 0 || ::send(fd, e.msg, (size_t)e.len, 0) != e.len) {
+		LOGE("TRXC: send '%s': %s", e.msg, strerror(errno));
+	}
+	else LOGD("TRXC: %s", e.msg);
+}
+
+void TrxControl::advance(jlong now) {
+	int low = level + 1;
+	for (const Entry& e : cmds) if (e.state != State::FREE && e.level < low) low = e.level;
+	for (Entry& e : cmds) {
+		if (e.state == State::WAITING && e.level == low) send(e, now);
+	}
+}
+
+void TrxControl::done(Entry& e, const TrxRsp& rsp) {
+	TrxCallback cb;
+	std::swap(cb, e.cb);
+	int lvl = e.level;
+	boolean abortNext = e.required && failed(rsp);
+	e.state = State::FREE;
+	if (failed(rsp)) {
+		++failures;
+		LOGE("TRXC: %s failed with status %d", e.msg, rsp.status);
+	}
+	if (abortNext) abortFrom(lvl + 1);
+	if (cb) cb(rsp);
+}
+
+void TrxControl::abortFrom(int lvl) {
+	for (Entry& e : cmds) {
+		if (e.state == State::FREE || e.level < lvl) continue;
+		TrxRsp rsp;
+		rsp.cmd = e.cmd;
+		rsp.status = TRXC_ABORTED;
+		rsp.params = 0;
+		TrxCallback cb;
+		std::swap(cb, e.cb);
+		e.state = State::FREE;
+		if (cb) cb(rsp);
+	}
+}
+
+boolean TrxControl::response(const TrxRsp& rsp, jlong now) {
+	Entry *m = null;
+	for (Entry& e : cmds) {
+		if (matches(e, rsp) && (m == null || e.seq < m->seq)) m = &e;
+	}
+	if (m == null) {
+		// late answer of retransmitted or aborted command
+		++unmatched;
+		LOGD("TRXC: unexpected RSP %s %d", TrxProtocol::name(rsp.cmd), rsp.status);
+		return false;
+	}
+	++responses;
+	done(*m, rsp);
+	advance(now);
+	return true;
+}
+
+jlong TrxControl::poll(jlong now) {
+	jlong next = -1;
+	boolean changed = false;
+	for (Entry& e : cmds) {
+		if (e.state != State::SENT) continue;
+		jlong left = e.sentAt + TRXC_TIMEOUT - now;
+		if (left <= 0) {
+			if (e.tries > TRXC_RETRIES) {
+				TrxRsp rsp;
+				rsp.cmd = e.cmd;
+				rsp.status = TRXC_TIMEDOUT;
+				rsp.params = 0;
+				done(e, rsp);
+				changed = true;
+				continue;
+			}
+			LOGW("TRXC: no RSP to '%s', retransmit", e.msg);
+			send(e, now);
+			left = TRXC_TIMEOUT;
+		}
+		if (next < 0 || left < next) next = left;
+	}
+	if (changed) {
+		advance(now);
+		for (const Entry& e : cmds) {
+			if (e.state != State::SENT) continue;
+			jlong left = e.sentAt + TRXC_TIMEOUT - now;
+			if (next < 0 || left < next) next = left;
+		}
+	}
+	return next;
+}
+
+void TrxControl::abort() {
+	abortFrom(0);
+	level = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef TRXCONTROL_HPP
+#define TRXCONTROL_HPP
+
+#include "TrxProtocol.hpp"
+
+#include <functional>
+
+#define TRXC_PENDING   32         // commands in flight or waiting
+#define TRXC_TIMEOUT   500000000L // ns without RSP before retransmit
+#define TRXC_RETRIES   3
+#define TRXC_TIMEDOUT  -1000      // status of command never answered
+#define TRXC_ABORTED   -1001      // status of command not sent (earlier level failed, queue full)
+
+// called with RSP of the command or status TRXC_TIMEDOUT/TRXC_ABORTED
+typedef std::function<void(const TrxRsp& rsp)> TrxCallback;
+
+// TRXC client with outstanding command tracking. Commands are grouped in dependency
+// levels by barrier(): all commands of a level are sent at once, the next level goes
+// when every one of them is answered. Failed required command aborts later levels.
+// RSP matches the oldest command sent with same name, and same first parameter for those
+// echoing it (SETSLOT: tn, RXTUNE/TXTUNE, SETTSC/SETBSIC).
+// Times are monotonic ns, used by the loop thread only.
+class TrxControl : extends Object {
+private:
+	enum class State { FREE, WAITING, SENT };
+	struct Entry {
+		State state = State::FREE;
+		TrxCommand cmd;
+		int param;
+		int level;
+		boolean required;
+		jlong seq;
+		jlong sentAt;
+		int tries;
+		int len;
+		char msg[TRXC_MAX];
+		TrxCallback cb;
+	};
+	Entry cmds[TRXC_PENDING];
+	int fd = -1;
+	int level = 0;      // level of commands submitted now
+	jlong seq = 0;
+
+	void send(Entry& e, jlong now);
+	void done(Entry& e, const TrxRsp& rsp);
+	void abortFrom(int level);
+	// sends the lowest waiting level when nothing below it is in flight
+	void advance(jlong now);
+	static boolean matches(const Entry& e, const TrxRsp& rsp);
+public:
+	jlong sent = 0, retransmits = 0, responses = 0;
+	jlong unmatched = 0, failures = 0;
+
+	void setFD(int fd) { this->fd = fd; }
+	// false when TRXC_PENDING commands wait already; optional (required=false) command
+	// failure doesn't stop later levels
+	boolean submit(TrxCommand cmd, int param, jlong now, TrxCallback cb = null, boolean required = true);
+	// commands submitted after wait for all submitted before
+	void barrier() { ++level; }
+	// false when RSP matches no command
+	boolean response(const TrxRsp& rsp, jlong now);
+	// retransmits or fails timed out commands; returns ns to next timeout, -1 none
+	jlong poll(jlong now);
+	// fails all with TRXC_ABORTED
+	void abort();
+	int pending() const;
+
+	// RSP status is error (SETFORMAT answers with version)
+	static boolean failed(const TrxRsp& rsp);
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include <lang/Exception.hpp>
+
+#include "TrxProtocol.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+namespace {
+const char *const names[] = {
+	"POWEROFF", "RXTUNE", "TXTUNE", "SETTSC", "SETBSIC", "POWERON", "SETRXGAIN", "SETPOWER", "SETSLOT",
+	"SETFORMAT",
+};
+const int COMMANDS = (int)(sizeof(names) / sizeof(names[0]));
+
+// appends decimal v at p, returns end
+char *putInt(char *p, int v) {
+	char tmp[12];
+	int n = 0;
+	unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+	do { tmp[n++] = (char)('0' + u % 10); u /= 10; } while (u);
+	if (v < 0) *p++ = '-';
+	while (n) *p++ = tmp[--n];
+	return p;
+}
+char *putStr(char *p, const char *s) {
+	while (*s) *p++ = *s++;
+	return p;
+}
+
+// cursor over message text, stops at len or 0
+struct Scanner {
+	const char *p, *end;
+	Scanner(const char *msg, int len) : p(msg), end(msg + len) {
+		const char *z = (const char *)memchr(msg, 0, (size_t)len);
+		if (z) end = z;
+	}
+	boolean word(const char *w) {
+		size_t l = strlen(w);
+		if ((size_t)(end - p) < l || memcmp(p, w, l)) return false;
+		if (p + l < end && p[l] != ' ') return false;
+		p += l;
+		return true;
+	}
+	boolean space() {
+		if (p >= end || *p != ' ') return false;
+		while (p < end && *p == ' ') ++p;
+		return true;
+	}
+	boolean number(int& v) {
+		boolean neg = p < end && *p == '-';
+		const char *s = neg ? p + 1 : p;
+		int digits = 0;
+		jlong r = 0;
+		while (s < end && *s >= '0' && *s <= '9') {
+			if (++digits > 10) return false;
+			r = r * 10 + (*s++ - '0');
+		}
+		if (digits == 0 || r > 0x7fffffffL) return false;
+		v = (int)(neg ? -r : r);
+		p = s;
+		return true;
+	}
+	boolean atEnd() {
+		while (p < end && (*p == ' ' || *p == '\n' || *p == '\r')) ++p;
+		return p == end;
+	}
+};
+}
+
+const char *TrxProtocol::name(TrxCommand cmd) {
+	int i = (int)cmd;
+	return i >= 0 && i < COMMANDS ? names[i] : "?";
+}
+
+int TrxProtocol::encodeCommand(char *buf, int cap, TrxCommand cmd, int param) {
+	// "CMD " + name + 2 params + 0
+	if (cap < 4 + 9 + 2*12 + 1) throw IllegalArgumentException(String::format("buffer too small %d", cap));
+	char *p = putStr(buf, "CMD ");
+	p = putStr(p, name(cmd));
+	switch (cmd) {
+	case TrxCommand::POWEROFF:
+	case TrxCommand::POWERON:
+		break;
+	case TrxCommand::SETSLOT:
+		*p++ = ' ';
+		p = putInt(p, (param >> 8) & 0xff);
+		*p++ = ' ';
+		p = putInt(p, param & 0xff);
+		break;
+	default:
+		*p++ = ' ';
+		p = putInt(p, param);
+		break;
+	}
+	*p++ = 0;
+	return (int)(p - buf);
+}
+
+boolean TrxProtocol::parseClock(const char *msg, int len, uint32_t& fn) {
+	Scanner s(msg, len);
+	int v;
+	if (!s.word("IND") || !s.space() || !s.word("CLOCK") || !s.space() || !s.number(v) || v < 0 || !s.atEnd()) return false;
+	fn = (uint32_t)v;
+	return true;
+}
+
+boolean TrxProtocol::parseResponse(const char *msg, int len, TrxRsp& rsp) {
+	Scanner s(msg, len);
+	if (!s.word("RSP") || !s.space()) return false;
+	int c = 0;
+	while (c < COMMANDS && !s.word(names[c])) ++c;
+	if (c == COMMANDS) return false;
+	rsp.cmd = (TrxCommand)c;
+	if (!s.space() || !s.number(rsp.status)) return false;
+	rsp.params = 0;
+	while (rsp.params < 2 && s.space()) {
+		if (!s.number(rsp.param[rsp.params])) break;
+		++rsp.params;
+	}
+	return s.atEnd();
+}
+
+// based on osmo-bts-trx/trx_if.c(462) trx_if_data
+int TrxProtocol::encodeBurst(uint8_t *buf, uint8_t tn, uint32_t fn, uint8_t gain, const uint8_t *bits, int n) {
+	if (tn > 7) throw IllegalArgumentException(String::format("TN=%d", tn));
+	if (n < 0 || n > TRXD_BITS) throw IllegalArgumentException(String::format("burst bits %d", n));
+	buf[0] = tn;
+	buf[1] = (uint8_t)(fn >> 24);
+	buf[2] = (uint8_t)(fn >> 16);
+	buf[3] = (uint8_t)(fn >> 8);
+	buf[4] = (uint8_t)fn;
+	buf[5] = gain;
+	memcpy(buf + 6, bits, (size_t)n);
+	memset(buf + 6 + n, 0, (size_t)(TRXD_BITS - n));
+	return TRXD_TX_SIZE;
+}
+
+boolean TrxProtocol::decodeBurst(const uint8_t *buf, int len, TrxdRx& rx) {
+	if (len != TRXD_RX_SIZE || buf[0] > 7) return false;
+	rx.tn = buf[0];
+	rx.fn = (uint32_t)buf[1] << 24 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 8 | buf[4];
+	rx.rssi = -(int)buf[5];
+	rx.toa = (int16_t)(buf[6] << 8 | buf[7]) / 256.0f;
+	const uint8_t *b = buf + 8;
+	for (int i = 0; i < TRXD_BITS; ++i) rx.soft[i] = (int8_t)(127 - b[i]);
+	return true;
+}
+
+int TrxProtocol::encodeUplink(uint8_t *buf, const TrxdRx& rx) {
+	buf[0] = (uint8_t)(rx.tn & 7);
+	buf[1] = (uint8_t)(rx.fn >> 24);
+	buf[2] = (uint8_t)(rx.fn >> 16);
+	buf[3] = (uint8_t)(rx.fn >> 8);
+	buf[4] = (uint8_t)rx.fn;
+	buf[5] = (uint8_t)-rx.rssi;
+	int toa = (int)(rx.toa * 256);
+	buf[6] = (uint8_t)(toa >> 8);
+	buf[7] = (uint8_t)toa;
+	for (int i = 0; i < TRXD_BITS; ++i) buf[8 + i] = (uint8_t)(127 - rx.soft[i]);
+	buf[8 + TRXD_BITS] = buf[9 + TRXD_BITS] = 0;
+	return TRXD_RX_SIZE;
+}
+
+boolean TrxdBatch::add(uint8_t tn, uint32_t fn, uint8_t gain, const uint8_t *bits, int n) {
+	if (txCount == TRXD_BATCH) return false;
+	TrxProtocol::encodeBurst(tx[txCount], tn, fn, gain, bits, n);
+	++txCount;
+	return true;
+}
+
+int TrxdBatch::flush(int fd) {
+	int n = txCount;
+	if (n == 0) return 0;
+	txCount = 0;
+	++sendCalls;
+	memset(msgs, 0, sizeof(msgs));
+	for (int i = 0; i < n; ++i) {
+		iov[i].iov_base = tx[i];
+		iov[i].iov_len = TRXD_TX_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int r = sendmmsg(fd, msgs, (unsigned)n, 0);
+	if (r != n && errors++ == 0) LOGE("TRXD sendmmsg %d of %d: %s", r, n, r < 0 ? strerror(errno) : "partial");
+	if (r < 0) return 0;
+	sent += r;
+	return r;
+}
+
+int TrxdBatch::receive(int fd) {
+	memset(msgs, 0, sizeof(msgs));
+	for (int i = 0; i < TRXD_BATCH; ++i) {
+		iov[i].iov_base = rx[i];
+		iov[i].iov_len = sizeof(rx[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	++recvCalls;
+	int r = recvmmsg(fd, msgs, TRXD_BATCH, MSG_DONTWAIT, null);
+	if (r < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errors++ == 0) LOGE("TRXD recvmmsg: %s", strerror(errno));
+		r = 0;
+	}
+	rxCount = r;
+	rxMsg = 0;
+	return r;
+}
+
+boolean TrxdBatch::next(TrxdRx& b) {
+	while (rxMsg < rxCount) {
+		int len = (int)msgs[rxMsg].msg_len;
+		const uint8_t *pdu = rx[rxMsg++];
+		if (TrxProtocol::decodeBurst(pdu, len, b)) {
+			++received;
+			return true;
+		}
+		if (errors++ == 0) LOGE("Wrong TRXD PDU length: %d or header: %02x", len, pdu[0]);
+	}
+	return false;
+}
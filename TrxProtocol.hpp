@@ -0,0 +1,90 @@
+#ifndef TRXPROTOCOL_HPP
+#define TRXPROTOCOL_HPP
+
+#include <lang/String.hpp>
+
+#include <sys/socket.h>
+
+#define TRXD_BITS     148  // bits of burst
+#define TRXD_TX_SIZE  154  // tn(1) fn(4) gain(1) hard bits
+#define TRXD_RX_SIZE  158  // tn(1) fn(4) rssi(1) toa(2) soft bits, padding(2)
+#define TRXD_BATCH      8  // bursts (datagrams) per syscall, one frame of all timeslots
+#define TRXC_MAX      128  // longest control message
+
+enum class TrxCommand {
+	POWEROFF,
+	RXTUNE,
+	TXTUNE,
+	SETTSC,
+	SETBSIC,
+	POWERON,
+	SETRXGAIN,
+	SETPOWER,
+	SETSLOT,
+	SETFORMAT, // TRXD header version, RSP status is version accepted
+};
+
+// uplink burst as received from transceiver
+struct TrxdRx {
+	uint8_t tn;
+	uint32_t fn;
+	int rssi;               // dBm
+	float toa;              // symbols
+	int8_t soft[TRXD_BITS]; // 127 - strong 1, -128 - strong 0
+};
+
+// "RSP <cmd> <status> [params]"
+struct TrxRsp {
+	TrxCommand cmd;
+	int status;             // 0 - ok
+	int params;             // count of values in param
+	int param[2];
+};
+
+// osmo-trx TRXC (text) and TRXD (binary) messages, in caller buffers without allocation.
+class TrxProtocol : extends Object {
+public:
+	static const char *name(TrxCommand cmd);
+
+	// "CMD <name> [param]" with terminating 0 in buf, returns length including the 0;
+	// SETSLOT param is (tn << 8) | slot type
+	static int encodeCommand(char *buf, int cap, TrxCommand cmd, int param);
+	// "IND CLOCK <fn>", msg may end with 0
+	static boolean parseClock(const char *msg, int len, uint32_t& fn);
+	static boolean parseResponse(const char *msg, int len, TrxRsp& rsp);
+
+	// n hard bits (0/1) of burst, padded to TRXD_BITS; returns TRXD_TX_SIZE
+	static int encodeBurst(uint8_t *buf, uint8_t tn, uint32_t fn, uint8_t gain, const uint8_t *bits, int n);
+	static boolean decodeBurst(const uint8_t *buf, int len, TrxdRx& rx);
+	// transceiver side of uplink, returns TRXD_RX_SIZE
+	static int encodeUplink(uint8_t *buf, const TrxdRx& rx);
+};
+
+// TRXD socket I/O in batches: bursts queued by add() leave with one sendmmsg,
+// receive() drains up to TRXD_BATCH datagrams with one recvmmsg.
+class TrxdBatch : extends Object {
+private:
+	uint8_t tx[TRXD_BATCH][TRXD_TX_SIZE];
+	int txCount = 0;
+	uint8_t rx[TRXD_BATCH][TRXD_RX_SIZE + 1]; // +1 detects oversized datagram
+	struct mmsghdr msgs[TRXD_BATCH];
+	struct iovec iov[TRXD_BATCH];
+	int rxCount = 0;                      // datagrams received
+	int rxMsg = 0;                        // next burst
+public:
+	jlong sendCalls = 0, sent = 0;        // syscalls, bursts
+	jlong recvCalls = 0, received = 0;
+	jlong errors = 0;                     // malformed PDUs, failed sends
+
+	// false when batch is full, flush() first
+	boolean add(uint8_t tn, uint32_t fn, uint8_t gain, const uint8_t *bits, int n);
+	int pending() const { return txCount; }
+	// returns bursts sent
+	int flush(int fd);
+	// datagrams read without blocking, 0 when none
+	int receive(int fd);
+	// next burst of received datagrams
+	boolean next(TrxdRx& rx);
+};
+
+#endif
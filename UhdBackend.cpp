@@ -0,0 +1,232 @@
+#include <lang/System.hpp>
+
+#include "UhdBackend.hpp"
+
+#include <uhd/usrp/multi_usrp.hpp>
+
+namespace {
+DeviceType parse_device_type(const String& board) {
+	if (board.equals("LimeSDR-USB")) return DeviceType::LIME_USB;
+	return DeviceType::Undef;
+}
+
+Array<String> toArray(const std::vector<std::string>& l) {
+	Array<String> a((int)l.size());
+	for (int i = 0; i < a.length; ++i) a[i] = l[i];
+	return a;
+}
+}
+
+class UHDdata {
+public:
+	uhd::usrp::multi_usrp::sptr usrp_dev;
+	uhd::rx_streamer::sptr rx_stream;
+	uhd::tx_streamer::sptr tx_stream;
+	std::vector<short *> rx_ptrs;
+	std::vector<const short *> tx_ptrs;
+};
+
+UhdBackend::~UhdBackend() {
+	if (uhd) { close(); delete uhd; }
+}
+
+boolean UhdBackend::open(const String& args) {
+	// Find UHD devices
+	uhd::device_addr_t addr(args.intern());
+	uhd::device_addrs_t dev_addrs = uhd::device::find(addr);
+	if (dev_addrs.size() == 0) {
+	    LOGE("No UHD devices found with address '%s'", args.cstr());
+	    return false;
+	}
+
+	if (!uhd) uhd = new UHDdata;
+	LOGD("Using discovered UHD device %s", dev_addrs[0].to_string().c_str());
+	try {
+	    uhd->usrp_dev = uhd::usrp::multi_usrp::make(addr);
+	} catch(...) {
+	    LOGE("UHD make failed, device '%s'", args.cstr());
+	    return false;
+	}
+
+	String board = uhd->usrp_dev->get_mboard_name();
+	devType = parse_device_type(board);
+	if (devType == DeviceType::Undef) {
+	    LOGE("Parse device type failed for '%s'", board.cstr());
+		return false;
+	}
+
+	if (devType == DeviceType::B2xx) chans = 2;
+	else if (devType == DeviceType::UMTRX) chans = 2;
+	else chans = 1;
+	uhd->rx_ptrs.resize(chans);
+	uhd->tx_ptrs.resize(chans);
+	return true;
+}
+
+String UhdBackend::name() const {
+	return String::format("%s", uhd->usrp_dev->get_mboard_name().c_str());
+}
+
+double UhdBackend::setMasterClock(double clock) {
+	uhd->usrp_dev->set_master_clock_rate(clock);
+	return uhd->usrp_dev->get_master_clock_rate();
+}
+double UhdBackend::getMasterClock() {
+	return uhd->usrp_dev->get_master_clock_rate();
+}
+double UhdBackend::setRxRate(double rate) {
+	uhd->usrp_dev->set_rx_rate(rate);
+	return rx_rate = uhd->usrp_dev->get_rx_rate();
+}
+double UhdBackend::setTxRate(double rate) {
+	uhd->usrp_dev->set_tx_rate(rate);
+	return tx_rate = uhd->usrp_dev->get_tx_rate();
+}
+void UhdBackend::setBandwidth(double bw, int chan, boolean tx) {
+	if (tx) uhd->usrp_dev->set_tx_bandwidth(bw, chan);
+	else uhd->usrp_dev->set_rx_bandwidth(bw, chan);
+}
+void UhdBackend::gainRange(int chan, boolean tx, double& min, double& max) {
+	uhd::gain_range_t range = tx ? uhd->usrp_dev->get_tx_gain_range(chan) : uhd->usrp_dev->get_rx_gain_range(chan);
+	min = range.start();
+	max = range.stop();
+}
+double UhdBackend::setGain(double gain, int chan, boolean tx) {
+	if (tx) {
+		uhd->usrp_dev->set_tx_gain(gain, chan);
+		return uhd->usrp_dev->get_tx_gain(chan);
+	}
+	uhd->usrp_dev->set_rx_gain(gain, chan);
+	return uhd->usrp_dev->get_rx_gain(chan);
+}
+void UhdBackend::setAntenna(const String& ant, int chan, boolean tx) {
+	if (tx) uhd->usrp_dev->set_tx_antenna(ant.intern(), chan);
+	else uhd->usrp_dev->set_rx_antenna(ant.intern(), chan);
+}
+
+TuneResult UhdBackend::tune(const TuneRequest& req, int chan, boolean tx, double at) {
+	uhd::tune_request_t treq = uhd::tune_request_t(req.freq, req.loOffset);
+	if (req.rf > 0) {
+		treq.rf_freq_policy = uhd::tune_request_t::POLICY_MANUAL;
+		treq.rf_freq = req.rf;
+	}
+	if (req.manualDsp) {
+		treq.dsp_freq_policy = uhd::tune_request_t::POLICY_MANUAL;
+		treq.dsp_freq = req.dsp;
+	}
+	if (at > 0) uhd->usrp_dev->set_command_time(uhd::time_spec_t(at));
+	uhd::tune_result_t res;
+	if (tx) res = uhd->usrp_dev->set_tx_freq(treq, chan);
+	else res = uhd->usrp_dev->set_rx_freq(treq, chan);
+	if (at > 0) uhd->usrp_dev->clear_command_time();
+	return {res.actual_rf_freq, res.target_dsp_freq};
+}
+
+double UhdBackend::getTime() {
+	return uhd->usrp_dev->get_time_now().get_real_secs();
+}
+void UhdBackend::setTime(double t) {
+	uhd->usrp_dev->set_time_now(uhd::time_spec_t(t));
+}
+Array<String> UhdBackend::clockSources() {
+	return toArray(uhd->usrp_dev->get_clock_sources(0));
+}
+Array<String> UhdBackend::timeSources() {
+	return toArray(uhd->usrp_dev->get_time_sources(0));
+}
+
+boolean UhdBackend::openStreams() {
+	uhd::stream_args_t stream_args;
+	if (devType == DeviceType::LIME_USB || devType == DeviceType::LIME_PCIE) {
+		stream_args = uhd::stream_args_t("sc12");
+		stream_args.args["latency"] = (devType == DeviceType::LIME_USB) ? "0.0" : "0.3";
+	}
+	else {
+		stream_args = uhd::stream_args_t("sc16");
+	}
+	//stream_args = uhd::stream_args_t("sc16"); //TODO check one setting for all
+	for (int i = 0; i < chans; i++)
+		stream_args.channels.push_back(i);
+
+	uhd->rx_stream = uhd->usrp_dev->get_rx_stream(stream_args);
+	uhd->tx_stream = uhd->usrp_dev->get_tx_stream(stream_args);
+
+	uhd::stream_cmd_t cmd = uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE;
+	cmd.num_samps = uhd->rx_stream->get_max_num_samps()*2;
+	cmd.stream_now = true;
+	uhd->usrp_dev->issue_stream_cmd(cmd);
+	return true;
+}
+
+void UhdBackend::close() {
+	if (!uhd->usrp_dev) return ;
+	uhd->usrp_dev->issue_stream_cmd(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS);
+	uhd->rx_stream.reset();
+	uhd->tx_stream.reset();
+	uhd->usrp_dev.reset();
+}
+
+int UhdBackend::maxPacket() {
+	return (int)uhd->rx_stream->get_max_num_samps();
+}
+
+void UhdBackend::startRx(double at) {
+	uhd::stream_cmd_t cmd = uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS;
+	cmd.stream_now = at <= 0;
+	cmd.time_spec = uhd::time_spec_t(at);
+	uhd->usrp_dev->issue_stream_cmd(cmd);
+}
+void UhdBackend::stopRx() {
+	uhd->usrp_dev->issue_stream_cmd(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS);
+}
+
+int UhdBackend::recv(short *const *bufs, int n, RxMeta& md, double timeout) {
+	uhd::rx_metadata_t m;
+	for (int i = 0; i < chans; ++i) uhd->rx_ptrs[i] = bufs[i];
+	int num_smpls = (int)uhd->rx_stream->recv(uhd->rx_ptrs, n, m, timeout, true);
+	md.hasTime = m.has_time_spec;
+	md.ts = m.has_time_spec ? m.time_spec.to_ticks(rx_rate) : 0;
+	switch (m.error_code) {
+	case uhd::rx_metadata_t::ERROR_CODE_NONE: md.error = RxError::NONE; break;
+	case uhd::rx_metadata_t::ERROR_CODE_TIMEOUT: md.error = RxError::TIMEOUT; break;
+	case uhd::rx_metadata_t::ERROR_CODE_OVERFLOW: md.error = RxError::OVERFLOW; break;
+	case uhd::rx_metadata_t::ERROR_CODE_LATE_COMMAND: md.error = RxError::LATE; break;
+	default:
+		md.error = RxError::OTHER;
+		LOGE("recv error = %s(%d)", m.strerror().c_str(), m.error_code);
+		break;
+	}
+	return num_smpls;
+}
+
+int UhdBackend::send(const short *const *bufs, int n, const TxMeta& md) {
+	uhd::tx_metadata_t m;
+	m.start_of_burst = md.startOfBurst;
+	m.end_of_burst = md.endOfBurst;
+	m.has_time_spec = md.hasTime;
+	if (md.hasTime) m.time_spec = uhd::time_spec_t::from_ticks(md.ts, tx_rate);
+	for (int i = 0; i < chans; ++i) uhd->tx_ptrs[i] = bufs[i];
+	return (int)uhd->tx_stream->send(uhd->tx_ptrs, n, m);
+}
+
+boolean UhdBackend::txEvent(TxEvent& ev) {
+	uhd::async_metadata_t md;
+	if (!uhd->tx_stream->recv_async_msg(md, 0.0)) return false;
+	switch (md.event_code) {
+	case uhd::async_metadata_t::EVENT_CODE_BURST_ACK:
+		ev = TxEvent::ACK;
+		break;
+	case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW:
+	case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW_IN_PACKET:
+		ev = TxEvent::UNDERFLOW;
+		break;
+	case uhd::async_metadata_t::EVENT_CODE_TIME_ERROR:
+		ev = TxEvent::TIME_ERROR;
+		break;
+	default:
+		ev = TxEvent::OTHER;
+		LOGE("tx async event %d", md.event_code);
+		break;
+	}
+	return true;
+}
@@ -0,0 +1,46 @@
+#ifndef UHDBACKEND_HPP
+#define UHDBACKEND_HPP
+
+#include "RadioBackend.hpp"
+
+// UHD driven SDR (USRP, LimeSDR), uhd headers are used only by UhdBackend.cpp
+class UHDdata;
+class UhdBackend : public RadioBackend {
+private:
+	UHDdata *uhd = null;
+	DeviceType devType = DeviceType::Undef;
+	int chans = 0;
+	double rx_rate = 0, tx_rate = 0; // stream rates
+public:
+	~UhdBackend();
+	boolean open(const String& args);
+
+	String name() const;
+	DeviceType type() const { return devType; }
+	int channels() const { return chans; }
+
+	double setMasterClock(double clock);
+	double getMasterClock();
+	double setRxRate(double rate);
+	double setTxRate(double rate);
+	void setBandwidth(double bw, int chan, boolean tx);
+	void gainRange(int chan, boolean tx, double& min, double& max);
+	double setGain(double gain, int chan, boolean tx);
+	void setAntenna(const String& ant, int chan, boolean tx);
+	TuneResult tune(const TuneRequest& req, int chan, boolean tx, double at);
+	double getTime();
+	void setTime(double t);
+	Array<String> clockSources();
+	Array<String> timeSources();
+
+	boolean openStreams();
+	void close();
+	int maxPacket();
+	void startRx(double at);
+	void stopRx();
+	int recv(short *const *bufs, int n, RxMeta& md, double timeout);
+	int send(const short *const *bufs, int n, const TxMeta& md);
+	boolean txEvent(TxEvent& ev);
+};
+
+#endif
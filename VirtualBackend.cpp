@@ -0,0 +1,278 @@
+#include <lang/System.hpp>
+
+#include "VirtualBackend.hpp"
+#include "GsmClock.hpp"
+
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RX_BUFFER_TIME 0.1 // samples kept by "device" for slow consumer
+
+namespace {
+void sleepSec(double s) {
+	if (s > 0) std::this_thread::sleep_for(std::chrono::microseconds((long)(s * 1e6)));
+}
+}
+
+String VirtualBackend::option(const String& args, const char *key, const char *def) {
+	std::string s = args.intern();
+	size_t kl = strlen(key);
+	for (size_t i = 0; i < s.size(); ) {
+		size_t e = s.find(',', i);
+		if (e == std::string::npos) e = s.size();
+		if (s.compare(i, kl, key) == 0) {
+			if (i + kl == e) return "1"; // flag without value
+			if (s[i + kl] == '=') return s.substr(i + kl + 1, e - i - kl - 1);
+		}
+		i = e + 1;
+	}
+	return def;
+}
+
+boolean VirtualBackend::open(const String& args) {
+	throttle = option(args, "throttle", "1").equals("1");
+	setTime(0);
+	return parse(args);
+}
+
+double VirtualBackend::wallTime() {
+	using namespace std::chrono;
+	return (double)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count() * 1e-6;
+}
+jlong VirtualBackend::nowTick() const {
+	return (jlong)llround(clockTime() * rate);
+}
+
+double VirtualBackend::getTime() {
+	if (throttle) return clockTime();
+	return rate > 0 ? (double)pos.load() / rate : timeBase;
+}
+void VirtualBackend::setTime(double t) {
+	wallBase = wallTime();
+	timeBase = t;
+	pos = (jlong)llround(t * rate);
+}
+
+double VirtualBackend::setRxRate(double r) {
+	double t = getTime();
+	std::lock_guard<std::mutex> lk(lock);
+	tunes.clear(); // ticks of old rate
+	rate = r;
+	pos = (jlong)llround(t * rate);
+	if (!throttle) timeBase = t;
+	return rate;
+}
+
+TuneResult VirtualBackend::tune(const TuneRequest& req, int chan, boolean tx, double at) {
+	// same convention as UHD rx: tuned = rf - dsp
+	double rf = req.rf > 0 ? req.rf : req.freq + req.loOffset;
+	double dsp = req.manualDsp ? req.dsp : rf - req.freq;
+	if (tx) return {rf, dsp};
+	std::lock_guard<std::mutex> lk(lock);
+	if (at > 0) {
+		// late command runs at once, as on hardware
+		Tune t = {(jlong)llround(at * rate), rf - dsp};
+		auto it = tunes.begin();
+		while (it != tunes.end() && it->at <= t.at) ++it;
+		tunes.insert(it, t);
+	}
+	else freq = rf - dsp;
+	return {rf, dsp};
+}
+
+Array<String> VirtualBackend::clockSources() {
+	Array<String> a(1);
+	a[0] = "internal";
+	return a;
+}
+Array<String> VirtualBackend::timeSources() {
+	Array<String> a(1);
+	a[0] = "none";
+	return a;
+}
+
+void VirtualBackend::startRx(double at) {
+	jlong start = at > 0 ? (jlong)llround(at * rate) : 0;
+	if (throttle && start < nowTick()) start = nowTick();
+	if (pos < start) pos = start;
+	running = true;
+}
+
+int VirtualBackend::recv(short *const *bufs, int n, RxMeta& md, double timeout) {
+	md.hasTime = false;
+	md.ts = 0;
+	if (!running || rate <= 0) {
+		sleepSec(timeout);
+		md.error = RxError::TIMEOUT;
+		return 0;
+	}
+	jlong p = resync(pos);
+	pos = p;
+	if (throttle) {
+		jlong now = nowTick();
+		if (now - p > (jlong)(RX_BUFFER_TIME * rate)) {
+			// consumer too slow, device buffer lost
+			pos = now;
+			md.error = RxError::OVERFLOW;
+			return 0;
+		}
+		double wait = (double)(p + n - now) / rate;
+		if (wait > timeout) {
+			sleepSec(timeout);
+			md.error = RxError::TIMEOUT;
+			return 0;
+		}
+		sleepSec(wait);
+	}
+
+	// split the packet at timed tunes
+	int done = 0;
+	while (done < n) {
+		int l = n - done;
+		double f;
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			jlong t = p + done;
+			while (!tunes.empty() && tunes.front().at <= t) {
+				freq = tunes.front().freq;
+				tunes.erase(tunes.begin());
+			}
+			if (!tunes.empty() && tunes.front().at < t + l) l = (int)(tunes.front().at - t);
+			f = freq;
+		}
+		int m = produce(bufs[0] + 2*done, l, p + done, f);
+		done += m;
+		// end of data or gap in it
+		if (m < l || resync(p + done) != p + done) break;
+	}
+	pos = p + done;
+	if (done == 0) {
+		// end of data
+		sleepSec(timeout);
+		md.error = RxError::TIMEOUT;
+		return 0;
+	}
+	md.error = RxError::NONE;
+	md.hasTime = true;
+	md.ts = p;
+	return done;
+}
+
+FileBackend::~FileBackend() {
+	if (data) munmap((void *)data, (size_t)size * 2*sizeof(short));
+}
+
+// rate and blocks from IqRecorder sidecar, contiguous blocks are merged
+boolean FileBackend::readMeta(const String& mpath) {
+	FILE *f = fopen(mpath.cstr(), "r");
+	if (f == null) return false;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		double r, fr;
+		long long off, tick, len;
+		if (sscanf(line, "rate %lf", &r) == 1) fileRate = r;
+		else if (sscanf(line, "tune %lld %lf", &tick, &fr) == 2) LOGD("IQ file: tuned to %.3lf MHz at %lld", fr/1e6, tick);
+		else if (sscanf(line, "blk %lld %lld %lld", &off, &tick, &len) == 3) {
+			if (!segs.empty()) {
+				Segment& l = segs.back();
+				if (l.off + l.len == off && l.tick + l.len == tick) { l.len += len; continue; }
+			}
+			segs.push_back({off, tick, len});
+		}
+	}
+	fclose(f);
+	LOGD("IQ file sidecar '%s': %d segments", mpath.cstr(), (int)segs.size());
+	return true;
+}
+
+boolean FileBackend::parse(const String& args) {
+	path = option(args, "file", "");
+	readMeta(String::format("%s.meta", path.cstr()));
+	double sps = atof(option(args, "sps", "0").cstr());
+	if (sps > 0) fileRate = GSM_SYMBOL_RATE * sps;
+	else if (fileRate <= 0) fileRate = atof(option(args, "rate", "0").cstr());
+	loop = option(args, "loop", "1").equals("1");
+	if (fileRate <= 0) {
+		LOGE("IQ file '%s': rate= or sps= required", path.cstr());
+		return false;
+	}
+	int fd = ::open(path.cstr(), O_RDONLY);
+	if (fd < 0) {
+		LOGE("Can't open IQ file '%s': %s", path.cstr(), strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0) size = (jlong)st.st_size / (jlong)(2*sizeof(short));
+	if (size > 0) {
+		void *p = mmap(null, (size_t)size * 2*sizeof(short), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			madvise(p, (size_t)size * 2*sizeof(short), MADV_SEQUENTIAL);
+			data = (const short *)p;
+		}
+	}
+	::close(fd);
+	if (data == null) {
+		LOGE("Can't map IQ file '%s' (%ld samples)", path.cstr(), size);
+		size = 0;
+		return false;
+	}
+	// blocks past end of file (recording not closed) are cut
+	for (size_t i = 0; i < segs.size(); ++i) {
+		if (segs[i].off + segs[i].len > size) segs[i].len = segs[i].off < size ? size - segs[i].off : 0;
+		if (segs[i].len <= 0) { segs.resize(i); break; }
+	}
+	if (segs.empty()) segs.push_back({0, 0, size});
+	LOGD("IQ file '%s': %ld samples at %.3lf MHz%s", path.cstr(), size, fileRate/1e6, loop ? ", loop" : "");
+	return true;
+}
+
+void FileBackend::nextSegment() {
+	segPos = 0;
+	if (++seg < (int)segs.size()) {
+		// keep the recorded gap
+		jlong t = segs[seg].tick + shift;
+		if (t > nextTick) nextTick = t;
+		shift = nextTick - segs[seg].tick;
+		return ;
+	}
+	seg = 0;
+	if (!loop) eof = true;
+	// next loop continues without gap
+	shift = nextTick - segs[0].tick;
+}
+
+// first sample plays at the first tick streamed, ticks skipped by the stream skip samples
+jlong FileBackend::resync(jlong pos) {
+	if (nextTick < 0) {
+		nextTick = pos;
+		shift = pos - segs[0].tick;
+	}
+	while (pos > nextTick && !eof) {
+		jlong l = segs[seg].len - segPos;
+		if (l > pos - nextTick) l = pos - nextTick;
+		segPos += l;
+		nextTick += l;
+		if (segPos == segs[seg].len) nextSegment();
+	}
+	return pos > nextTick ? pos : nextTick;
+}
+
+// samples up to end of segment, the next recv starts after the gap
+int FileBackend::produce(short *out, int n, jlong ts, double freq) {
+	if (eof) return 0;
+	const Segment& s = segs[seg];
+	if (n > s.len - segPos) n = (int)(s.len - segPos);
+	memcpy(out, data + 2*(s.off + segPos), (size_t)n * 2*sizeof(short));
+	segPos += n;
+	nextTick += n;
+	if (segPos == s.len) nextSegment();
+	return n;
+}
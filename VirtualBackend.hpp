@@ -0,0 +1,110 @@
+#ifndef VIRTUALBACKEND_HPP
+#define VIRTUALBACKEND_HPP
+
+#include "RadioBackend.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Single channel backend without hardware, samples come from produce().
+// Device time is the stream position, with throttle=1 it follows the wall clock
+// (recv waits for samples to "arrive", a slow consumer gets overflows).
+// tx samples are discarded.
+class VirtualBackend : public RadioBackend {
+private:
+	struct Tune {
+		jlong at;     // stream tick
+		double freq;
+	};
+	std::mutex lock;          // guards tunes and freq
+	std::vector<Tune> tunes;  // pending timed tunes, ordered by tick
+	double freq = 0;          // rx frequency in effect at pos
+
+	double clock = 0;
+	double txRate = 0;
+	boolean throttle = true;
+	std::atomic<boolean> running{false};
+	double wallBase = 0;      // wall clock (s) at timeBase
+	double timeBase = 0;      // device time at wallBase
+	std::atomic<jlong> pos{0}; // tick of next rx sample
+
+	static double wallTime();
+	double clockTime() const { return timeBase + wallTime() - wallBase; }
+	jlong nowTick() const;
+protected:
+	double rate = 0;          // rx stream rate
+
+	// value of key in "key=value,..." args, def if missing
+	static String option(const String& args, const char *key, const char *def);
+	virtual boolean parse(const String& args) { return true; }
+	// tick of next sample when the stream is at pos, later than pos after a gap in data
+	virtual jlong resync(jlong pos) { return pos; }
+	// n samples starting at tick ts, rx tuned to freq; returns samples made, 0 at end of data
+	virtual int produce(short *out, int n, jlong ts, double freq) = 0;
+public:
+	boolean open(const String& args);
+	int channels() const { return 1; }
+
+	double setMasterClock(double c) { return clock = c; }
+	double getMasterClock() { return clock; }
+	double setRxRate(double r);
+	double setTxRate(double r) { return txRate = r; }
+	void setBandwidth(double bw, int chan, boolean tx) {}
+	void gainRange(int chan, boolean tx, double& min, double& max) { min = 0; max = 60; }
+	double setGain(double gain, int chan, boolean tx) { return gain; }
+	void setAntenna(const String& ant, int chan, boolean tx) {}
+	TuneResult tune(const TuneRequest& req, int chan, boolean tx, double at);
+	double getTime();
+	void setTime(double t);
+	Array<String> clockSources();
+	Array<String> timeSources();
+
+	boolean openStreams() { return true; }
+	void close() { running = false; }
+	int maxPacket() { return 2048; }
+	void startRx(double at);
+	void stopRx() { running = false; }
+	int recv(short *const *bufs, int n, RxMeta& md, double timeout);
+	int send(const short *const *bufs, int n, const TxMeta& md) { return n; }
+	boolean txEvent(TxEvent& ev) { return false; }
+};
+
+// Replay of sc16 I/Q file recorded at fixed rate, RadioDevice resamples it as needed.
+// args: file=<path>,rate=<Hz>|sps=<n>,loop=0|1,throttle=0|1
+// Sidecar <path>.meta written by IqRecorder gives the rate and gaps between blocks,
+// the first sample plays at the stream start and gaps are kept.
+// Tuning is accepted but doesn't change the recorded signal.
+class FileBackend : public VirtualBackend {
+private:
+	struct Segment {
+		jlong off;  // file sample
+		jlong tick; // as recorded
+		jlong len;
+	};
+	String path;
+	const short *data = null; // mmaped file
+	jlong size = 0;           // samples
+	double fileRate = 0;
+	boolean loop = true;
+	std::vector<Segment> segs; // contiguous parts of the file, whole file without sidecar
+	int seg = 0;              // segment being played
+	jlong segPos = 0;         // samples of segment played
+	jlong shift = 0;          // stream tick - recorded tick
+	jlong nextTick = -1;      // stream tick of next sample (-1 not started)
+	boolean eof = false;
+
+	boolean readMeta(const String& mpath);
+	void nextSegment();
+protected:
+	boolean parse(const String& args);
+	jlong resync(jlong pos);
+	int produce(short *out, int n, jlong ts, double freq);
+public:
+	~FileBackend();
+	String name() const { return String::format("file %s", path.cstr()); }
+	DeviceType type() const { return DeviceType::IQFILE; }
+	double setRxRate(double r) { return VirtualBackend::setRxRate(fileRate); }
+};
+
+#endif
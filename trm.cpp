@@ -1,6 +1,23 @@
+#include <lang/Math.hpp>
+
 #include "MobileStation.hpp"
 #include "RadioDevice.hpp"
+#include "SampleConvert.hpp"
+#include "Channelizer.hpp"
+#include "PowerScan.hpp"
+#include "FcchDetector.hpp"
+#include "GsmSync.hpp"
+#include "BurstSlicer.hpp"
+#include "GmskDemod.hpp"
+#include "ChannelDecoder.hpp"
+#include "Resampler.hpp"
+#include "Hopping.hpp"
+#include "RadioBackend.hpp"
+#include "IqRecorder.hpp"
 
+#include <atomic>
+#include <cmath>
+#include <thread>
 
 #define GSMRATE (1625000.0 / 6.0)
 #define SAMPLE_BUF_SZ    (1<<20)
@@ -11,6 +28,7 @@ jlong writeTimestamp = 0;
 int writeBuffer(SampleBuffer& b) {
 	int segmentLen = 100; // =sendBuffer[0]->getSegmentLen();
 	short segment[2*segmentLen];
+	memset(segment, 0, sizeof(segment));
 
 	int r = b.write(segment, segmentLen, writeTimestamp);
 	LOGD("Wrote segment len=%d = %d, b = %s", segmentLen, r, b.toString().cstr());
@@ -54,8 +72,877 @@ void simpleReadWrite() {
 	}
 }
 
+namespace {
+short samplePattern(jlong t, int iq) {
+	return (short)(iq ? (t >> 7) ^ 0x5a5a : t);
+}
+
+// tx side writes only where no unsent sample gets dropped
+void bufferSpace() {
+	const int cap = 1024;
+	SampleBuffer b(cap, GSMRATE, false);
+	short pkt[2*100];
+	memset(pkt, 0, sizeof(pkt));
+	int errors = 0;
+	if (b.space(5000) != cap) ++errors; // empty, anywhere
+	if (b.write(pkt, 100, 1000) != 100) ++errors;
+	if (b.space(999) != -1 || b.space(1000) != cap || b.space(1500) != cap - 500 || b.space(1000 + cap) != 0) ++errors;
+	int n = 50;
+	b.peek(1000, n);
+	b.consume(n);
+	if (b.space(1500) != cap - 450) ++errors;
+	if (errors) LOGE("bufferSpace FAILED errors=%d b = %s", errors, b.toString().cstr());
+}
+
+// sendBurst keeps off samples txLoop has taken for sending, also when tx_buffer is empty
+void sendBurstBusy() {
+	RadioDevice dev(4, 4);
+	if (!dev.open("synth,throttle=1")) {
+		LOGE("sendBurstBusy: no synth device");
+		return ;
+	}
+	SpscSampleBuffer& rxb = dev.getRxBuffer(0);
+	const int len = 625, frame = 1250*4; // bursts leave a frame ahead
+	short burst[2*len];
+	memset(burst, 0, sizeof(burst));
+	const short *bufs[1] = {burst};
+	int errors = 0;
+	// tx time follows rx stream, keep it running and let it settle after start
+	jlong tmo = System.currentTimeMillis() + 100;
+	while (System.currentTimeMillis() < tmo) {
+		rxb.release(rxb.last());
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	// retried when the loaded machine made it late
+	jlong ts = 0;
+	for (int tries = 0; tries < 3 && dev.getTxStats().bursts == 0; ++tries) {
+		ts = rxb.last() + 4*frame;
+		long late = dev.getTxStats().late;
+		if (!dev.sendBurst(bufs, len, ts)) ++errors;
+		tmo = System.currentTimeMillis() + 1000;
+		while (dev.getTxStats().bursts == 0 && dev.getTxStats().late == late && System.currentTimeMillis() < tmo) {
+			rxb.release(rxb.last());
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+	// sent and consumed, tx_buffer is empty: overlapping the sent samples is refused,
+	// right after them is fine
+	if (dev.getTxStats().bursts != 1 || dev.sendBurst(bufs, len, ts + len/2) || dev.getTxStats().rejected != 1) ++errors;
+	if (!dev.sendBurst(bufs, len, ts + len)) ++errors;
+	dev.close();
+	LOGN("sendBurstBusy: tx %s, errors=%d", dev.getTxStats().toString().cstr(), errors);
+	if (errors) LOGE("sendBurstBusy FAILED");
+}
+
+// MSK with GSM differential encoding, amplitude 0.5; prev - last bit sent
+void mskModulate(const uint8_t *bits, int n, int sps, double& ph, uint8_t& prev, float *out) {
+	for (int k = 0; k < n; ++k) {
+		double step = (bits[k] ^ prev) ? -M_PI/2 : M_PI/2;
+		prev = bits[k];
+		for (int i = 0; i < sps; ++i, out += 2) {
+			ph += step/sps;
+			out[0] = (float)(0.5*cos(ph));
+			out[1] = (float)(0.5*sin(ph));
+		}
+	}
+}
+}
+// producer and consumer of SpscSampleBuffer running on separate threads
+void spscReadWrite(boolean mirror) {
+	double rx_rate = GSMRATE * 4;
+	int buf_len = SAMPLE_BUF_SZ / sizeof(uint32_t);
+	const jlong t0 = 1000;
+	const jlong total = 20000000; // samples
+	const int maxPkt = 3*625;
+
+	SpscSampleBuffer b(buf_len, rx_rate, mirror);
+	jlong tm = System.currentTimeMillis();
+
+	std::thread producer([&b, t0, total, maxPkt]() {
+		short pkt[2*maxPkt];
+		jlong t = t0;
+		for (int k = 0; t < t0 + total; ++k) {
+			int l = 1 + (k*7919) % maxPkt;
+			for (int i = 0; i < l; ++i) {
+				pkt[2*i] = samplePattern(t+i, 0);
+				pkt[2*i+1] = samplePattern(t+i, 1);
+			}
+			while (b.space() < l) std::this_thread::yield();
+			if (k & 1) {
+				// zero-copy write
+				for (int done = 0; done < l; ) {
+					int n = l - done;
+					short *p = b.reserve(n, t + done);
+					memcpy(p, pkt + 2*done, n*2*sizeof(short));
+					b.commit(n);
+					done += n;
+				}
+				t += l;
+				continue;
+			}
+			int r = b.write(pkt, l, t);
+			if (r != l) {
+				LOGE("can't write packet r=%d l=%d", r, l);
+				return ;
+			}
+			t += r;
+		}
+	});
+
+	short seg[2*maxPkt];
+	jlong t = t0;
+	long errors = 0;
+	for (int k = 0; t < t0 + total; ++k) {
+		int l = 1 + (k*104729) % maxPkt;
+		int r;
+		if (k & 1) {
+			// zero-copy read
+			r = l;
+			const short *p = b.peek(t, r);
+			if (r > 0) {
+				memcpy(seg, p, r*2*sizeof(short));
+				b.consume(r);
+			}
+		}
+		else r = b.read(seg, l, t);
+		if (r < 0) {
+			LOGE("read in the past t=%ld b = %s", t, b.toString().cstr());
+			break;
+		}
+		if (r == 0) { std::this_thread::yield(); continue; }
+		for (int i = 0; i < r; ++i) {
+			if (seg[2*i] != samplePattern(t+i, 0) || seg[2*i+1] != samplePattern(t+i, 1)) ++errors;
+		}
+		t += r;
+	}
+	producer.join();
+	tm = System.currentTimeMillis() - tm;
+
+	LOGN("spsc%s: %ld samples in %ld ms, errors=%ld dropped=%ld", mirror ? "(mirrored)" : "", t - t0, tm, errors, b.overflows());
+	if (errors || b.overflows() || t < t0 + total) LOGE("spscReadWrite FAILED b = %s", b.toString().cstr());
+}
+
+// consumer idle for longer than the ring between captures, producer runs at device pace
+// and drops samples while the ring is full
+void captureIdle() {
+	const int cap = 1<<14, pkt = 625;
+	SpscSampleBuffer b(cap, GSMRATE, false);
+	std::atomic<jlong> now(0); // device time
+	std::atomic<boolean> running(true);
+	std::thread producer([&b, &now, &running, pkt]() {
+		short p[2*pkt];
+		memset(p, 0, sizeof(p));
+		for (jlong t = 0; running; t += pkt) {
+			b.write(p, pkt, t);
+			now = t + pkt;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	});
+
+	Array<float> x(2*pkt);
+	int errors = 0;
+	for (int k = 0; k < 4; ++k) {
+		// latest samples, whatever is still there
+		jlong t = b.last();
+		if (!MobileStation::capture(b, t, &x[0], pkt, true)) ++errors;
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+		// exact position ahead of device time, like settled samples after a retune
+		t = now + cap/2;
+		if (!MobileStation::capture(b, t, &x[0], pkt)) ++errors;
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	}
+	running = false;
+	producer.join();
+	LOGN("captureIdle: errors=%d dropped=%ld", errors, b.overflows());
+	if (errors || b.overflows() == 0) LOGE("captureIdle FAILED b = %s", b.toString().cstr());
+}
+
+// samples/s of each conversion kernel, results checked against scalar one
+void convertBenchmark() {
+	const int len = 2*(1<<16); // values (I/Q interleaved)
+	const int loops = 200;
+	Array<short> in(len), out(len), ref(len);
+	Array<float> f(len), fref(len);
+	for (int i = 0; i < len; ++i) in[i] = (short)((i*7919) ^ (i>>3));
+
+	const ConvertKernels& scalar = convertKernels(0);
+	scalar.toFloatIQ(&fref[0], &in[0], 1.0f/32768, 0.9f/32768, len/2);
+	scalar.toShortIQ(&ref[0], &fref[0], 32768, 30000, len/2);
+
+	for (int k = 0; k < convertKernelsCount(); ++k) {
+		const ConvertKernels& c = convertKernels(k);
+		if (!c.supported()) continue;
+
+		jlong tm = System.currentTimeMillis();
+		for (int l = 0; l < loops; ++l) c.toFloat(&f[0], &in[0], 1.0f/32768, len);
+		jlong t1 = System.currentTimeMillis() - tm;
+		tm = System.currentTimeMillis();
+		for (int l = 0; l < loops; ++l) c.toShort(&out[0], &f[0], 32768, len);
+		jlong t2 = System.currentTimeMillis() - tm;
+		tm = System.currentTimeMillis();
+		for (int l = 0; l < loops; ++l) {
+			c.toFloatIQ(&f[0], &in[0], 1.0f/32768, 0.9f/32768, len/2);
+			c.toShortIQ(&out[0], &f[0], 32768, 30000, len/2);
+		}
+		jlong t3 = System.currentTimeMillis() - tm;
+
+		int errors = 0;
+		for (int i = 0; i < len; ++i) {
+			int d = out[i] - ref[i];
+			if (f[i] != fref[i] || d < -1 || d > 1) ++errors;
+		}
+		double smpls = (double)loops * len / 2 / 1e3; // ksamples
+		LOGN("convert %-6s toFloat %.1f Ms/s, toShort %.1f Ms/s, IQ round trip %.1f Ms/s, errors=%d", c.name,
+			smpls / (double)(t1 + 1), smpls / (double)(t2 + 1), smpls / (double)(t3 + 1), errors);
+	}
+}
+
+// FCCH tone through device->GSM rate conversion fed in odd chunks, output checked against
+// the tone at exact output ticks, speed relative to real time
+void resampleTone(double inRate, double outRate) {
+	const double freq = GSMRATE/4, amp = 16000; // FCCH tone
+	const int n = 1<<18;
+	int P, Q;
+	if (!Resampler::ratio(inRate, outRate, P, Q)) {
+		LOGE("resample %.0f -> %.0f: no ratio", inRate, outRate);
+		return ;
+	}
+	Resampler rs(P, Q);
+	Array<short> in(2*n), out(2*rs.maxOutput(n));
+	const jlong t0 = 1000003;
+	for (int i = 0; i < n; ++i) {
+		double ph = 2*M_PI*freq*(double)(t0 + i)/inRate;
+		in[2*i] = (short)lround(amp*cos(ph)); in[2*i+1] = (short)lround(amp*sin(ph));
+	}
+	uint32_t rnd = 12345;
+	int errors = 0, done = 0;
+	jlong next = rs.toOutput(t0);
+	double maxErr = 0;
+	while (done < n) {
+		rnd ^= rnd<<13; rnd ^= rnd>>17; rnd ^= rnd<<5;
+		int l = std::min(n - done, (int)(rnd % 3000) + 1);
+		int m = rs.process(&in[2*done], l, t0 + done, &out[0]);
+		if (m > 0 && rs.outTime() != next) ++errors;
+		for (int k = 0; k < m; ++k) {
+			jlong t = rs.outTime() + k;
+			if (t < next + rs.tapsPerPhase()) continue; // filter startup
+			double ph = 2*M_PI*freq*(double)t/outRate;
+			double e = hypot(out[2*k] - amp*cos(ph), out[2*k+1] - amp*sin(ph)) / amp;
+			if (e > maxErr) maxErr = e;
+		}
+		if (m > 0) next = rs.outTime() + m;
+		done += l;
+	}
+	if (maxErr > 0.01) ++errors;
+
+	const int loops = 20;
+	jlong tm = System.currentTimeMillis();
+	for (int l = 0; l < loops; ++l) rs.process(&in[0], n, t0 + (jlong)l*n, &out[0]);
+	tm = System.currentTimeMillis() - tm;
+	LOGN("resample %d/%d (%d taps) %s: max error %.4f, %.0fx real time, errors=%d", P, Q, rs.tapsPerPhase(),
+		Resampler::kernel(), maxErr, (double)loops * n / inRate * 1e3 / (double)(tm + 1), errors);
+}
+
+// tones at channel centers must land in their own channel only
+void channelizerTones() {
+	const int M = 32, frames = 256, n = M*frames;
+	const int tones[] = {3, 29}; // +3 and -3 channels
+	Array<float> x(2*n), y(2*n);
+	for (int i = 0; i < n; ++i) {
+		double re = 0, im = 0;
+		for (int k : tones) {
+			double ph = 2*M_PI*k*i/M;
+			re += 0.5*cos(ph); im += 0.5*sin(ph);
+		}
+		x[2*i] = (float)re; x[2*i+1] = (float)im;
+	}
+	Channelizer chz(M);
+	chz.process(&x[0], n, &y[0]);
+	Array<double> pwr(M);
+	for (int k = 0; k < M; ++k) pwr[k] = 0;
+	for (int m = 16; m < frames; ++m)
+		for (int k = 0; k < M; ++k) pwr[k] += y[2*(m*M+k)]*y[2*(m*M+k)] + y[2*(m*M+k)+1]*y[2*(m*M+k)+1];
+	int errors = 0;
+	for (int k = 0; k < M; ++k) {
+		double db = 10*log10(pwr[k]/(frames-16) + 1e-20);
+		boolean tone = k == tones[0] || k == tones[1];
+		if (tone ? fabs(db + 6) > 0.5 : db > -50) {
+			LOGE("channel %d: %.1f dB", k, db);
+			++errors;
+		}
+	}
+	LOGN("channelizer: errors=%d", errors);
+}
+
+// tone at +400kHz in 6.4MHz capture, speed relative to real time
+void powerScanBenchmark() {
+	const double rate = 6.4e6;
+	const int n = 1<<16;
+	const int loops = 100;
+	Array<float> x(2*n);
+	for (int i = 0; i < n; ++i) {
+		double ph = 2*M_PI*400e3*i/rate;
+		x[2*i] = (float)(0.5*cos(ph)); x[2*i+1] = (float)(0.5*sin(ph));
+	}
+	PowerScan ps(rate);
+	jlong tm = System.currentTimeMillis();
+	for (int l = 0; l < loops; ++l) ps.process(&x[0], n);
+	tm = System.currentTimeMillis() - tm;
+	float on = ps.power(400e3), off = ps.power(-400e3), adj = ps.power(200e3);
+	int errors = 0;
+	if (fabs(on + 6.0f) > 0.5f) ++errors;
+	if (off > -60.0f || adj > -40.0f) ++errors;
+	LOGN("powerscan: %.1f dBFS, adjacent %.1f dBFS, image %.1f dBFS, %.0fx real time, errors=%d",
+		on, adj, off, (double)loops * n / rate * 1e3 / (double)(tm + 1), errors);
+}
+
+// MSK-like random data with one FCCH burst (+1kHz offset), fed in odd sized chunks
+void fcchDetect() {
+	const int sps = 4;
+	const double rate = GSMRATE * sps;
+	const int nsym = 1<<15, n = nsym*sps;
+	const int fcch = 10000, offs = 3; // burst start symbol, sample offset
+	const int loops = 20;
+	Array<float> x(2*n);
+	unsigned rnd = 1;
+	double ph = 0;
+	for (int k = 0; k < nsym; ++k) {
+		rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+		double step = (k >= fcch && k < fcch + 148) || (rnd >> 16 & 1) ? M_PI/2 : -M_PI/2;
+		for (int i = 0; i < sps; ++i) {
+			int j = k*sps + i + offs;
+			if (j >= n) break;
+			double a = ph + 2*M_PI*1000*j/rate;
+			rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+			float noise = (float)((int)(rnd >> 16 & 0xff) - 128) / 2048;
+			x[2*j] = (float)(0.5*cos(a)) + noise;
+			x[2*j+1] = (float)(0.5*sin(a)) - noise;
+			ph += step/sps;
+		}
+	}
+	for (int j = 0; j < offs; ++j) x[2*j] = x[2*j+1] = 0;
+
+	FcchDetector det(rate, sps);
+	FcchBurst fb[4];
+	int found = 0, errors = 0;
+	jlong ts = 0;
+	jlong tm = System.currentTimeMillis();
+	for (int l = 0; l < loops; ++l) {
+		for (int i = 0; i < n; ) {
+			int len = std::min(977, n - i);
+			int c = det.process(&x[2*i], len, ts + i, fb, 4);
+			for (int k = 0; k < c; ++k) {
+				jlong exp = (jlong)l*n + fcch*sps + offs;
+				if (Math::abs(fb[k].ts - exp) > 2*sps || Math::abs(fb[k].freq - 1000.0f) > 300.0f) {
+					LOGE("fcch at %ld (expected %ld), offset %.0f Hz, q=%.2f", fb[k].ts, exp, fb[k].freq, fb[k].quality);
+					++errors;
+				}
+			}
+			found += c;
+			i += len;
+		}
+		ts += n;
+	}
+	tm = System.currentTimeMillis() - tm;
+	if (found != loops) ++errors;
+	LOGN("fcch(%s): found %d/%d, %.0fx real time, errors=%d", FcchDetector::kernel(), found, loops,
+		(double)loops * n / rate * 1e3 / (double)(tm + 1), errors);
+}
+
+// SCH burst between random bursts, decoded BSIC/FN and clock mapping incl. FN wrap
+void schSync() {
+	const int sps = 4;
+	const int fns[] = {1, 1326*7 + 51*3 + 21, FRAME_MODULUS - 51 + 41};
+	int errors = 0;
+	// SB info octets as osmo-bts passes them to gsm0503_sch_encode, sent lsb first:
+	// BSIC 43, T1 931, T2 10, T3' 1 (FN 1234568)
+	const uint8_t sb[4] = {0xad, 0xd1, 0xa8, 0x01};
+	uint8_t air[25], built[25];
+	for (int i = 0; i < 25; ++i) air[i] = (uint8_t)(sb[i/8] >> (i%8) & 1);
+	GsmSync::schBuild(43, 1234568, built);
+	int sbBsic, sbFn;
+	GsmSync::schParse(air, sbBsic, sbFn);
+	if (memcmp(air, built, sizeof(air)) != 0 || sbBsic != 43 || sbFn != 1234568) {
+		LOGE("sch: info bits not in 04.08 octet order, bsic=%d fn=%d", sbBsic, sbFn);
+		++errors;
+	}
+	for (int fn : fns) {
+		const int burst = 625*sps/4;
+		const int n = 4*burst;
+		const jlong ts = 100000, sch = ts + burst + 5; // SCH starts at tick sch
+		Array<float> x(2*n);
+		uint8_t bits[148], prev = 0;
+		double ph = 0;
+		unsigned rnd = 7;
+		for (int b = 0; b < 4; ++b) {
+			if (b == 1) GsmSync::schBurst(0x2b, fn, bits);
+			else for (int i = 0; i < 148; ++i) { rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5; bits[i] = rnd & 1; }
+			mskModulate(bits, 148, sps, ph, prev, &x[2*(b*burst + 5)]);
+		}
+		GsmSync sync(GSMRATE*sps, sps);
+		SchInfo info;
+		if (!sync.sch(&x[0], n, ts, sch + 3*sps, 8, 0, info) || info.bsic != 0x2b || info.fn != fn) {
+			LOGE("sch: fn %d not decoded", fn);
+			++errors;
+			continue;
+		}
+		// MSK bit is complete at last sample of its symbol
+		if (Math::abs(info.ts - (double)(sch + sps - 1)) > 0.5) {
+			LOGE("sch: burst at %.2lf expected %ld", info.ts, sch + sps - 1);
+			++errors;
+		}
+		GsmClock clock(GSMRATE*sps);
+		clock.set(info.ts, info.fn);
+		jlong t = (jlong)info.ts + 3*sps*1250/2 + 5*burst + burst/2; // 17.5 bursts later: TN1 two frames later
+		GsmTime g = clock.toGsm(t);
+		if (g.fn != GsmClock::fnAdd(fn, 2) || g.tn != 1) {
+			LOGE("sch: clock fn=%d tn=%d sym=%.2lf", g.fn, g.tn, g.symbol);
+			++errors;
+		}
+		double back = clock.toTick(g.fn, g.tn, t);
+		if (back > (double)t || (double)t - back > burst) ++errors;
+	}
+	LOGN("sch(%s): errors=%d", GsmSync::kernel(), errors);
+}
+
+// timeslot sequence and 156/157 lengths, views checked against sample pattern
+void burstSlicer(int sps, boolean mirror) {
+	SpscSampleBuffer rxb(1<<13, GSMRATE*sps, mirror);
+	GsmClock clock(GSMRATE*sps);
+	clock.set(1000.0, FRAME_MODULUS - 2);
+	BurstSlicer slicer(rxb, clock, 4*sps);
+	slicer.start(1000 - 10);
+	const jlong retune = 50000, settle = 100; // LO settling window
+	rxb.unsettled(retune, retune + settle);
+
+	const int chunk = 1000;
+	Array<short> pkt(2*chunk);
+	BurstView v[8];
+	int errors = 0, bursts = 0, unsettled = 0, fn = FRAME_MODULUS - 2, tn = 0;
+	jlong ts = 1000;
+	for (jlong t = 0; t < 200000; t += chunk) {
+		for (int i = 0; i < chunk; ++i) {
+			pkt[2*i] = samplePattern(t+i, 0);
+			pkt[2*i+1] = samplePattern(t+i, 1);
+		}
+		if (rxb.write(&pkt[0], chunk, t) != chunk) ++errors;
+		int n;
+		while ((n = slicer.next(v, 8)) > 0) {
+			for (int k = 0; k < n; ++k, ++bursts) {
+				int len = sps == 1 ? (tn % 4 == 0 ? 157 : 156) : 625*sps/4;
+				if (v[k].fn != fn || v[k].tn != tn || v[k].ts != ts || v[k].len != len) {
+					LOGE("slicer: fn=%d tn=%d ts=%ld len=%d, expected fn=%d tn=%d ts=%ld len=%d",
+						v[k].fn, v[k].tn, v[k].ts, v[k].len, fn, tn, ts, len);
+					++errors;
+				}
+				if (v[k].settled != (ts + len <= retune || ts >= retune + settle)) ++errors;
+				if (!v[k].settled) ++unsettled;
+				for (int i = 0; i < v[k].len + 4*sps; ++i) {
+					if (v[k].ptr[2*i] != samplePattern(ts+i, 0) || v[k].ptr[2*i+1] != samplePattern(ts+i, 1)) {
+						++errors;
+						break;
+					}
+				}
+				ts += len;
+				if (++tn == 8) { tn = 0; fn = GsmClock::fnAdd(fn, 1); }
+			}
+		}
+	}
+	if (unsettled == 0 || rxb.settled(retune) != retune + settle) ++errors;
+	LOGN("slicer(sps=%d%s): %d bursts, unsettled=%d, copied=%ld, lost=%ld, errors=%d", sps, mirror ? ",mirrored" : "",
+		bursts, unsettled, slicer.getCopied(), slicer.getLost(), errors);
+}
+
+// lookup table against 05.02 formula, MAIO orthogonality and even ARFCN usage
+void hoppingSequence() {
+	const int sizes[] = {1, 4, 7, 16, 64};
+	int errors = 0;
+	jlong tm = System.currentTimeMillis();
+	for (int n : sizes) {
+		Array<int> ma(n);
+		for (int i = 0; i < n; ++i) ma[i] = 512 + 3*i;
+		for (int hsn : {0, 1, 45, 63}) {
+			HoppingSequence a(ma, hsn, 0), b(ma, hsn, n - 1);
+			Array<int> used(n);
+			for (int i = 0; i < n; ++i) used[i] = 0;
+			for (int fn = 0; fn < FRAME_MODULUS; fn += 5) {
+				if (a.index(fn) != HoppingSequence::mai(fn, n, hsn, 0)) ++errors;
+				if (n > 1 && a.arfcn(fn) == b.arfcn(fn)) ++errors;
+				++used[a.index(fn)];
+			}
+			double mean = (double)(FRAME_MODULUS/5 + 1) / n;
+			for (int i = 0; i < n; ++i) {
+				if (fabs(used[i] - mean) > 0.2*mean) {
+					LOGE("hopping N=%d HSN=%d: MAI %d used %d times, mean %.0f", n, hsn, i, used[i], mean);
+					++errors;
+				}
+			}
+		}
+	}
+	// cyclic hopping just steps through MA
+	Array<int> ma(3);
+	ma[0] = 10; ma[1] = 20; ma[2] = 30;
+	HoppingSequence c(ma, 0, 1);
+	if (c.arfcn(0) != 20 || c.arfcn(1) != 30 || c.arfcn(2) != 10) ++errors;
+	LOGN("hopping: %ld ms, errors=%d", System.currentTimeMillis() - tm, errors);
+}
+
+// normal bursts through 2-path channel with noise, bit errors and bursts/s
+void gmskDemod() {
+	const int sps = 4, len = 625, count = 64, loops = 50, tsc = 5;
+	Array<short> x(2*len*count);
+	Array<uint8_t> bits(BURST_BITS*count);
+	Array<float> f(2*len);
+	unsigned rnd = 11;
+	for (int b = 0; b < count; ++b) {
+		uint8_t *d = &bits[b*BURST_BITS], prev = 0;
+		for (int i = 0; i < BURST_BITS; ++i) { rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5; d[i] = rnd & 1; }
+		for (int i = 0; i < 3; ++i) d[i] = d[BURST_BITS-1-i] = 0;
+		memcpy(d + 61, GmskDemod::training(tsc), 26);
+		for (int i = 0; i < 2*len; ++i) f[i] = 0;
+		double ph = 0.3*b;
+		mskModulate(d, BURST_BITS, sps, ph, prev, &f[0]);
+		short *o = &x[2*b*len];
+		for (int i = 0; i < len; ++i) {
+			// echo one symbol later
+			float er = 0, ei = 0;
+			if (i >= sps) {
+				er = 0.4f*(0.54f*f[2*(i-sps)] - 0.84f*f[2*(i-sps)+1]);
+				ei = 0.4f*(0.84f*f[2*(i-sps)] + 0.54f*f[2*(i-sps)+1]);
+			}
+			rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+			float nr = (float)((int)(rnd & 0xff) - 128) / 4096, ni = (float)((int)(rnd >> 8 & 0xff) - 128) / 4096;
+			o[2*i] = (short)((f[2*i] + er + nr) * 16384);
+			o[2*i+1] = (short)((f[2*i+1] + ei + ni) * 16384);
+		}
+	}
+	Array<BurstView> v(count);
+	Array<BurstSoft> out(count);
+	for (int b = 0; b < count; ++b) {
+		v[b].fn = 0; v[b].tn = b & 7; v[b].ts = (jlong)b*len;
+		v[b].ptr = &x[2*b*len]; v[b].len = len;
+	}
+	GmskDemod demod(sps);
+	jlong tm = System.currentTimeMillis();
+	for (int l = 0; l < loops; ++l) demod.demod(&v[0], count, tsc, &out[0]);
+	tm = System.currentTimeMillis() - tm;
+
+	int errors = 0;
+	for (int b = 0; b < count; ++b) {
+		for (int i = 3; i < BURST_BITS-3; ++i) {
+			if ((out[b].soft[i] < 0) != (bits[b*BURST_BITS + i] != 0)) ++errors;
+		}
+	}
+	double bps = (double)loops*count*1e3 / (double)(tm + 1);
+	LOGN("gmsk(%s): snr %.1f dB, bit errors=%d, %.0f bursts/s (%.1f ARFCNs x 8 TN)", GmskDemod::kernel(),
+		out[0].snr, errors, bps, bps / (8 * 26 / 120e-3));
+}
+
+// xCCH blocks with noisy soft bits through deinterleaver and decoder, blocks/s
+void channelDecoder() {
+	const int count = 64, loops = 50;
+	Array<uint8_t> data(count*XCCH_BYTES);
+	Array<BurstSoft> bursts(4*count);
+	Array<float> coded(count*XCCH_CODED);
+	Array<XcchBlock> out(count);
+	unsigned rnd = 5;
+	for (int b = 0; b < count; ++b) {
+		uint8_t bits[4][BURST_BITS];
+		for (int i = 0; i < XCCH_BYTES; ++i) { rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5; data[b*XCCH_BYTES + i] = (uint8_t)rnd; }
+		ChannelDecoder::encode(&data[b*XCCH_BYTES], bits);
+		for (int k = 0; k < 4; ++k) {
+			for (int i = 0; i < BURST_BITS; ++i) {
+				rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+				float n = (float)((int)(rnd & 0xff) - 128) / 56; // ~6% of bits flipped
+				bursts[4*b + k].soft[i] = (bits[k][i] ? -2.0f : 2.0f) + n;
+			}
+		}
+	}
+	int flipped = 0;
+	ChannelDecoder decoder;
+	jlong tm = System.currentTimeMillis();
+	for (int l = 0; l < loops; ++l) {
+		for (int b = 0; b < count; ++b) {
+			const BurstSoft *bb[4] = {&bursts[4*b], &bursts[4*b+1], &bursts[4*b+2], &bursts[4*b+3]};
+			ChannelDecoder::deinterleave(bb, &coded[b*XCCH_CODED]);
+		}
+		decoder.decode(&coded[0], count, &out[0]);
+	}
+	tm = System.currentTimeMillis() - tm;
+	int errors = 0;
+	for (int b = 0; b < count; ++b) {
+		if (!out[b].ok || memcmp(out[b].data, &data[b*XCCH_BYTES], XCCH_BYTES) != 0) ++errors;
+		flipped += out[b].errors;
+	}
+	LOGN("xcch(%s): %.1f corrected bits/block, %.0f blocks/s, errors=%d", ChannelDecoder::kernel(),
+		(double)flipped / count, (double)loops*count*1e3 / (double)(tm + 1), errors);
+}
+
+// synthetic cell through backend recv, rx buffer, SCH sync, slicer, demod and xCCH decoder;
+// the same samples replayed from IQ file
+void synthCell() {
+	const int sps = 4, fn0 = 51*100; // starts with FCCH
+	const double rate = GSMRATE*sps, freq = 1822.8e6;
+	const int total = 52*1250*sps;
+	RadioBackend *b = RadioBackend::create(String::format("synth,throttle=0,bsic=43,fn=%d,snr=20", fn0));
+	int errors = 0;
+	if (b == null || b->setRxRate(rate) != rate) {
+		LOGE("synth: backend not created");
+		return ;
+	}
+	b->tune({freq, 0, 0, 0, false}, 0, false, 0);
+	b->startRx(0);
+	SpscSampleBuffer rxb(1<<19, rate, true);
+	RxMeta md;
+	int len;
+	jlong tm = System.currentTimeMillis();
+	while (rxb.last() < total) {
+		int n = 3*625;
+		short *p = rxb.reserve(n, rxb.last());
+		int r = b->recv(&p, n, md, 0.1);
+		if (md.error != RxError::NONE || md.ts != rxb.last()) { ++errors; break; }
+		rxb.commit(r);
+	}
+	tm = System.currentTimeMillis() - tm;
+	LOGN("synth: %.1lf Msps (%.0fx real time)", (double)total / (double)(tm + 1) / 1e3, (double)total / rate * 1e3 / (double)(tm + 1));
+	Array<short> iq(2*total);
+	memcpy(&iq[0], rxb.peek(0, len = total), (size_t)total*2*sizeof(short));
+	const char *path = "/tmp/trm-synth.iq";
+	FILE *f = fopen(path, "wb");
+	if (f == null || len != total || fwrite(&iq[0], 2*sizeof(short), (size_t)total, f) != (size_t)total) ++errors;
+	if (f) fclose(f);
+
+	// SCH in frame after FCCH
+	const int n = 2*625*sps;
+	Array<float> x(2*n);
+	len = n;
+	const jlong sch = 1250*sps;
+	toFloat(&x[0], rxb.peek(sch - n/4, len), 1.0f/16384, 2*n);
+	GsmSync sync(rate, sps);
+	SchInfo info;
+	if (len != n || !sync.sch(&x[0], n, sch - n/4, sch + 3*sps, 8, 0, info) || info.bsic != 43 || info.fn != fn0 + 1) ++errors;
+	else if (Math::abs(info.ts - (double)(sch + sps - 1)) > 0.5) ++errors;
+
+	GsmClock clock(rate);
+	clock.set(info.ts - (double)sch, fn0);
+	BurstSlicer slicer(rxb, clock, 4*sps);
+	slicer.start(0);
+	GmskDemod demod(sps);
+	ChannelDecoder decoder;
+	BurstView v[8];
+	BurstSoft soft[8], blk[4];
+	Array<float> coded(XCCH_CODED);
+	int blocks = 0, good = 0, k;
+	while ((k = slicer.next(v, 8)) > 0) {
+		demod.demod(v, k, 43 & 7, soft);
+		for (int i = 0; i < k; ++i) {
+			int bi = v[i].tn == 0 ? ChannelDecoder::xcchBurst(v[i].fn) : -1;
+			if (bi < 0) continue;
+			blk[bi] = soft[i];
+			if (bi < 3) continue;
+			const BurstSoft *bb[4] = {&blk[0], &blk[1], &blk[2], &blk[3]};
+			ChannelDecoder::deinterleave(bb, &coded[0]);
+			XcchBlock out;
+			++blocks;
+			if (decoder.decode(&coded[0], 1, &out) == 1 && out.data[1] == (uint8_t)(v[i].fn / 51)) ++good;
+		}
+	}
+	if (blocks != 10 || good != blocks) ++errors;
+	delete b;
+
+	// replay of the synthesized samples
+	b = RadioBackend::create(String::format("file=%s,sps=%d,throttle=0,loop=0", path, sps));
+	// file rate is fixed
+	if (b == null || b->setRxRate(GSMRATE) != rate) ++errors;
+	else {
+		b->startRx(0);
+		Array<short> pkt(2*2000);
+		short *pp = &pkt[0];
+		jlong t = 0;
+		for (;;) {
+			int r = b->recv(&pp, 2000, md, 0.0);
+			if (r == 0) break;
+			if (md.ts != t || memcmp(pp, &iq[2*(int)t], (size_t)r*2*sizeof(short)) != 0) ++errors;
+			t += r;
+		}
+		if (t != total || md.error != RxError::TIMEOUT) ++errors;
+	}
+	delete b;
+	remove(path);
+	LOGN("synth: sch fn=%d bsic=%d q=%.2f, xcch blocks %d/%d, errors=%d", info.fn, info.bsic, info.quality, good, blocks, errors);
+}
+
+// 2 channel recording with a gap, channel 1 replayed through file backend using the sidecar
+void iqRecorder() {
+	const int chans = 2, pkt = 3*625;
+	const jlong t0 = 5000, gapAt = 700000, gap = 12345, total = 1500000;
+	const char *base = "/tmp/trm-rec";
+	IqRecorder rec(base, chans, GSMRATE*4, 4);
+	int errors = 0;
+	if (!rec.open()) {
+		LOGE("iqRecorder: can't open");
+		return ;
+	}
+	Array<short> x(2*chans*pkt);
+	const short *bufs[chans] = {&x[0], &x[2*pkt]};
+	jlong tm = System.currentTimeMillis();
+	for (jlong t = t0, n = 0; n < total; n += pkt) {
+		for (int ch = 0; ch < chans; ++ch) {
+			for (int i = 0; i < pkt; ++i) {
+				x[2*(ch*pkt + i)] = samplePattern(t + i + ch, 0);
+				x[2*(ch*pkt + i) + 1] = samplePattern(t + i + ch, 1);
+			}
+		}
+		rec.record(bufs, pkt, t);
+		t += pkt;
+		if (t >= gapAt && t < gapAt + pkt) t += gap;
+	}
+	tm = System.currentTimeMillis() - tm;
+	rec.close();
+	if (rec.getWritten() + rec.getDropped() != (total + pkt - 1) / pkt * pkt) ++errors;
+
+	RadioBackend *b = RadioBackend::create(String::format("file=%s.ch1.iq,throttle=0,loop=0", base));
+	jlong replayed = 0, gaps = 0, shift = 0, next = -1;
+	if (b == null) ++errors;
+	else {
+		b->setRxRate(GSMRATE);
+		b->startRx(0);
+		Array<short> y(2*2000);
+		short *p = &y[0];
+		RxMeta md;
+		int r;
+		while ((r = b->recv(&p, 2000, md, 0.0)) > 0) {
+			if (next < 0) shift = md.ts - t0;
+			else if (md.ts != next) ++gaps;
+			for (int i = 0; i < r; ++i) {
+				jlong t = md.ts - shift + i + 1;
+				if (p[2*i] != samplePattern(t, 0) || p[2*i+1] != samplePattern(t, 1)) { ++errors; break; }
+			}
+			replayed += r;
+			next = md.ts + r;
+		}
+		if (replayed != rec.getWritten() || (rec.getDropped() == 0 && gaps != 1)) ++errors;
+		delete b;
+	}
+	for (int ch = 0; ch < chans; ++ch) {
+		remove(String::format("%s.ch%d.iq", base, ch).cstr());
+		remove(String::format("%s.ch%d.iq.meta", base, ch).cstr());
+	}
+	LOGN("iqrec: %.0f Msps per channel, dropped %ld, replayed %ld samples, gaps=%ld, errors=%d",
+		(double)total / (double)(tm + 1) / 1e3, rec.getDropped(), replayed, gaps, errors);
+}
+
+// zero-copy window crossing end of mirrored ring
+void mirroredWindow() {
+	const int burst = 625;
+	SampleBuffer b(4096, GSMRATE * 4);
+	SpscSampleBuffer sb(4096, GSMRATE * 4);
+	if (!sb.isMirrored()) {
+		LOGW("mirrored memory not available");
+		return ;
+	}
+	short pkt[2*burst];
+	int errors = 0;
+	for (jlong t = 0; t < 20000; t += burst) {
+		for (int i = 0; i < burst; ++i) {
+			pkt[2*i] = samplePattern(t+i, 0);
+			pkt[2*i+1] = samplePattern(t+i, 1);
+		}
+		b.write(pkt, burst, t);
+		sb.write(pkt, burst, t);
+		int n1 = burst, n2 = burst;
+		const short *p1 = b.peek(t, n1);
+		const short *p2 = sb.peek(t, n2);
+		if (n1 != burst || n2 != burst) { ++errors; break; }
+		for (int i = 0; i < burst; ++i) {
+			if (p1[2*i] != pkt[2*i] || p1[2*i+1] != pkt[2*i+1]) ++errors;
+			if (p2[2*i] != pkt[2*i] || p2[2*i+1] != pkt[2*i+1]) ++errors;
+		}
+		b.consume(burst);
+		sb.consume(burst);
+	}
+	if (errors) LOGE("mirroredWindow FAILED errors=%d", errors);
+	else LOGN("mirrored: all windows contiguous");
+}
+
+// buffers placed in preallocated arena
+// free hugepages and their size from /proc/meminfo
+unsigned long freeHugePages(size_t& size) {
+	unsigned long n = 0, kb = 2048;
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f != null) {
+		char line[128];
+		while (fgets(line, sizeof(line), f)) {
+			sscanf(line, "HugePages_Free: %lu", &n);
+			sscanf(line, "Hugepagesize: %lu kB", &kb);
+		}
+		fclose(f);
+	}
+	size = kb << 10;
+	return n;
+}
+
+void arenaBuffers() {
+	int buf_len = SAMPLE_BUF_SZ / sizeof(uint32_t);
+	const int burst = 625;
+	size_t hp = 0;
+	unsigned long hugePages = freeHugePages(hp);
+	unsigned long ringPages = ((size_t)buf_len*2*sizeof(short) + hp - 1) / hp;
+	unsigned long stagePages = 1;
+	SampleArena arena;
+	if (!arena.create(2, buf_len, 2*burst*sizeof(short))) {
+		LOGE("arenaBuffers FAILED");
+		return ;
+	}
+	SpscSampleBuffer rx(buf_len, GSMRATE * 4, arena);
+	SampleBuffer tx(buf_len, GSMRATE * 4, arena);
+	short *pkt = (short *)arena.staging(2*burst*sizeof(short));
+	int errors = 0;
+	for (jlong t = 0; t < 4*buf_len; t += burst) {
+		for (int i = 0; i < burst; ++i) {
+			pkt[2*i] = samplePattern(t+i, 0);
+			pkt[2*i+1] = samplePattern(t+i, 1);
+		}
+		if (rx.write(pkt, burst, t) != burst || tx.write(pkt, burst, t) != burst) ++errors;
+		int n1 = burst, n2 = burst;
+		const short *p1 = rx.peek(t, n1);
+		const short *p2 = tx.peek(t, n2);
+		if (n1 <= 0 || n2 <= 0 || memcmp(p1, pkt, n1*2*sizeof(short)) || memcmp(p2, pkt, n2*2*sizeof(short))) ++errors;
+		rx.consume(burst);
+		tx.consume(burst);
+	}
+	// everything fits into hugepages free before, so it must have got them
+	if (hugePages >= 2*ringPages + stagePages && !arena.isHuge()) ++errors;
+	if (errors) LOGE("arenaBuffers FAILED errors=%d %s", errors, arena.toString().cstr());
+	else LOGN("arena: %s", arena.toString().cstr());
+}
+
 void runTests() {
 	simpleReadWrite();
+	bufferSpace();
+	sendBurstBusy();
+	spscReadWrite(true);
+	spscReadWrite(false);
+	captureIdle();
+	mirroredWindow();
+	arenaBuffers();
+	channelizerTones();
+	resampleTone(390625*4, GSMRATE*4);
+	resampleTone(400000*4, GSMRATE*4);
+	resampleTone(GSMRATE*12, GSMRATE*4);
+	resampleTone(GSMRATE*4, GSMRATE);
+	powerScanBenchmark();
+	fcchDetect();
+	schSync();
+	burstSlicer(1, true);
+	burstSlicer(4, true);
+	burstSlicer(1, false);
+	hoppingSequence();
+	gmskDemod();
+	channelDecoder();
+	synthCell();
+	iqRecorder();
+	convertBenchmark();
 }
 
 int main(int argc, const char *argv[]) {
@@ -64,6 +951,6 @@ int main(int argc, const char *argv[]) {
 		return 0;
 	}
 	MobileStation ms;
-	ms.start();	
+	ms.start(argc > 1 ? argv[1] : "");
 	return 0;
 }
@@ -1,6 +1,478 @@
+#include <lang/System.hpp>
+
 #include "Transcom.hpp"
+#include "TrxProtocol.hpp"
+#include "TrxClock.hpp"
+#include "BurstQueue.hpp"
+#include "TrxControl.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#ifdef ALLOC_CHECK
+namespace {
+std::atomic<long> allocations{0};
+}
+
+// counts heap allocations (make ALLOC_CHECK=1), tests check hot paths don't allocate
+void *operator new(size_t n) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(n ? n : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+void operator delete(void *p) noexcept {
+	free(p);
+}
+long allocationCount() { return allocations.load(); }
+#else
+long allocationCount() { return -1; } // not counted
+#endif
+
+// TRXD round trip and TRXC messages, then ns per burst of encode + decode + clock parse
+void trxProtocol() {
+	int errors = 0;
+	uint8_t bits[TRXD_BITS], tx[TRXD_TX_SIZE], rx[TRXD_RX_SIZE];
+	for (int i = 0; i < TRXD_BITS; ++i) bits[i] = (uint8_t)((i * 7) >> 2 & 1);
+
+	int l = TrxProtocol::encodeBurst(tx, 5, 2715647, 12, bits, TRXD_BITS);
+	if (l != TRXD_TX_SIZE || tx[0] != 5 || tx[1] != 0x00 || tx[2] != 0x29 || tx[3] != 0x6f || tx[4] != 0xff
+			|| tx[5] != 12 || memcmp(tx + 6, bits, TRXD_BITS)) ++errors;
+	l = TrxProtocol::encodeBurst(tx, 1, 0, 0, bits, 100);
+	for (int i = 6 + 100; i < TRXD_TX_SIZE; ++i) if (tx[i]) ++errors;
+
+	// rx PDU: tn, fn, -rssi, toa*256, soft bits
+	memset(rx, 0, sizeof(rx));
+	rx[0] = 3; rx[1] = 0x00; rx[2] = 0x01; rx[3] = 0x02; rx[4] = 0x03;
+	rx[5] = 87; rx[6] = 0xff; rx[7] = 0x80; // toa -0.5
+	for (int i = 0; i < TRXD_BITS; ++i) rx[8 + i] = (uint8_t)(i * 13);
+	TrxdRx b;
+	if (!TrxProtocol::decodeBurst(rx, TRXD_RX_SIZE, b) || b.tn != 3 || b.fn != 0x010203 || b.rssi != -87 || b.toa != -0.5f) ++errors;
+	for (int i = 0; i < TRXD_BITS; ++i) if (b.soft[i] != (int8_t)(127 - (uint8_t)(i * 13))) ++errors;
+	if (TrxProtocol::decodeBurst(rx, TRXD_RX_SIZE - 1, b)) ++errors;
+	rx[0] = 8;
+	if (TrxProtocol::decodeBurst(rx, TRXD_RX_SIZE, b)) ++errors;
+	rx[0] = 3;
+
+	char cmd[TRXC_MAX];
+	const struct { TrxCommand c; int p; const char *s; } cmds[] = {
+		{TrxCommand::POWEROFF, 0, "CMD POWEROFF"},
+		{TrxCommand::RXTUNE, 930400, "CMD RXTUNE 930400"},
+		{TrxCommand::SETPOWER, -10, "CMD SETPOWER -10"},
+		{TrxCommand::SETSLOT, (3 << 8) | 7, "CMD SETSLOT 3 7"},
+	};
+	for (const auto& c : cmds) {
+		l = TrxProtocol::encodeCommand(cmd, sizeof(cmd), c.c, c.p);
+		if (l != (int)strlen(c.s) + 1 || strcmp(cmd, c.s)) { ++errors; LOGE("encodeCommand '%s'", cmd); }
+	}
+
+	uint32_t fn = 0;
+	const char *clk = "IND CLOCK 2715647";
+	if (!TrxProtocol::parseClock(clk, (int)strlen(clk) + 1, fn) || fn != 2715647) ++errors;
+	const char *badClk[] = {"IND CLOCK", "IND CLOCK x1", "IND CLOCKS 1", "IND CLOCK 12 3", "IND CLOCK 99999999999"};
+	for (const char *m : badClk) if (TrxProtocol::parseClock(m, (int)strlen(m), fn)) { ++errors; LOGE("parseClock '%s'", m); }
+
+	TrxRsp rsp;
+	const char *r1 = "RSP SETSLOT 0 3 7";
+	if (!TrxProtocol::parseResponse(r1, (int)strlen(r1) + 1, rsp) || rsp.cmd != TrxCommand::SETSLOT || rsp.status != 0
+			|| rsp.params != 2 || rsp.param[0] != 3 || rsp.param[1] != 7) ++errors;
+	const char *r2 = "RSP POWERON -1";
+	if (!TrxProtocol::parseResponse(r2, (int)strlen(r2), rsp) || rsp.cmd != TrxCommand::POWERON || rsp.status != -1 || rsp.params != 0) ++errors;
+	const char *badRsp[] = {"RSP SETSLOTS 0", "RSP POWERON", "RSP NOPE 0", "IND CLOCK 1"};
+	for (const char *m : badRsp) if (TrxProtocol::parseResponse(m, (int)strlen(m), rsp)) { ++errors; LOGE("parseResponse '%s'", m); }
+
+	const int loops = 2000000;
+	char ind[TRXC_MAX];
+	uint32_t sum = 0;
+	long allocs = allocationCount();
+	jlong tm = System.currentTimeMillis();
+	for (int i = 0; i < loops; ++i) {
+		TrxProtocol::encodeBurst(tx, (uint8_t)(i & 7), (uint32_t)i, 0, bits, TRXD_BITS);
+		rx[4] = (uint8_t)i;
+		TrxProtocol::decodeBurst(rx, TRXD_RX_SIZE, b);
+		sum += b.fn + (uint8_t)b.soft[i % TRXD_BITS] + tx[4];
+		if ((i & 7) == 0) {
+			// one clock indication per frame
+			memcpy(ind, "IND CLOCK ", 10);
+			int n = 10 + snprintf(ind + 10, sizeof(ind) - 10, "%d", i >> 3);
+			TrxProtocol::parseClock(ind, n, fn);
+			sum += fn;
+		}
+	}
+	tm = System.currentTimeMillis() - tm;
+	if (allocs >= 0) {
+		allocs = allocationCount() - allocs;
+		if (allocs) ++errors;
+	}
+
+	LOGD("trxProtocol: checksum %u", sum);
+	LOGN("trxProtocol: %.1lf ns/burst (encode+decode+clock/8), allocations=%ld (-1 not counted), errors=%d",
+			(double)tm * 1e6 / loops, allocs, errors);
+	if (errors) LOGE("trxProtocol FAILED");
+}
+
+// two UDP sockets on loopback connected to each other
+boolean udpPair(int fd[2]) {
+	struct sockaddr_in a[2];
+	for (int i = 0; i < 2; ++i) {
+		fd[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		memset(&a[i], 0, sizeof(a[i]));
+		a[i].sin_family = AF_INET;
+		a[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t l = sizeof(a[i]);
+		if (fd[i] < 0 || bind(fd[i], (struct sockaddr *)&a[i], l) || getsockname(fd[i], (struct sockaddr *)&a[i], &l)) return false;
+	}
+	return connect(fd[0], (struct sockaddr *)&a[1], sizeof(a[1])) == 0 && connect(fd[1], (struct sockaddr *)&a[0], sizeof(a[0])) == 0;
+}
+
+// bursts of a frame both ways, a datagram per burst, then ns per burst of send() per burst
+// and one sendmmsg per frame
+void trxdBatch() {
+	int fd[2];
+	if (!udpPair(fd)) {
+		LOGE("trxdBatch: no loopback sockets: %s", strerror(errno));
+		return ;
+	}
+	int errors = 0;
+	uint8_t bits[TRXD_BITS], pdu[TRXD_RX_SIZE + 1];
+	memset(bits, 1, sizeof(bits));
+	TrxdBatch batch;
+	for (int tn = 0; tn < 8; ++tn) if (!batch.add((uint8_t)tn, 100, 0, bits, TRXD_BITS)) ++errors;
+	if (batch.add(0, 101, 0, bits, TRXD_BITS)) ++errors;
+	if (batch.flush(fd[0]) != 8 || batch.sendCalls != 1) ++errors;
+	int bursts = 0;
+	ssize_t l;
+	while ((l = recv(fd[1], pdu, sizeof(pdu), MSG_DONTWAIT)) > 0) {
+		if (l != TRXD_TX_SIZE || pdu[0] != bursts) ++errors;
+		++bursts;
+	}
+	if (bursts != 8) ++errors;
+
+	// uplink: a frame as 8 datagrams, drained by one recvmmsg
+	TrxdRx b;
+	memset(&b, 0, sizeof(b));
+	b.fn = 200;
+	b.rssi = -60;
+	b.toa = 1.5f;
+	for (int tn = 0; tn < 8; ++tn) {
+		b.tn = (uint8_t)tn;
+		b.soft[tn] = (int8_t)tn;
+		int n = TrxProtocol::encodeUplink(pdu, b);
+		if (send(fd[1], pdu, (size_t)n, 0) != n) ++errors;
+	}
+	bursts = 0;
+	jlong rc = batch.recvCalls;
+	while (batch.receive(fd[0]) > 0) {
+		while (batch.next(b)) {
+			if (b.tn != bursts || b.fn != 200 || b.rssi != -60 || b.toa != 1.5f || b.soft[b.tn] != b.tn) ++errors;
+			++bursts;
+		}
+	}
+	if (bursts != 8 || batch.recvCalls - rc != 2) ++errors;
+	// header of other TRXD versions (never negotiated) isn't taken for a burst
+	jlong e = batch.errors;
+	int n = TrxProtocol::encodeUplink(pdu, b);
+	pdu[0] |= 2 << 4;
+	if (send(fd[1], pdu, (size_t)n, 0) != n) ++errors;
+	while (batch.receive(fd[0]) > 0) while (batch.next(b)) ++errors;
+	if (batch.errors != e + 1) ++errors;
+
+	const int frames = 20000;
+	double ns[2];
+	jlong calls[2];
+	for (int m = 0; m < 2; ++m) {
+		jlong c = batch.sendCalls;
+		jlong tm = System.currentTimeMillis();
+		for (int f = 0; f < frames; ++f) {
+			for (int tn = 0; tn < 8; ++tn) {
+				batch.add((uint8_t)tn, (uint32_t)f, 0, bits, TRXD_BITS);
+				if (m == 0) batch.flush(fd[0]);
+			}
+			batch.flush(fd[0]);
+			// receiver socket drops what doesn't fit, only sending is measured
+			if ((f & 63) == 0) while (recv(fd[1], pdu, sizeof(pdu), MSG_DONTWAIT) > 0) ;
+		}
+		tm = System.currentTimeMillis() - tm;
+		ns[m] = (double)tm * 1e6 / (frames * 8);
+		calls[m] = batch.sendCalls - c;
+	}
+	close(fd[0]);
+	close(fd[1]);
+	LOGN("trxdBatch: per burst %.0lf ns (%ld calls), sendmmsg %.0lf ns (%ld calls), errors=%d",
+			ns[0], calls[0], ns[1], calls[1], errors);
+	if (errors) LOGE("trxdBatch FAILED");
+}
+
+// frame timer on epoll across FRAME_MODULUS wrap: contiguous frames through an oversleep,
+// IND CLOCK ahead of the timer and a clock jump, wakeup latency histogram
+void trxClock() {
+	TrxClock c;
+	LatencyHistogram h;
+	int ep = epoll_create1(0);
+	struct epoll_event ev;
+	ev.events = EPOLLIN|EPOLLET;
+	ev.data.u32 = 0;
+	epoll_ctl(ep, EPOLL_CTL_ADD, c.getFD(), &ev);
+
+	int errors = 0;
+	int expect = FRAME_MODULUS - 50;
+	c.lock(expect, TrxClock::now());
+	expect = GsmClock::fnAdd(expect, 1);
+	int frames = 0, step = 0;
+	while (frames < 120) {
+		if (epoll_wait(ep, &ev, 1, 100) != 1) { ++errors; break; }
+		jlong t = TrxClock::now();
+		int fn;
+		int n = c.expired(t, fn);
+		if (n == 0) continue;
+		h.add(t - c.deadline());
+		if (fn != expect) { ++errors; LOGE("trxClock: fn %d expected %d", fn, expect); }
+		expect = GsmClock::fnAdd(fn, n);
+		frames += n;
+		if (step == 0 && frames >= 40) {
+			usleep((useconds_t)(3 * TRX_FRAME_NS / 1000));
+			++step;
+		}
+		else if (step == 1 && frames >= 70) {
+			// transceiver 2 frames ahead
+			c.lock(GsmClock::fnAdd(expect, 1), TrxClock::now());
+			++step;
+		}
+	}
+	if (c.missed < 3 || c.slips != 1 || c.jumps != 0 || expect > 100) ++errors;
+	int jump = GsmClock::fnAdd(expect, 1000);
+	c.lock(jump, TrxClock::now());
+	while (epoll_wait(ep, &ev, 1, 100) == 1) {
+		int fn;
+		if (c.expired(TrxClock::now(), fn) == 0) continue;
+		if (fn != GsmClock::fnAdd(jump, 1) || c.jumps != 1) ++errors;
+		break;
+	}
+	c.stop();
+	if (epoll_wait(ep, &ev, 1, 10) != 0) ++errors;
+	close(ep);
+	LOGN("trxClock: %d frames, missed %ld, slips %ld, jumps %ld, wakeup %s, errors=%d",
+			frames, c.missed, c.slips, c.jumps, h.toString().cstr(), errors);
+	if (errors) LOGE("trxClock FAILED");
+}
+
+// (tn, fn) of bursts in datagrams waiting on fd
+int receivedBursts(int fd, int *tn, int *fn, int max) {
+	uint8_t pdu[TRXD_TX_SIZE];
+	int n = 0;
+	while (recv(fd, pdu, sizeof(pdu), MSG_DONTWAIT) == TRXD_TX_SIZE && n < max) {
+		tn[n] = pdu[0] & 7;
+		fn[n] = pdu[1] << 24 | pdu[2] << 16 | pdu[3] << 8 | pdu[4];
+		++n;
+	}
+	return n;
+}
+
+// bursts queued for frames across FRAME_MODULUS wrap leave in (fn, tn) order, late,
+// skipped and too far ones are counted; then ns per frame of 8 bursts queued and sent with sendmmsg
+void burstQueue() {
+	int fd[2];
+	if (!udpPair(fd)) {
+		LOGE("burstQueue: no loopback sockets: %s", strerror(errno));
+		return ;
+	}
+	int errors = 0;
+	uint8_t bits[TRXD_BITS];
+	memset(bits, 0, sizeof(bits));
+	BurstQueue q;
+	TrxdBatch batch;
+	const int start = FRAME_MODULUS - 4;
+
+	// frame f gets timeslots tn <= f % 8, queued out of order
+	for (int i = 9; i >= 0; --i) {
+		int f = GsmClock::fnAdd(start, i);
+		for (int tn = f % 8; tn >= 0; --tn) if (!q.put(tn, f, 0, bits)) ++errors;
+	}
+	int tn[128], fn[128], n = 0, expect = 0;
+	for (int i = 0; i < 10; ++i) {
+		int f = GsmClock::fnAdd(start, i);
+		expect += f % 8 + 1;
+		q.flush(f, batch);
+		batch.flush(fd[0]);
+		n += receivedBursts(fd[1], tn + n, fn + n, 128 - n);
+	}
+	if (n != expect) ++errors;
+	for (int i = 0, k = 0; i < 10 && k < n; ++i) {
+		int f = GsmClock::fnAdd(start, i);
+		for (int t = 0; t <= f % 8; ++t, ++k) if (fn[k] != f || tn[k] != t) ++errors;
+	}
+
+	int head = q.next(); // 6 after the wrap
+	if (q.put(0, GsmClock::fnAdd(head, -1), 0, bits) || q.late != 1) ++errors;
+	if (q.put(0, GsmClock::fnAdd(head, UL_HORIZON), 0, bits) || q.rejected != 1) ++errors;
+	// loop missed two frames
+	q.put(1, head, 0, bits);
+	q.put(2, GsmClock::fnAdd(head, 1), 0, bits);
+	q.put(3, GsmClock::fnAdd(head, 2), 0, bits);
+	if (q.flush(GsmClock::fnAdd(head, 2), batch) != 1 || q.late != 3) ++errors;
+	batch.flush(fd[0]);
+	n = receivedBursts(fd[1], tn, fn, 128);
+	if (n != 1 || tn[0] != 3 || fn[0] != GsmClock::fnAdd(head, 2)) ++errors;
+
+	const int frames = 100000;
+	jlong sent = q.sent;
+	jlong tm = System.currentTimeMillis();
+	int f = q.next();
+	for (int i = 0; i < frames; ++i) {
+		int ahead = GsmClock::fnAdd(f, 20);
+		for (int t = 0; t < 8; ++t) q.put(t, ahead, 0, bits);
+		q.flush(f, batch);
+		batch.flush(fd[0]);
+		if ((i & 63) == 0) while (recv(fd[1], bits, 0, MSG_DONTWAIT) >= 0) ;
+		f = GsmClock::fnAdd(f, 1);
+	}
+	tm = System.currentTimeMillis() - tm;
+	if (q.sent - sent != (jlong)(frames - 20) * 8) ++errors;
+	close(fd[0]);
+	close(fd[1]);
+	LOGN("burstQueue: %.0lf ns/frame, queued %ld, sent %ld, late %ld, rejected %ld, errors=%d",
+			(double)tm * 1e6 / frames, q.queued, q.sent, q.late, q.rejected, errors);
+	if (errors) LOGE("burstQueue FAILED");
+}
+
+// fake transceiver: answers all commands waiting on fd, "RSP <cmd> <status> <params>";
+// drop - command name answered only from the second try, fail - command name answered with 1
+int answerCommands(int fd, const char *drop, const char *fail, int& dropped) {
+	char msg[TRXC_MAX], rsp[TRXC_MAX + 16];
+	int n = 0;
+	ssize_t l;
+	while ((l = recv(fd, msg, sizeof(msg) - 1, MSG_DONTWAIT)) > 0) {
+		msg[l] = 0;
+		char name[16], params[64] = "";
+		if (sscanf(msg, "CMD %15s %63[^\n]", name, params) < 1) continue;
+		++n;
+		if (drop && !strcmp(name, drop) && dropped++ == 0) continue;
+		int status = fail && !strcmp(name, fail) ? 1 : !strcmp(name, "SETFORMAT") ? atoi(params) : 0;
+		// like osmo-trx answers with the gain applied, limited by the hardware
+		if (!strcmp(name, "SETRXGAIN") && atoi(params) > 6) strcpy(params, "6");
+		int rl = snprintf(rsp, sizeof(rsp), "RSP %s %d %s", name, status, params);
+		send(fd, rsp, (size_t)rl + 1, 0);
+	}
+	return n;
+}
+
+// control client against fake transceiver on loopback, run in rounds: the transceiver
+// answers what it got, then the client reads responses; returns rounds with commands
+int controlRounds(TrxControl& c, int fd[2], jlong& now, const char *drop, const char *fail, int& dropped) {
+	int rounds = 0, idle = 0;
+	while (c.pending() > 0 && idle < 10) {
+		if (answerCommands(fd[1], drop, fail, dropped) > 0) { ++rounds; idle = 0; }
+		else {
+			// nothing came, let timeouts run
+			now += TRXC_TIMEOUT;
+			++idle;
+		}
+		char buf[TRXC_MAX];
+		ssize_t l;
+		TrxRsp rsp;
+		while ((l = recv(fd[0], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			if (TrxProtocol::parseResponse(buf, (int)l, rsp)) c.response(rsp, now);
+		}
+		c.poll(now);
+	}
+	return rounds;
+}
+
+// setup levels take a round trip each, a lost RSP is retransmitted, failed command aborts
+// later levels, unanswered command times out, stale RSP doesn't match
+void trxControl() {
+	int fd[2];
+	if (!udpPair(fd)) {
+		LOGE("trxControl: no loopback sockets: %s", strerror(errno));
+		return ;
+	}
+	int errors = 0;
+	jlong now = 0;
+	int setup = 0, format = -1, slots = 0, gain = 0, dropped = 0;
+	TrxControl c;
+	c.setFD(fd[0]);
+	auto levels = [&](int tsc) {
+		c.submit(TrxCommand::POWEROFF, 0, now);
+		c.barrier();
+		c.submit(TrxCommand::SETFORMAT, 0, now, [&](const TrxRsp& r) { format = r.status; }, false);
+		c.submit(TrxCommand::RXTUNE, 930400, now);
+		c.submit(TrxCommand::TXTUNE, 885400, now);
+		c.submit(TrxCommand::SETTSC, tsc, now);
+		c.submit(TrxCommand::SETBSIC, 63, now);
+		c.submit(TrxCommand::SETRXGAIN, 10, now, [&](const TrxRsp& r) { gain = r.params > 0 ? r.param[0] : -1; });
+		c.submit(TrxCommand::SETPOWER, 0, now);
+		for (int tn = 0; tn < 8; ++tn) {
+			c.submit(TrxCommand::SETSLOT, tn << 8 | 1, now, [&, tn](const TrxRsp& r) {
+				if (r.status == 0 && r.params == 2 && r.param[0] == tn) ++slots;
+			});
+		}
+		c.barrier();
+		c.submit(TrxCommand::POWERON, 0, now, [&](const TrxRsp& r) { setup = r.status; });
+	};
+
+	levels(7);
+	int rounds = controlRounds(c, fd, now, null, null, dropped);
+	if (rounds != 3 || setup != 0 || format != 0 || slots != 8 || gain != 6 || c.retransmits != 0) ++errors;
+	LOGN("trxControl: setup %d commands in %d round trips", (int)c.sent, rounds);
+
+	// first SETTSC lost
+	setup = -1;
+	levels(5);
+	rounds = controlRounds(c, fd, now, "SETTSC", null, dropped);
+	if (rounds != 4 || setup != 0 || c.retransmits != 1) ++errors;
+
+	// RXTUNE fails, POWERON isn't sent
+	setup = -1;
+	levels(7);
+	jlong sent = c.sent;
+	controlRounds(c, fd, now, null, "RXTUNE", dropped);
+	// POWEROFF went out on submit
+	if (setup != TRXC_ABORTED || c.failures != 1 || c.sent - sent != 15) ++errors;
+
+	// no answer at all
+	dropped = 0;
+	int st = 0;
+	c.submit(TrxCommand::SETPOWER, 0, now, [&](const TrxRsp& r) { st = r.status; });
+	for (int i = 0; i <= TRXC_RETRIES; ++i) {
+		now += TRXC_TIMEOUT;
+		c.poll(now);
+	}
+	if (st != TRXC_TIMEDOUT || c.pending() != 0) ++errors;
+	TrxRsp stale;
+	stale.cmd = TrxCommand::SETPOWER;
+	stale.status = 0;
+	stale.params = 1;
+	stale.param[0] = 0;
+	if (c.response(stale, now)) ++errors;
+	answerCommands(fd[1], "SETPOWER", null, dropped); // flush retransmits
+
+	close(fd[0]);
+	close(fd[1]);
+	LOGN("trxControl: sent %ld, retransmits %ld, responses %ld, unmatched %ld, failures %ld, errors=%d",
+			c.sent, c.retransmits, c.responses, c.unmatched, c.failures, errors);
+	if (errors) LOGE("trxControl FAILED");
+}
+
+void runTests() {
+	trxProtocol();
+	trxdBatch();
+	trxClock();
+	burstQueue();
+	trxControl();
+}
 
 int main(int argc, const char *argv[]) {
+	if (argc > 1 && strcmp(argv[1],"-t")==0) {
+		runTests();
+		return 0;
+	}
 	Transcom tc("localhost");
-	tc.start();	
+	tc.start();
 }